@@ -0,0 +1,95 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 WebAssembly Community Group participants
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+'''
+This measures how fast wasm binaries are read (WasmBinaryBuilder), using the
+C API. Each file is read into memory once, and then parsed into a module a
+number of times. The best time is printed, along with the throughput. Large
+real-world binaries give the most meaningful numbers.
+
+Run this from the build directory, like benchmark_relooper.py, for example
+
+  python ../scripts/benchmark_binary_reading.py a.wasm [b.wasm..]
+'''
+
+import os
+import subprocess
+import sys
+
+if os.environ.get('LD_LIBRARY_PATH'):
+  os.environ['LD_LIBRARY_PATH'] += os.pathsep + 'lib'
+else:
+  os.environ['LD_LIBRARY_PATH'] = 'lib'
+
+REPEATS = 10
+
+SOURCE = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "binaryen-c.h"
+
+int main(int argc, char** argv) {
+  FILE* f = fopen(argv[1], "rb");
+  if (!f) {
+    fprintf(stderr, "cannot open %s\n", argv[1]);
+    return 1;
+  }
+  fseek(f, 0, SEEK_END);
+  size_t size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char* data = malloc(size);
+  if (fread(data, 1, size, f) != size) {
+    fprintf(stderr, "cannot read %s\n", argv[1]);
+    return 1;
+  }
+  fclose(f);
+  int repeats = atoi(argv[2]);
+  double best = -1;
+  int i;
+  for (i = 0; i < repeats; i++) {
+    clock_t start = clock();
+    BinaryenModuleRef module = BinaryenModuleRead(data, size);
+    double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+    BinaryenModuleDispose(module);
+    if (best < 0 || t < best) best = t;
+  }
+  printf("%zu bytes: %.4f s\n", size, best);
+  return 0;
+}
+'''
+
+if __name__ == '__main__':
+  files = sys.argv[1:]
+  if not files:
+    print(__doc__)
+    sys.exit(1)
+  open('benchmark_binary_reading.c', 'w').write(SOURCE)
+  root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+  cmd = [os.environ.get('CC') or 'gcc', '-O2', 'benchmark_binary_reading.c',
+         '-I' + os.path.join(root, 'src'), '-lbinaryen', '-Llib/.',
+         '-pthread', '-o', 'benchmark_binary_reading']
+  subprocess.check_call(cmd)
+  for name in files:
+    out = subprocess.check_output(['./benchmark_binary_reading', name,
+                                   str(REPEATS)]).decode()
+    size = int(out.split()[0])
+    time = float(out.split()[-2])
+    print('%-30s %10d bytes: %7.4f s  (%.1f MB/s)' %
+          (os.path.basename(name), size, time,
+           size / max(time, 0.0001) / (1024 * 1024)))
+  for temp in ['benchmark_binary_reading.c', 'benchmark_binary_reading']:
+    os.unlink(temp)
@@ -0,0 +1,176 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 WebAssembly Community Group participants
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+'''
+This measures how the relooper scales with the size of the CFG, using the
+C API. For each CFG shape its size is doubled a few times, and
+the time to reloop and render it is printed along with how much it grew, which
+is about 2x for each doubling when things are linear.
+
+Run this from the build directory, like fuzz_relooper.py, for example
+
+  python ../scripts/benchmark_relooper.py [shape..]
+'''
+
+import os
+import subprocess
+import sys
+
+if os.environ.get('LD_LIBRARY_PATH'):
+  os.environ['LD_LIBRARY_PATH'] += os.pathsep + 'lib'
+else:
+  os.environ['LD_LIBRARY_PATH'] = 'lib'
+
+# the shapes, with the sizes to start from
+SHAPES = [
+  ('switch', 4000),    # one huge switch, like test/bigswitch.cpp
+  ('diamonds', 10000), # a long chain of if-elses
+  ('loops', 10000),    # a long sequence of loops
+  ('nested', 250),     # deeply nested loops
+  ('random', 1000),    # random, mostly forward branches, often irreducible
+]
+
+DOUBLINGS = 4
+
+SOURCE = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "binaryen-c.h"
+
+static BinaryenModuleRef module;
+static RelooperBlockRef block(RelooperRef r, int i) {
+  BinaryenExpressionRef args[] = { BinaryenConst(module, BinaryenLiteralInt32(i)) };
+  return RelooperAddBlock(r, BinaryenCallImport(module, "print", args, 1, BinaryenTypeNone()));
+}
+static BinaryenExpressionRef cond(int i) {
+  return BinaryenBinary(module, BinaryenEqInt32(), BinaryenGetLocal(module, 0, BinaryenTypeInt32()), BinaryenConst(module, BinaryenLiteralInt32(i)));
+}
+int main(int argc, char** argv) {
+  const char* shape = argv[1];
+  int n = atoi(argv[2]);
+  int print = argc > 3;
+  module = BinaryenModuleCreate();
+  BinaryenType iparams[] = { BinaryenTypeInt32() };
+  BinaryenFunctionTypeRef vi = BinaryenAddFunctionType(module, "vi", BinaryenTypeNone(), iparams, 1);
+  BinaryenAddFunctionImport(module, "print", "spectest", "print", vi);
+  RelooperRef r = RelooperCreate();
+  RelooperBlockRef* b = malloc(sizeof(RelooperBlockRef) * (n + 2));
+  int i;
+  RelooperBlockRef entry;
+  srand(1);
+  if (!strcmp(shape, "switch")) {
+    BinaryenExpressionRef args[] = { BinaryenConst(module, BinaryenLiteralInt32(-1)) };
+    entry = RelooperAddBlockWithSwitch(r, BinaryenCallImport(module, "print", args, 1, BinaryenTypeNone()), BinaryenGetLocal(module, 0, BinaryenTypeInt32()));
+    RelooperBlockRef exit = block(r, -2);
+    for (i = 0; i < n; i++) {
+      b[i] = block(r, i);
+      BinaryenIndex v = i;
+      RelooperAddBranchForSwitch(entry, b[i], i + 1 < n ? &v : NULL, i + 1 < n ? 1 : 0, NULL);
+      RelooperAddBranch(b[i], exit, NULL, NULL);
+    }
+  } else if (!strcmp(shape, "diamonds")) {
+    // a chain of if-else diamonds
+    entry = b[0] = block(r, 0);
+    RelooperBlockRef curr = entry;
+    for (i = 0; i < n; i++) {
+      RelooperBlockRef l = block(r, 3 * i + 1), rr = block(r, 3 * i + 2), join = block(r, 3 * i + 3);
+      RelooperAddBranch(curr, l, cond(i), NULL);
+      RelooperAddBranch(curr, rr, NULL, NULL);
+      RelooperAddBranch(l, join, NULL, NULL);
+      RelooperAddBranch(rr, join, NULL, NULL);
+      curr = join;
+    }
+  } else if (!strcmp(shape, "loops")) {
+    // a sequence of loops each with a conditional body
+    entry = block(r, 0);
+    RelooperBlockRef heads[n + 1];
+    for (i = 0; i <= n; i++) heads[i] = block(r, 2 * i + 1);
+    RelooperAddBranch(entry, heads[0], NULL, NULL);
+    for (i = 0; i < n; i++) {
+      RelooperBlockRef body = block(r, 2 * i + 2);
+      RelooperAddBranch(heads[i], body, cond(i), NULL);
+      RelooperAddBranch(heads[i], heads[i + 1], NULL, NULL);
+      RelooperAddBranch(body, heads[i], NULL, NULL);
+    }
+  } else if (!strcmp(shape, "nested")) {
+    // nested loops
+    entry = block(r, 0);
+    RelooperBlockRef heads[n + 1];
+    RelooperBlockRef tails[n + 1];
+    for (i = 0; i < n; i++) { heads[i] = block(r, 2 * i + 1); }
+    for (i = 0; i < n; i++) { tails[i] = block(r, 2 * i + 2); }
+    RelooperBlockRef exit = block(r, -3);
+    RelooperAddBranch(entry, heads[0], NULL, NULL);
+    for (i = 0; i < n; i++) {
+      if (i + 1 < n) RelooperAddBranch(heads[i], heads[i + 1], NULL, NULL);
+      else RelooperAddBranch(heads[i], tails[i], NULL, NULL);
+      RelooperAddBranch(tails[i], heads[i], cond(i), NULL);
+      RelooperAddBranch(tails[i], i > 0 ? tails[i - 1] : exit, NULL, NULL);
+    }
+  } else {
+    // random, mostly forward, with some short back edges
+    for (i = 0; i < n; i++) b[i] = block(r, i);
+    entry = b[0];
+    for (i = 0; i < n - 1; i++) {
+      int targets[3], num = 1 + rand() % 3, j, k, found = 0;
+      for (j = 0; j < num; j++) {
+        int t;
+        if (j > 0 && rand() % 8 == 0) t = i - rand() % (i < 8 ? i + 1 : 8);
+        else t = i + 1 + rand() % (n - i - 1 < 8 ? n - i - 1 : 8);
+        for (k = 0; k < found; k++) if (targets[k] == t) break;
+        if (k == found) targets[found++] = t;
+      }
+      for (j = 0; j < found; j++) RelooperAddBranch(b[i], b[targets[j]], j + 1 < found ? cond(j) : NULL, NULL);
+    }
+  }
+  clock_t start = clock();
+  BinaryenExpressionRef body = RelooperRenderAndDispose(r, entry, 1, module);
+  double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+  BinaryenFunctionTypeRef v = BinaryenAddFunctionType(module, "v", BinaryenTypeNone(), NULL, 0);
+  BinaryenType localTypes[] = { BinaryenTypeInt32(), BinaryenTypeInt32() };
+  BinaryenAddFunction(module, "main", v, localTypes, 2, body);
+  if (print) BinaryenModulePrint(module);
+  else printf("%s %d: %.3f s\n", shape, n, t);
+  return 0;
+}
+'''
+
+if __name__ == '__main__':
+  shapes = sys.argv[1:] or [shape for shape, size in SHAPES]
+  open('benchmark_relooper.c', 'w').write(SOURCE)
+  root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+  cmd = [os.environ.get('CC') or 'gcc', '-O2', 'benchmark_relooper.c',
+         '-I' + os.path.join(root, 'src'), '-lbinaryen', '-Llib/.',
+         '-pthread', '-o', 'benchmark_relooper']
+  subprocess.check_call(cmd)
+  for shape, size in SHAPES:
+    if shape not in shapes:
+      continue
+    last = None
+    for i in range(DOUBLINGS):
+      out = subprocess.check_output(['./benchmark_relooper', shape,
+                                     str(size)]).decode()
+      time = float(out.split()[-2])
+      growth = ''
+      if last:
+        growth = '  (x%.1f)' % (time / last)
+      print('%-9s %8d: %7.3f s%s' % (shape, size, time, growth))
+      last = max(time, 0.001)
+      size *= 2
+  for temp in ['benchmark_relooper.c', 'benchmark_relooper']:
+    os.unlink(temp)
@@ -145,7 +145,8 @@ int main() {
   BinaryenExpressionRef checkBodyList[] = { halter, incer, debugger,
                                             returner };
   BinaryenExpressionRef checkBody = BinaryenBlock(module,
-    NULL, checkBodyList, sizeof(checkBodyList) / sizeof(BinaryenExpressionRef)
+    NULL, checkBodyList, sizeof(checkBodyList) / sizeof(BinaryenExpressionRef),
+    BinaryenUndefined()
   );
   BinaryenFunctionTypeRef i = BinaryenAddFunctionType(module, "i",
                                                       BinaryenInt32(),
@@ -185,7 +186,7 @@ int main() {
     if use_switch[i]:
       fast += '''
     b%d = RelooperAddBlockWithSwitch(relooper,
-      BinaryenBlock(module, NULL, list, 2),
+      BinaryenBlock(module, NULL, list, 2, BinaryenUndefined()),
       BinaryenBinary(module,
         BinaryenRemUInt32(),
         BinaryenGetLocal(module, 0, BinaryenInt32()),
@@ -195,7 +196,8 @@ int main() {
 ''' % (i, len(branches[i]) + 1)
     else:  # non-switch
       fast += '''
-    b%d = RelooperAddBlock(relooper, BinaryenBlock(module, NULL, list, 2));
+    b%d = RelooperAddBlock(relooper, BinaryenBlock(module, NULL, list, 2,
+                                                   BinaryenUndefined()));
 ''' % i
     fast += '''
   }
@@ -260,7 +262,8 @@ int main() {
   }
   full[numDecisions] = body;
   BinaryenExpressionRef all = BinaryenBlock(module, NULL, full,
-                                            numDecisions + 1);
+                                            numDecisions + 1,
+                                            BinaryenUndefined());
 
   BinaryenFunctionTypeRef v = BinaryenAddFunctionType(module, "v",
                                                       BinaryenNone(),
@@ -360,6 +360,20 @@ def binary_format_check(wast, verify_final_result=True, wasm_as_args=['-g'],
   return 'ab.wast'
 
 
+def snapshot_check(wast):
+  # checks a snapshot reads back as exactly the same IR
+
+  print '     (snapshot check)'
+  cmd = WASM_OPT + [wast, '--emit-snapshot', '-o', 'a.bir']
+  print '      ', ' '.join(cmd)
+  subprocess.check_call(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+  expected = subprocess.check_output(WASM_OPT + [wast, '--print-full'])
+  actual = subprocess.check_output(WASM_OPT + ['a.bir', '--print-full'])
+  if actual != expected:
+    fail(actual, expected)
+  os.unlink('a.bir')
+
+
 def minify_check(wast, verify_final_result=True):
   # checks we can parse minified output
 
@@ -36,6 +36,7 @@
 #include "ir/literal-utils.h"
 #include "ir/trapping.h"
 #include "ir/utils.h"
+#include "support/threads.h"
 #include "wasm-builder.h"
 #include "wasm-emscripten.h"
 #include "wasm-module-building.h"
@@ -149,7 +150,7 @@ Index indexOr(Index x, Index y) {
 
 // useful when we need to see our parent, in an asm.js expression stack
 struct AstStackHelper {
-  static std::vector<Ref> astStack;
+  thread_local static std::vector<Ref> astStack; // functions are converted in parallel
   AstStackHelper(Ref curr) {
     astStack.push_back(curr);
   }
@@ -165,7 +166,7 @@ struct AstStackHelper {
   }
 };
 
-std::vector<Ref> AstStackHelper::astStack;
+thread_local std::vector<Ref> AstStackHelper::astStack;
 
 static bool startsWith(const char* string, const char *prefix) {
   while (1) {
@@ -443,6 +444,23 @@ private:
 
   std::map<IString, View> views; // name (e.g. HEAP8) => view info
 
+  // Functions are converted in parallel, so these only look things up, and
+  // never insert into the maps.
+  MappedGlobal& getMappedGlobal(IString name) {
+    auto iter = mappedGlobals.find(name);
+    if (iter == mappedGlobals.end()) {
+      Fatal() << "error: access of a non-existent global var " << name.str;
+    }
+    return iter->second;
+  }
+  View& getView(IString heap) {
+    auto iter = views.find(heap);
+    if (iter == views.end()) {
+      Fatal() << "error: access of a non-existent heap view " << heap.str;
+    }
+    return iter->second;
+  }
+
   // Imported names of Math.*
   IString Math_imul;
   IString Math_clz32;
@@ -529,9 +547,85 @@ private:
     return result;
   }
 
-  FunctionType* getFunctionType(Ref parent, ExpressionList& operands, AsmData* data) {
+  // Converting a function can add things to the rest of the module: function
+  // types, imports of support code, and helpers for operations that may
+  // trap. Functions are converted in parallel, so each notes those here, and
+  // they are added to the module in the order of the functions, which keeps
+  // the output the same however many threads are used.
+  struct FunctionEffects {
+    std::vector<std::string> signatures; // function types, in order of use
+    std::vector<Name> supportImports; // imports of support code, in order of first use
+    bool usesAtomics = false;
+    std::vector<std::pair<Ref, CallImport*>> importedCalls;
+    // trapping helpers are generated into a container of our own, and noted
+    // in order of use
+    TrappingFunctionContainer trappingFunctions;
+    std::vector<Name> trappingHelpers;
+    // the f64-to-int import is added to the module when we apply the effects;
+    // until then, this keeps makeTrappingUnary from adding it
+    Import f64ToIntPlaceholder;
+
+    FunctionEffects(TrapMode trapMode, Module& wasm) : trappingFunctions(trapMode, wasm) {
+      f64ToIntPlaceholder.name = F64_TO_INT;
+      trappingFunctions.addImport(&f64ToIntPlaceholder);
+    }
+
+    // returns whether this is the first use of the support import
+    bool noteSupportImport(Name name) {
+      if (std::find(supportImports.begin(), supportImports.end(), name) != supportImports.end()) {
+        return false;
+      }
+      supportImports.push_back(name);
+      return true;
+    }
+  };
+
+  void applyEffects(FunctionEffects& effects) {
+    for (auto& sig : effects.signatures) {
+      ensureFunctionType(sig, &wasm);
+    }
+    auto makeSupportImport = [&](Name name, std::string sig) {
+      auto import = new Import; // name = asm2wasm.name;
+      import->name = name;
+      import->module = ASM2WASM;
+      import->base = name;
+      import->functionType = ensureFunctionType(sig, &wasm)->name;
+      import->kind = ExternalKind::Function;
+      return import;
+    };
+    // add them in the order a serial conversion would have
+    for (auto name : effects.supportImports) {
+      if (name == F64_TO_INT) {
+        if (!trappingFunctions.hasImport(F64_TO_INT)) {
+          trappingFunctions.addImport(makeSupportImport(F64_TO_INT, "id"));
+        }
+      } else if (!wasm.getImportOrNull(name)) {
+        wasm.addImport(makeSupportImport(name, name == DEBUGGER ? "v" : "ddd"));
+      }
+    }
+    for (auto& name : effects.trappingHelpers) {
+      auto* helper = effects.trappingFunctions.getFunctions()[name];
+      if (trappingFunctions.hasFunction(name)) {
+        delete helper; // an earlier function added it
+      } else {
+        trappingFunctions.addFunction(helper);
+      }
+    }
+    for (auto& pair : effects.importedCalls) {
+      noteImportedFunctionCall(pair.first, pair.second->type, pair.second);
+    }
+    if (effects.usesAtomics) {
+      wasm.memory.shared = true;
+    }
+  }
+
+  // sets the type of an indirect call, noting that the module needs it
+  void setIndirectCallType(CallIndirect* call, Ref parent, AsmData* data, FunctionEffects& effects) {
     Type result = getResultTypeOfCallUsingParent(parent, data);
-    return ensureFunctionType(getSig(result, operands), &wasm);
+    auto sig = getSig(result, call->operands);
+    effects.signatures.push_back(sig);
+    call->fullType = sigToFunctionTypeName(sig);
+    call->type = result;
   }
 
 public:
@@ -548,7 +642,12 @@ public:
        runOptimizationPasses(runOptimizationPasses),
        wasmOnly(wasmOnly) {}
 
- void processAsm(Ref ast);
+ typedef cashew::Parser<Ref, DotZeroValueBuilder> AsmParser;
+
+ // If the bodies of the module's functions were left for later by the
+ // parser (see Parser::parseToplevelLazily), they are parsed here, in
+ // parallel, together with converting them.
+ void processAsm(Ref ast, std::vector<AsmParser::LazyFunction>* lazyFunctions = nullptr);
 
 private:
   AsmType detectAsmType(Ref ast, AsmData *data) {
@@ -556,8 +655,7 @@ private:
       IString name = ast->getIString();
       if (!data->isLocal(name)) {
         // must be global
-        assert(mappedGlobals.find(name) != mappedGlobals.end());
-        return wasmToAsmType(mappedGlobals[name].type);
+        return wasmToAsmType(getMappedGlobal(name).type);
       }
     } else if (ast->isArray(SUB) && ast[1]->isString()) {
       // could be a heap access, use view info
@@ -732,10 +830,10 @@ private:
     return value;
   }
 
-  Function* processFunction(Ref ast);
+  Function* processFunction(Ref ast, FunctionEffects& effects);
 };
 
-void Asm2WasmBuilder::processAsm(Ref ast) {
+void Asm2WasmBuilder::processAsm(Ref ast, std::vector<AsmParser::LazyFunction>* lazyFunctions) {
   assert(ast[0] == TOPLEVEL);
   Ref asmFunction = ast[1][0];
   assert(asmFunction[0] == DEFUN);
@@ -973,8 +1071,73 @@ void Asm2WasmBuilder::processAsm(Ref ast) {
 
   wasm.table.initial = wasm.table.max = 0;
 
+  // functions are parsed (if that was left for later) and converted on
+  // demand, or in parallel, see below
+
+  std::vector<AsmParser::LazyFunction*> lazyBodies(body->size(), nullptr);
+  if (lazyFunctions) {
+    Index k = 0;
+    for (unsigned i = 1; i < body->size(); i++) {
+      if (body[i][0] == DEFUN) {
+        assert(k < lazyFunctions->size() && (*lazyFunctions)[k].func.inst == body[i].inst);
+        lazyBodies[i] = &(*lazyFunctions)[k++];
+      }
+    }
+    assert(k == lazyFunctions->size());
+  }
+
+  std::vector<Function*> functions(body->size(), nullptr);
+  std::vector<std::unique_ptr<FunctionEffects>> functionEffects(body->size());
+
+  auto convertFunction = [&](Index i) {
+    if (lazyBodies[i]) {
+      AsmParser parser;
+      parser.parseFunctionBody(*lazyBodies[i]);
+    }
+    functionEffects[i] = make_unique<FunctionEffects>(trapMode, wasm);
+    functions[i] = processFunction(body[i], *functionEffects[i]);
+  };
+
+  // Converts all the functions, starting from the first, in parallel. That
+  // is possible when, as usual in asm.js, the globals and imports that they
+  // use all come before them (function tables may come after them, as
+  // indirect calls are fixed up later). Their effects on the rest of the
+  // module are applied afterwards, in order.
+  auto convertFunctionsInParallel = [&](Index first) {
+    auto* pool = ThreadPool::get();
+    size_t num = pool->size();
+    if (num <= 1 || pool->isRunning() || debug) return;
+    std::vector<Index> todo;
+    for (Index i = first; i < body->size(); i++) {
+      Ref curr = body[i];
+      if (curr[0] == DEFUN) {
+        todo.push_back(i);
+      } else if (curr[0] == VAR) {
+        for (unsigned j = 0; j < curr[1]->size(); j++) {
+          Ref value = curr[1][j][1];
+          if (!value->isArray() || value[0] != ARRAY) return;
+        }
+      }
+    }
+    std::atomic<size_t> next;
+    next.store(0);
+    std::vector<std::function<ThreadWorkState ()>> doWorkers;
+    for (size_t i = 0; i < num; i++) {
+      doWorkers.push_back([&]() {
+        auto index = next.fetch_add(1);
+        if (index >= todo.size()) {
+          return ThreadWorkState::Finished;
+        }
+        convertFunction(todo[index]);
+        return index + 1 >= todo.size() ? ThreadWorkState::Finished : ThreadWorkState::More;
+      });
+    }
+    pool->work(doWorkers);
+  };
+
   // first pass - do almost everything, but function imports and indirect calls
 
+  bool reachedFunctions = false;
   for (unsigned i = 1; i < body->size(); i++) {
     Ref curr = body[i];
     if (curr[0] == VAR) {
@@ -1110,7 +1273,16 @@ void Asm2WasmBuilder::processAsm(Ref ast) {
       }
     } else if (curr[0] == DEFUN) {
       // function
-      auto* func = processFunction(curr);
+      if (!reachedFunctions) {
+        reachedFunctions = true;
+        convertFunctionsInParallel(i);
+      }
+      if (!functions[i]) {
+        convertFunction(i);
+      }
+      auto* func = functions[i];
+      applyEffects(*functionEffects[i]);
+      functionEffects[i].reset();
       if (wasm.getFunctionOrNull(func->name)) {
         Fatal() << "duplicate function: " << func->name;
       }
@@ -1541,7 +1713,7 @@ void Asm2WasmBuilder::processAsm(Ref ast) {
   }
 }
 
-Function* Asm2WasmBuilder::processFunction(Ref ast) {
+Function* Asm2WasmBuilder::processFunction(Ref ast, FunctionEffects& effects) {
   auto name = ast[1]->getIString();
 
   if (debug) {
@@ -1603,6 +1775,26 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
     asmData.addVar(I32_TEMP, ASM_INT);
   };
 
+  // operations that may trap use helpers, which we note (see FunctionEffects)
+  auto noteTrappingHelper = [&](Expression* ret, size_t numHelpers) {
+    if (effects.trappingFunctions.getFunctions().size() > numHelpers) {
+      effects.trappingHelpers.push_back(ret->cast<Call>()->target);
+    } else if (auto* call = ret->dynCast<CallImport>()) {
+      if (call->target == F64_TO_INT && effects.noteSupportImport(F64_TO_INT)) {
+        effects.signatures.push_back("id");
+      }
+    }
+    return ret;
+  };
+  auto makeTrappingBinary = [&](Binary* curr) {
+    auto numHelpers = effects.trappingFunctions.getFunctions().size();
+    return noteTrappingHelper(wasm::makeTrappingBinary(curr, effects.trappingFunctions), numHelpers);
+  };
+  auto makeTrappingUnary = [&](Unary* curr) {
+    auto numHelpers = effects.trappingFunctions.getFunctions().size();
+    return noteTrappingHelper(wasm::makeTrappingUnary(curr, effects.trappingFunctions), numHelpers);
+  };
+
   bool seenReturn = false; // function->result is updated if we see a return
   // processors
   std::function<Expression* (Ref, unsigned)> processStatements;
@@ -1623,22 +1815,12 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
         CallImport *call = allocator.alloc<CallImport>();
         call->target = DEBUGGER;
         call->type = none;
-        static bool addedImport = false;
-        if (!addedImport) {
-          addedImport = true;
-          auto import = new Import; // debugger = asm2wasm.debugger;
-          import->name = DEBUGGER;
-          import->module = ASM2WASM;
-          import->base = DEBUGGER;
-          import->functionType = ensureFunctionType("v", &wasm)->name;
-          import->kind = ExternalKind::Function;
-          wasm.addImport(import);
-        }
+        effects.signatures.push_back("v");
+        effects.noteSupportImport(DEBUGGER);
         return call;
       }
       // global var
-      assert(mappedGlobals.find(name) != mappedGlobals.end() ? true : (std::cerr << name.str << '\n', false));
-      MappedGlobal& global = mappedGlobals[name];
+      MappedGlobal& global = getMappedGlobal(name);
       return builder.makeGetGlobal(name, global.type);
     }
     if (ast->isNumber()) {
@@ -1681,8 +1863,7 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
       Ref target = assign->target();
       assert(target[1]->isString());
       IString heap = target[1]->getIString();
-      assert(views.find(heap) != views.end());
-      View& view = views[heap];
+      View& view = getView(heap);
       auto ret = allocator.alloc<Store>();
       ret->isAtomic = false;
       ret->bytes = view.bytes;
@@ -1727,26 +1908,16 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
         call->operands.push_back(ensureDouble(ret->left));
         call->operands.push_back(ensureDouble(ret->right));
         call->type = f64;
-        static bool addedImport = false;
-        if (!addedImport) {
-          addedImport = true;
-          auto import = new Import; // f64-rem = asm2wasm.f64-rem;
-          import->name = F64_REM;
-          import->module = ASM2WASM;
-          import->base = F64_REM;
-          import->functionType = ensureFunctionType("ddd", &wasm)->name;
-          import->kind = ExternalKind::Function;
-          wasm.addImport(import);
-        }
+        effects.signatures.push_back("ddd");
+        effects.noteSupportImport(F64_REM);
         return call;
       }
-      return makeTrappingBinary(ret, trappingFunctions);
+      return makeTrappingBinary(ret);
     } else if (what == SUB) {
       Ref target = ast[1];
       assert(target->isString());
       IString heap = target->getIString();
-      assert(views.find(heap) != views.end());
-      View& view = views[heap];
+      View& view = getView(heap);
       auto ret = allocator.alloc<Load>();
       ret->isAtomic = false;
       ret->bytes = view.bytes;
@@ -1821,7 +1992,7 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
           } else { // !isSigned && !isF64
             op = UnaryOp::TruncUFloat32ToInt32;
           }
-          return makeTrappingUnary(builder.makeUnary(op, expr), trappingFunctions);
+          return makeTrappingUnary(builder.makeUnary(op, expr));
         }
         // no bitwise unary not, so do xor with -1
         auto ret = allocator.alloc<Binary>();
@@ -1981,9 +2152,8 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
           Ref target = ast[2][0];
           assert(target->isString());
           IString heap = target->getIString();
-          assert(views.find(heap) != views.end());
-          View& view = views[heap];
-          wasm.memory.shared = true;
+          View& view = getView(heap);
+          effects.usesAtomics = true;
           if (name == Atomics_load) {
             Expression* ret = builder.makeAtomicLoad(view.bytes, 0, processUnshifted(ast[2][1], view.bytes), asmToWasmType(view.type));
             if (view.signed_) {
@@ -2075,19 +2245,19 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
                 if (name == I64_U2D) return builder.makeUnary(UnaryOp::ConvertUInt64ToFloat64, value);
                 if (name == I64_F2S) {
                   Unary* conv = builder.makeUnary(UnaryOp::TruncSFloat32ToInt64, value);
-                  return makeTrappingUnary(conv, trappingFunctions);
+                  return makeTrappingUnary(conv);
                 }
                 if (name == I64_D2S) {
                   Unary* conv = builder.makeUnary(UnaryOp::TruncSFloat64ToInt64, value);
-                  return makeTrappingUnary(conv, trappingFunctions);
+                  return makeTrappingUnary(conv);
                 }
                 if (name == I64_F2U) {
                   Unary* conv = builder.makeUnary(UnaryOp::TruncUFloat32ToInt64, value);
-                  return makeTrappingUnary(conv, trappingFunctions);
+                  return makeTrappingUnary(conv);
                 }
                 if (name == I64_D2U) {
                   Unary* conv = builder.makeUnary(UnaryOp::TruncUFloat64ToInt64, value);
-                  return makeTrappingUnary(conv, trappingFunctions);
+                  return makeTrappingUnary(conv);
                 }
                 if (name == I64_BC2D) return builder.makeUnary(UnaryOp::ReinterpretInt64, value);
                 if (name == I64_BC2I) return builder.makeUnary(UnaryOp::ReinterpretFloat64, value);
@@ -2105,19 +2275,19 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
                 if (name == I64_MUL) return builder.makeBinary(BinaryOp::MulInt64, left, right);
                 if (name == I64_UDIV) {
                   Binary* div = builder.makeBinary(BinaryOp::DivUInt64, left, right);
-                  return makeTrappingBinary(div, trappingFunctions);
+                  return makeTrappingBinary(div);
                 }
                 if (name == I64_SDIV) {
                   Binary* div = builder.makeBinary(BinaryOp::DivSInt64, left, right);
-                  return makeTrappingBinary(div, trappingFunctions);
+                  return makeTrappingBinary(div);
                 }
                 if (name == I64_UREM) {
                   Binary* rem = builder.makeBinary(BinaryOp::RemUInt64, left, right);
-                  return makeTrappingBinary(rem, trappingFunctions);
+                  return makeTrappingBinary(rem);
                 }
                 if (name == I64_SREM) {
                   Binary* rem = builder.makeBinary(BinaryOp::RemSInt64, left, right);
-                  return makeTrappingBinary(rem, trappingFunctions);
+                  return makeTrappingBinary(rem);
                 }
                 if (name == I64_AND) return builder.makeBinary(BinaryOp::AndInt64, left, right);
                 if (name == I64_OR) return builder.makeBinary(BinaryOp::OrInt64, left, right);
@@ -2138,36 +2308,36 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
                 if (name == I64_SGT) return builder.makeBinary(BinaryOp::GtSInt64, left, right);
                 // atomics
                 if (name == I64_ATOMICS_STORE) {
-                  wasm.memory.shared = true;
+                  effects.usesAtomics = true;
                   return builder.makeAtomicStore(8, 0, left, right, i64);
                 }
                 if (name == I64_ATOMICS_ADD) {
-                  wasm.memory.shared = true;
+                  effects.usesAtomics = true;
                   return builder.makeAtomicRMW(AtomicRMWOp::Add, 8, 0, left, right, i64);
                 }
                 if (name == I64_ATOMICS_SUB) {
-                  wasm.memory.shared = true;
+                  effects.usesAtomics = true;
                   return builder.makeAtomicRMW(AtomicRMWOp::Sub, 8, 0, left, right, i64);
                 }
                 if (name == I64_ATOMICS_AND) {
-                  wasm.memory.shared = true;
+                  effects.usesAtomics = true;
                   return builder.makeAtomicRMW(AtomicRMWOp::And, 8, 0, left, right, i64);
                 }
                 if (name == I64_ATOMICS_OR) {
-                  wasm.memory.shared = true;
+                  effects.usesAtomics = true;
                   return builder.makeAtomicRMW(AtomicRMWOp::Or, 8, 0, left, right, i64);
                 }
                 if (name == I64_ATOMICS_XOR) {
-                  wasm.memory.shared = true;
+                  effects.usesAtomics = true;
                   return builder.makeAtomicRMW(AtomicRMWOp::Xor, 8, 0, left, right, i64);
                 }
                 if (name == I64_ATOMICS_EXCHANGE) {
-                  wasm.memory.shared = true;
+                  effects.usesAtomics = true;
                   return builder.makeAtomicRMW(AtomicRMWOp::Xchg, 8, 0, left, right, i64);
                 }
               } else if (num == 3) {
                 if (name == I64_ATOMICS_COMPAREEXCHANGE) {
-                  wasm.memory.shared = true;
+                  effects.usesAtomics = true;
                   return builder.makeAtomicCmpxchg(8, 0, process(ast[2][0]), process(ast[2][1]), process(ast[2][2]), i64);
                 }
               }
@@ -2216,9 +2386,7 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
         if (tableCall) {
           auto specific = ret->dynCast<CallIndirect>();
           // note that we could also get the type from the suffix of the name, e.g., mftCall_vi
-          auto* fullType = getFunctionType(astStackHelper.getParent(), specific->operands, &asmData);
-          specific->fullType = fullType->name;
-          specific->type = fullType->result;
+          setIndirectCallType(specific, astStackHelper.getParent(), &asmData, effects);
         }
         if (callImport) {
           // apply the detected type from the parent
@@ -2230,7 +2398,7 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
           // to finalizeCalls (which we can only do once we've read all the functions,
           // and we optimize in parallel starting earlier).
           callImport->type = getResultTypeOfCallUsingParent(astStackHelper.getParent(), &asmData);
-          noteImportedFunctionCall(ast, callImport->type, callImport);
+          effects.importedCalls.emplace_back(ast, callImport);
         }
         return ret;
       }
@@ -2243,9 +2411,7 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
       for (unsigned i = 0; i < args->size(); i++) {
         ret->operands.push_back(process(args[i]));
       }
-      auto* fullType = getFunctionType(astStackHelper.getParent(), ret->operands, &asmData);
-      ret->fullType = fullType->name;
-      ret->type = fullType->result;
+      setIndirectCallType(ret, astStackHelper.getParent(), &asmData, effects);
       // we don't know the table offset yet. emit target = target + callImport(tableName), which we fix up later when we know how asm function tables are layed out inside the wasm table.
       ret->target = builder.makeBinary(BinaryOp::AddInt32, ret->target, builder.makeCallImport(target[1]->getIString(), {}, i32));
       return ret;
@@ -2478,7 +2644,7 @@ Function* Asm2WasmBuilder::processFunction(Ref ast) {
           // (?[tempDoublePtr >> 2] = ?, ?)  so far
           auto heap = target[1]->getIString();
           if (views.find(heap) != views.end()) {
-            AsmType writeType = views[heap].type;
+            AsmType writeType = getView(heap).type;
             AsmType readType = ASM_NONE;
             Ref readValue;
             if (ast[2]->isArray(BINARY) && ast[2][1] == OR && ast[2][3]->isNumber() && ast[2][3]->getNumber() == 0) {
@@ -68,6 +68,9 @@ Type sigToType(char sig);
 
 FunctionType* sigToFunctionType(std::string sig);
 
+// the name ensureFunctionType gives the type of a signature
+Name sigToFunctionTypeName(std::string sig);
+
 FunctionType* ensureFunctionType(std::string sig, Module* wasm);
 
 // converts an f32 to an f64 if necessary
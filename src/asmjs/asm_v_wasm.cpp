@@ -93,8 +93,12 @@ FunctionType* sigToFunctionType(std::string sig) {
   return ret;
 }
 
+Name sigToFunctionTypeName(std::string sig) {
+  return cashew::IString(("FUNCSIG$" + sig).c_str(), false);
+}
+
 FunctionType* ensureFunctionType(std::string sig, Module* wasm) {
-  cashew::IString name(("FUNCSIG$" + sig).c_str(), false);
+  auto name = sigToFunctionTypeName(sig);
   if (wasm->getFunctionTypeOrNull(name)) {
     return wasm->getFunctionType(name);
   }
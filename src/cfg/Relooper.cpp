@@ -23,6 +23,7 @@
 #include <stack>
 #include <string>
 
+#include "ir/manipulation.h"
 #include "ir/utils.h"
 #include "parsing.h"
 
@@ -100,7 +101,7 @@ static wasm::Expression* HandleFollowupMultiples(wasm::Expression* Ret, Shape* P
 
 Branch::Branch(wasm::Expression* ConditionInit, wasm::Expression* CodeInit) : Ancestor(nullptr), Condition(ConditionInit), Code(CodeInit) {}
 
-Branch::Branch(std::vector<wasm::Index>&& ValuesInit, wasm::Expression* CodeInit) : Ancestor(nullptr), Code(CodeInit) {
+Branch::Branch(std::vector<wasm::Index>&& ValuesInit, wasm::Expression* CodeInit) : Ancestor(nullptr), Condition(nullptr), Code(CodeInit) {
   if (ValuesInit.size() > 0) {
     SwitchValues = wasm::make_unique<std::vector<wasm::Index>>(ValuesInit);
   }
@@ -382,30 +383,67 @@ wasm::Expression* SimpleShape::Render(RelooperBuilder& Builder, bool InLoop) {
 // MultipleShape
 
 wasm::Expression* MultipleShape::Render(RelooperBuilder& Builder, bool InLoop) {
-  // TODO: consider switch
-  // emit an if-else chain
-  wasm::If *FirstIf = nullptr, *CurrIf = nullptr;
-  std::vector<wasm::If*> finalizeStack;
-  for (IdShapeMap::iterator iter = InnerMap.begin(); iter != InnerMap.end(); iter++) {
-    auto* Now = Builder.makeIf(
-      Builder.makeCheckLabel(iter->first),
-      iter->second->Render(Builder, InLoop)
-    );
-    finalizeStack.push_back(Now);
-    if (!CurrIf) {
-      FirstIf = CurrIf = Now;
-    } else {
-      CurrIf->ifFalse = Now;
-      CurrIf->finalize();
-      CurrIf = Now;
+  wasm::Expression* Ret;
+  int MinId = InnerMap.begin()->first, MaxId = InnerMap.rbegin()->first;
+  if (InnerMap.size() >= 3 && MaxId - MinId < 4 * int(InnerMap.size())) {
+    // emit a switch on the label, which is one check instead of one per group
+    auto Base = std::string("shape$") + std::to_string(Id);
+    auto Leave = wasm::Name(Base + "$leave");
+    std::vector<wasm::Name> Table(MaxId - MinId + 1, Leave);
+    std::vector<wasm::Block*> finalizeStack;
+    auto* Outer = Builder.makeBlock();
+    auto* Inner = Outer;
+    size_t Remaining = InnerMap.size();
+    for (auto& iter : InnerMap) {
+      auto Name = wasm::Name(Base + "$case$" + std::to_string(iter.first));
+      Table[iter.first - MinId] = Name;
+      // breaking on Outer leads to the content in NextOuter
+      Outer->name = Name;
+      finalizeStack.push_back(Outer);
+      auto* NextOuter = Builder.makeBlock(Outer);
+      auto* Content = iter.second->Render(Builder, InLoop);
+      NextOuter->list.push_back(Content);
+      if (--Remaining > 0 && Content->type != wasm::unreachable) {
+        NextOuter->list.push_back(Builder.makeBreak(Leave));
+      }
+      Outer = NextOuter;
     }
+    Outer->name = Leave;
+    finalizeStack.push_back(Outer);
+    wasm::Expression* Index = Builder.makeGetLabel();
+    if (MinId != 0) {
+      Index = Builder.makeBinary(wasm::SubInt32, Index, Builder.makeConst(wasm::Literal(int32_t(MinId))));
+    }
+    Inner->list.push_back(Builder.makeSwitch(Table, Leave, Index));
+    for (auto* Curr : finalizeStack) {
+      Curr->finalize();
+    }
+    Ret = Outer;
+  } else {
+    // emit an if-else chain
+    wasm::If *FirstIf = nullptr, *CurrIf = nullptr;
+    std::vector<wasm::If*> finalizeStack;
+    for (IdShapeMap::iterator iter = InnerMap.begin(); iter != InnerMap.end(); iter++) {
+      auto* Now = Builder.makeIf(
+        Builder.makeCheckLabel(iter->first),
+        iter->second->Render(Builder, InLoop)
+      );
+      finalizeStack.push_back(Now);
+      if (!CurrIf) {
+        FirstIf = CurrIf = Now;
+      } else {
+        CurrIf->ifFalse = Now;
+        CurrIf->finalize();
+        CurrIf = Now;
+      }
+    }
+    while (finalizeStack.size() > 0) {
+      wasm::If* curr = finalizeStack.back();
+      finalizeStack.pop_back();
+      curr->finalize();
+    }
+    Ret = Builder.makeBlock(FirstIf);
   }
-  while (finalizeStack.size() > 0) {
-    wasm::If* curr = finalizeStack.back();
-    finalizeStack.pop_back();
-    curr->finalize();
-  }
-  wasm::Expression* Ret = Builder.makeBlock(FirstIf);
   Ret = HandleFollowupMultiples(Ret, this, Builder, InLoop);
   if (Next) {
     Ret = Builder.makeSequence(Ret, Next->Render(Builder, InLoop));
@@ -426,7 +464,7 @@ wasm::Expression* LoopShape::Render(RelooperBuilder& Builder, bool InLoop) {
 
 // Relooper
 
-Relooper::Relooper() : Root(nullptr), MinSize(false), BlockIdCounter(1), ShapeIdCounter(0) { // block ID 0 is reserved for clearings
+Relooper::Relooper(wasm::Module* ModuleInit) : Module(ModuleInit), Root(nullptr), MinSize(false), BlockIdCounter(1), ShapeIdCounter(0) { // block ID 0 is reserved for clearings
 }
 
 Relooper::~Relooper() {
@@ -446,7 +484,406 @@ struct RelooperRecursor {
 
 typedef std::list<Block*> BlockList;
 
+// Builds the shapes for a reducible CFG from its dominator tree and loop
+// nesting forest, in close to linear time. The blocks are stored flat, by
+// index in reverse postorder, and all the analysis is on those indexes.
+//
+// Each block gets a Simple shape (wrapped in a Loop if it is a loop header),
+// which is followed by
+//
+//  * a Multiple with the blocks it immediately dominates and is the only
+//    forward predecessor of, which are fused into its branches, and then
+//  * the blocks it immediately dominates that are reached from several
+//    places, in reverse postorder, each of them breaking out of the blocks
+//    before it.
+//
+// Blocks that are immediately dominated by a block in a loop, but are outside
+// of that loop, follow the loop in the same manner instead.
+//
+// Small irreducible regions are made reducible by splitting blocks: a block
+// that is entered from inside a loop it does not dominate gets a copy for
+// those branches, until each loop has a single entry. That avoids the label
+// variable which the general algorithm, that handles any other irreducible
+// control flow, would need to dispatch to the entries.
+struct DominatorShaper : public RelooperRecursor {
+  DominatorShaper(Relooper *Parent) : RelooperRecursor(Parent) {}
+
+  typedef wasm::Index Index;
+  enum : Index { None = Index(-1) };
+
+  // Limits on splitting, as each split adds code
+  static const Index MaxSplits = 16;
+  static const Index MaxSplitSize = 40;
+
+  std::vector<Block*> Blocks; // in reverse postorder
+  std::vector<std::vector<Index>> Out, In;
+  std::vector<Index> ImmediateDominator;
+  std::vector<Index> DomStart, DomEnd; // preorder interval in the dominator tree
+  std::vector<bool> IsHeader;
+  std::vector<Index> NumForwardIn;
+  std::vector<Index> InnermostLoop; // the innermost loop header, or ourselves if a header
+  std::vector<Index> ParentLoop; // for a header, the header of the loop around it
+  Index IrreducibleEntry; // a block entered from a loop it does not dominate
+
+  bool Dominates(Index A, Index B) {
+    return DomStart[A] <= DomStart[B] && DomEnd[B] <= DomEnd[A];
+  }
+
+  // Returns false if the CFG is irreducible, in which case no shapes were
+  // created (but some blocks may have been split).
+  bool Calculate(Block *Entry) {
+    for (Index Splits = 0;; Splits++) {
+      Linearize(Entry);
+      ComputeDominators();
+      if (FindLoops()) break;
+      if (Splits == MaxSplits || !Split(IrreducibleEntry)) return false;
+    }
+    Parent->Root = MakeShapes();
+    return true;
+  }
+
+  void Notice(Shape *New) {
+    New->Id = Parent->ShapeIdCounter++;
+    Parent->Shapes.push_back(New);
+  }
+
+  // Number the live blocks in reverse postorder, and note their edges.
+  void Linearize(Block *Entry) {
+    std::unordered_map<Block*, Index> Indexes;
+    std::vector<Block*> Postorder;
+    std::vector<std::pair<Block*, BlockBranchMap::iterator>> Stack;
+    Indexes[Entry] = None;
+    Stack.emplace_back(Entry, Entry->BranchesOut.begin());
+    while (!Stack.empty()) {
+      auto& Top = Stack.back();
+      if (Top.second == Top.first->BranchesOut.end()) {
+        Indexes[Top.first] = Postorder.size();
+        Postorder.push_back(Top.first);
+        Stack.pop_back();
+        continue;
+      }
+      Block *Target = (Top.second++)->first;
+      if (Indexes.emplace(Target, None).second) {
+        Stack.emplace_back(Target, Target->BranchesOut.begin());
+      }
+    }
+    Index Num = Postorder.size();
+    Blocks.assign(Postorder.rbegin(), Postorder.rend());
+    Out.clear();
+    Out.resize(Num);
+    In.clear();
+    In.resize(Num);
+    for (Index i = 0; i < Num; i++) {
+      for (auto& iter : Blocks[i]->BranchesOut) {
+        Index Target = Num - 1 - Indexes[iter.first];
+        Out[i].push_back(Target);
+        In[Target].push_back(i);
+      }
+    }
+  }
+
+  // Lengauer-Tarjan, with path compression. As blocks are numbered in reverse
+  // postorder, and not preorder, we find the DFS tree and preorder here.
+  void ComputeDominators() {
+    Index Num = Blocks.size();
+    std::vector<Index> Pre(Num, None), Vertex, DFSParent(Num, None);
+    std::vector<std::pair<Index, Index>> Stack; // block, next edge
+    Pre[0] = 0;
+    Vertex.push_back(0);
+    Stack.emplace_back(0, 0);
+    while (!Stack.empty()) {
+      auto& Top = Stack.back();
+      if (Top.second == Out[Top.first].size()) {
+        Stack.pop_back();
+        continue;
+      }
+      Index Target = Out[Top.first][Top.second++];
+      if (Pre[Target] == None) {
+        Pre[Target] = Vertex.size();
+        Vertex.push_back(Target);
+        DFSParent[Pre[Target]] = Pre[Top.first];
+        Stack.emplace_back(Target, 0);
+      }
+    }
+    // everything below is on preorder numbers
+    std::vector<Index> Semi(Num), Ancestor(Num, None), Label(Num), Idom(Num, None);
+    std::vector<std::vector<Index>> Bucket(Num);
+    for (Index i = 0; i < Num; i++) {
+      Semi[i] = Label[i] = i;
+    }
+    std::vector<Index> Path;
+    auto Eval = [&](Index V) {
+      if (Ancestor[V] == None) return V;
+      // compress the path to the root of V's tree in the forest
+      while (Ancestor[Ancestor[V]] != None) {
+        Path.push_back(V);
+        V = Ancestor[V];
+      }
+      while (!Path.empty()) {
+        Index U = Path.back();
+        Path.pop_back();
+        if (Semi[Label[Ancestor[U]]] < Semi[Label[U]]) {
+          Label[U] = Label[Ancestor[U]];
+        }
+        Ancestor[U] = Ancestor[V];
+        V = U;
+      }
+      return Label[V];
+    };
+    for (Index W = Num - 1; W > 0; W--) {
+      for (Index Pred : In[Vertex[W]]) {
+        Index U = Eval(Pre[Pred]);
+        if (Semi[U] < Semi[W]) Semi[W] = Semi[U];
+      }
+      Bucket[Semi[W]].push_back(W);
+      Index P = DFSParent[W];
+      Ancestor[W] = P;
+      for (Index V : Bucket[P]) {
+        Index U = Eval(V);
+        Idom[V] = Semi[U] < Semi[V] ? U : P;
+      }
+      Bucket[P].clear();
+    }
+    for (Index W = 1; W < Num; W++) {
+      if (Idom[W] != Semi[W]) Idom[W] = Idom[Idom[W]];
+    }
+    // back to our numbering, and number the dominator tree so that we can
+    // answer dominance queries in constant time
+    ImmediateDominator.assign(Num, None);
+    std::vector<std::vector<Index>> Children(Num);
+    for (Index W = 1; W < Num; W++) {
+      ImmediateDominator[Vertex[W]] = Vertex[Idom[W]];
+      Children[Vertex[Idom[W]]].push_back(Vertex[W]);
+    }
+    DomStart.resize(Num);
+    DomEnd.resize(Num);
+    Index Counter = 0;
+    Stack.clear();
+    DomStart[0] = Counter++;
+    Stack.emplace_back(0, 0);
+    while (!Stack.empty()) {
+      auto& Top = Stack.back();
+      if (Top.second == Children[Top.first].size()) {
+        DomEnd[Top.first] = Counter++;
+        Stack.pop_back();
+        continue;
+      }
+      Index Child = Children[Top.first][Top.second++];
+      DomStart[Child] = Counter++;
+      Stack.emplace_back(Child, 0);
+    }
+  }
+
+  // Finds the loop nesting forest. A retreating edge that is not to a
+  // dominator means the CFG is irreducible, and we return false, noting the
+  // target of the edge.
+  bool FindLoops() {
+    Index Num = Blocks.size();
+    IsHeader.assign(Num, false);
+    NumForwardIn.assign(Num, 0);
+    for (Index i = 0; i < Num; i++) {
+      for (Index Pred : In[i]) {
+        if (Pred >= i) {
+          if (!Dominates(i, Pred)) {
+            IrreducibleEntry = i;
+            return false;
+          }
+          IsHeader[i] = true;
+        } else {
+          NumForwardIn[i]++;
+        }
+      }
+    }
+    // Go over the headers from the inside out. Each marks the blocks in its
+    // loop that are not yet in one, and adopts the outermost loop around the
+    // others, found through a union-find on the headers.
+    InnermostLoop.assign(Num, None);
+    ParentLoop.assign(Num, None);
+    std::vector<Index> Representative(Num, None), Seen(Num, None), Work;
+    auto Find = [&](Index B) {
+      if (InnermostLoop[B] == None) return B;
+      Index Root = InnermostLoop[B];
+      while (Representative[Root] != Root) Root = Representative[Root];
+      Index Curr = InnermostLoop[B];
+      while (Representative[Curr] != Root) {
+        Index Next = Representative[Curr];
+        Representative[Curr] = Root;
+        Curr = Next;
+      }
+      return Root;
+    };
+    for (Index H = Num; H-- > 0;) {
+      if (!IsHeader[H]) continue;
+      InnermostLoop[H] = Representative[H] = H;
+      for (Index Pred : In[H]) {
+        if (Pred >= H) Work.push_back(Pred);
+      }
+      while (!Work.empty()) {
+        Index B = Find(Work.back());
+        Work.pop_back();
+        if (B == H || Seen[B] == H) continue;
+        Seen[B] = H;
+        if (InnermostLoop[B] == None) {
+          InnermostLoop[B] = H;
+        } else {
+          // the header of an inner loop
+          ParentLoop[B] = H;
+          Representative[B] = H;
+        }
+        for (Index Pred : In[B]) {
+          Work.push_back(Pred);
+        }
+      }
+    }
+    return true;
+  }
+
+  // Copies a block for the branches to it that enter a loop from inside it.
+  // Returns false if we cannot, as we have no module to allocate the copies
+  // in, or it would add too much code.
+  bool Split(Index Target) {
+    if (!Parent->Module || Parent->MinSize) return false;
+    Block *Original = Blocks[Target];
+    Index Size = 0;
+    auto Measure = [&](wasm::Expression* Curr) {
+      if (Curr) Size += wasm::Measurer::measure(Curr);
+    };
+    Measure(Original->Code);
+    Measure(Original->SwitchCondition);
+    for (auto& iter : Original->BranchesOut) {
+      Measure(iter.second->Condition);
+      Measure(iter.second->Code);
+    }
+    if (Size > MaxSplitSize) return false;
+    auto Copy = [&](wasm::Expression* Curr) -> wasm::Expression* {
+      return Curr ? wasm::ExpressionManipulator::copy(Curr, *Parent->Module) : nullptr;
+    };
+    auto *Copied = new Block(Copy(Original->Code), Copy(Original->SwitchCondition));
+    Parent->AddBlock(Copied);
+    for (auto& iter : Original->BranchesOut) {
+      Branch *Details = iter.second;
+      if (Original->SwitchCondition) {
+        std::vector<wasm::Index> Values;
+        if (Details->SwitchValues) Values = *Details->SwitchValues;
+        Copied->AddSwitchBranchTo(iter.first, std::move(Values), Copy(Details->Code));
+      } else {
+        Copied->AddBranchTo(iter.first, Copy(Details->Condition), Copy(Details->Code));
+      }
+    }
+    for (Index Pred : In[Target]) {
+      if (Pred < Target || Dominates(Target, Pred)) continue;
+      // redirect the branch, keeping the order of the branches, as it is the
+      // order in which their conditions are checked
+      Block *From = Blocks[Pred];
+      std::vector<std::pair<Block*, Branch*>> Branches(From->BranchesOut.begin(), From->BranchesOut.end());
+      From->BranchesOut.clear();
+      for (auto& Pair : Branches) {
+        From->BranchesOut[Pair.first == Original ? Copied : Pair.first] = Pair.second;
+      }
+    }
+    return true;
+  }
+
+  Shape *MakeShapes() {
+    Index Num = Blocks.size();
+    // Place each block after its immediate dominator, or after a loop around
+    // its immediate dominator, if it is outside of that loop.
+    std::vector<std::vector<Index>> Fused(Num), Followers(Num), LoopFollowers(Num);
+    for (Index i = 1; i < Num; i++) {
+      Index Dominator = ImmediateDominator[i];
+      Index Loop = IsHeader[i] ? ParentLoop[i] : InnermostLoop[i];
+      Index DominatorLoop = InnermostLoop[Dominator];
+      if (DominatorLoop == Loop) {
+        if (NumForwardIn[i] == 1) {
+          Fused[Dominator].push_back(i);
+        } else {
+          Followers[Dominator].push_back(i);
+        }
+      } else {
+        while (ParentLoop[DominatorLoop] != Loop) {
+          DominatorLoop = ParentLoop[DominatorLoop];
+          assert(DominatorLoop != None);
+        }
+        LoopFollowers[DominatorLoop].push_back(i);
+      }
+    }
+    // Create the shapes from the inside out, so each block's dominated blocks
+    // are ready when we get to it.
+    std::vector<Shape*> Shapes(Num);
+    std::vector<LoopShape*> Loops(Num);
+    auto Follow = [&](Shape *Tail, std::vector<Index>& List) {
+      for (Index i = 0; i < List.size(); i++) {
+        Shape *Next;
+        if (i + 1 < List.size()) {
+          auto *Multiple = new MultipleShape();
+          Notice(Multiple);
+          Multiple->InnerMap[Blocks[List[i]]->Id] = Shapes[List[i]];
+          Next = Multiple;
+        } else {
+          Next = Shapes[List[i]];
+        }
+        Tail->Next = Next;
+        Tail = Next;
+      }
+    };
+    for (Index i = Num; i-- > 0;) {
+      auto *Simple = new SimpleShape;
+      Notice(Simple);
+      Simple->Inner = Blocks[i];
+      Blocks[i]->Parent = Simple;
+      Shape *Tail = Simple;
+      // always add a Multiple if anything follows us, as the block will fuse
+      // the next Multiple into its branches
+      if (!Fused[i].empty() || !Followers[i].empty()) {
+        auto *Multiple = new MultipleShape();
+        Notice(Multiple);
+        for (Index Target : Fused[i]) {
+          Multiple->InnerMap[Blocks[Target]->Id] = Shapes[Target];
+        }
+        Simple->Next = Multiple;
+        Tail = Multiple;
+      }
+      Follow(Tail, Followers[i]);
+      Shapes[i] = Simple;
+      if (IsHeader[i]) {
+        auto *Loop = new LoopShape();
+        Notice(Loop);
+        Loop->Inner = Simple;
+        Loop->Entries.insert(Blocks[i]);
+        Follow(Loop, LoopFollowers[i]);
+        Shapes[i] = Loops[i] = Loop;
+      }
+    }
+    // Mark the branches as processed: back edges continue their loop, and
+    // everything else breaks, which fusing turns into direct flow where it can.
+    for (Index i = 0; i < Num; i++) {
+      Block *Curr = Blocks[i];
+      Index j = 0;
+      for (auto& iter : Curr->BranchesOut) {
+        Index Target = Out[i][j++];
+        Branch *Details = iter.second;
+        if (Target <= i && Dominates(Target, i)) {
+          Details->Type = Branch::Continue;
+          Details->Ancestor = Loops[Target];
+        } else {
+          Details->Type = Branch::Break;
+          Details->Ancestor = Curr->Parent;
+        }
+        Curr->ProcessedBranchesOut[iter.first] = Details;
+        iter.first->ProcessedBranchesIn.insert(Curr);
+      }
+      Curr->BranchesOut.clear();
+    }
+    return Shapes[0];
+  }
+};
+
 void Relooper::Calculate(Block *Entry) {
+  // Most CFGs are reducible, and can be handled quickly using dominators
+  if (DominatorShaper(this).Calculate(Entry)) {
+    return;
+  }
+
   // Scan and optimize the input
   struct PreOptimizer : public RelooperRecursor {
     PreOptimizer(Relooper *Parent) : RelooperRecursor(Parent) {}
@@ -503,21 +940,32 @@ void Relooper::Calculate(Block *Entry) {
     void Solipsize(Block *Target, Branch::FlowType Type, Shape *Ancestor, BlockSet &From) {
       PrintDebug("Solipsizing branches into %d\n", Target->Id);
       DebugDump(From, "  relevant to solipsize: ");
-      for (BlockSet::iterator iter = Target->BranchesIn.begin(); iter != Target->BranchesIn.end();) {
-        Block *Prior = *iter;
-        if (!contains(From, Prior)) {
-          iter++;
-          continue;
-        }
+      auto Process = [&](Block *Prior) {
         Branch *PriorOut = Prior->BranchesOut[Target];
         PriorOut->Ancestor = Ancestor;
         PriorOut->Type = Type;
-        iter++; // carefully increment iter before erasing
         Target->BranchesIn.erase(Prior);
         Target->ProcessedBranchesIn.insert(Prior);
         Prior->BranchesOut.erase(Target);
         Prior->ProcessedBranchesOut[Target] = PriorOut;
         PrintDebug("  eliminated branch from %d\n", Prior->Id);
+      };
+      // scan whichever side is smaller, as a block may have very many
+      // incoming branches, of which just a few are relevant here
+      if (From.size() < Target->BranchesIn.size()) {
+        for (BlockSet::iterator iter = From.begin(); iter != From.end(); iter++) {
+          if (contains(Target->BranchesIn, *iter)) {
+            Process(*iter);
+          }
+        }
+        return;
+      }
+      for (BlockSet::iterator iter = Target->BranchesIn.begin(); iter != Target->BranchesIn.end();) {
+        Block *Prior = *iter;
+        iter++; // carefully increment iter before erasing
+        if (contains(From, Prior)) {
+          Process(Prior);
+        }
       }
     }
 
@@ -18,6 +18,8 @@
 This is an optimized C++ implemention of the Relooper algorithm originally
 developed as part of Emscripten. This implementation includes optimizations
 added since the original academic paper [1] was published about it.
+Reducible CFGs are handled by a faster path that builds shapes directly from
+the dominator tree and loop nesting forest, in close to linear time.
 
 [1] Alon Zakai. 2011. Emscripten: an LLVM-to-JavaScript compiler. In Proceedings of the ACM international conference companion on Object oriented programming systems languages and applications companion (SPLASH '11). ACM, New York, NY, USA, 301-312. DOI=10.1145/2048147.2048224 http://doi.acm.org/10.1145/2048147.2048224
 */
@@ -32,6 +34,7 @@ added since the original academic paper [1] was published about it.
 #include <map>
 #include <memory>
 #include <set>
+#include <unordered_map>
 
 #include "wasm.h"
 #include "wasm-builder.h"
@@ -106,8 +109,8 @@ struct Branch {
 template<typename T>
 struct InsertOrderedSet
 {
-  std::map<T, typename std::list<T>::iterator>  Map;
-  std::list<T>                                  List;
+  std::unordered_map<T, typename std::list<T>::iterator> Map;
+  std::list<T>                                           List;
 
   typedef typename std::list<T>::iterator iterator;
   iterator begin() { return List.begin(); }
@@ -164,8 +167,8 @@ struct InsertOrderedSet
 template<typename Key, typename T>
 struct InsertOrderedMap
 {
-  std::map<Key, typename std::list<std::pair<Key,T>>::iterator> Map;
-  std::list<std::pair<Key,T>>                                   List;
+  std::unordered_map<Key, typename std::list<std::pair<Key,T>>::iterator> Map;
+  std::list<std::pair<Key,T>>                                             List;
 
   T& operator[](const Key& k) {
     auto it = Map.find(k);
@@ -194,6 +197,11 @@ struct InsertOrderedMap
     erase(position->first);
   }
 
+  void clear() {
+    Map.clear();
+    List.clear();
+  }
+
   size_t size() const { return Map.size(); }
   bool empty() const { return Map.empty(); }
   size_t count(const Key& k) const { return Map.count(k); }
@@ -331,6 +339,7 @@ struct LoopShape : public Shape {
 // Implementation details: The Relooper instance has
 // ownership of the blocks and shapes, and frees them when done.
 struct Relooper {
+  wasm::Module* Module; // If provided, blocks can be copied, to avoid irreducible control flow
   std::deque<Block*> Blocks;
   std::deque<Shape*> Shapes;
   Shape *Root;
@@ -338,7 +347,7 @@ struct Relooper {
   int BlockIdCounter;
   int ShapeIdCounter;
 
-  Relooper();
+  Relooper(wasm::Module* ModuleInit = nullptr);
   ~Relooper();
 
   void AddBlock(Block *New, int Id=-1);
@@ -423,11 +423,51 @@ class Parser {
       abort();
     }
     src++;
+    if (lazyFunctions && functionDepth > 0) {
+      // leave the body for later, see parseToplevelLazily
+      skipSpace(src);
+      assert(*src == '{');
+      lazyFunctions->push_back({ ret, src });
+      skipBracketedBlock(src);
+      return ret;
+    }
+    functionDepth++;
     Builder::setBlockContent(ret, parseBracketedBlock(src));
+    functionDepth--;
     // TODO: parse expression?
     return ret;
   }
 
+  // Skips over a {} block without parsing it, by matching brackets while
+  // ignoring those in strings and comments.
+  static void skipBracketedBlock(char*& src) {
+    assert(*src == '{');
+    int depth = 0;
+    while (*src) {
+      skipSpace(src);
+      char c = *src;
+      if (c == '{') {
+        depth++;
+      } else if (c == '}') {
+        if (--depth == 0) {
+          src++;
+          return;
+        }
+      } else if (c == '"' || c == '\'') {
+        src++;
+        while (*src && *src != c) {
+          if (*src == '\\' && src[1]) src++;
+          src++;
+        }
+        if (!*src) break;
+      }
+      if (!*src) break;
+      src++;
+    }
+    dump("unterminated function body", src);
+    abort();
+  }
+
   NodeRef parseVar(char*& src, const char* seps, bool is_const) {
     NodeRef ret = Builder::makeVar(is_const);
     while (1) {
@@ -941,7 +981,13 @@ class Parser {
 
 public:
 
-  Parser() : allSource(nullptr), allSize(0) {
+  // A function whose body was not parsed yet
+  struct LazyFunction {
+    NodeRef func;
+    char* body; // the start of the body, at its {
+  };
+
+  Parser() : allSource(nullptr), allSize(0), lazyFunctions(nullptr), functionDepth(0) {
     expressionPartsStack.resize(1);
   }
 
@@ -953,6 +999,32 @@ public:
     Builder::setBlockContent(toplevel, parseBlock(src));
     return toplevel;
   }
+
+  // Like parseToplevel, but the bodies of functions inside functions (in
+  // asm.js, the functions of the module) are only located, and are noted,
+  // in order, in the given vector; they must be parsed with
+  // parseFunctionBody before the AST is used. Parsing a body only touches
+  // its own part of the source, so bodies can be parsed in parallel, each
+  // with its own Parser.
+  NodeRef parseToplevelLazily(char* src, std::vector<LazyFunction>& lazy) {
+    lazyFunctions = &lazy;
+    NodeRef toplevel = parseToplevel(src);
+    lazyFunctions = nullptr;
+    return toplevel;
+  }
+
+  void parseFunctionBody(LazyFunction& lazy) {
+    char* src = lazy.body;
+    functionDepth = 1;
+    Builder::setBlockContent(lazy.func, parseBracketedBlock(src));
+    functionDepth = 0;
+  }
+
+private:
+  // When set, function bodies inside functions are not parsed, but noted
+  // here (see parseToplevelLazily).
+  std::vector<LazyFunction>* lazyFunctions;
+  int functionDepth;
 };
 
 } // namespace cashew
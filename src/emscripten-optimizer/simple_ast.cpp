@@ -56,6 +56,8 @@ bool Ref::operator!() {
 
 GlobalMixedArena arena;
 
+ArrayStorage ArrayStorage::empty;
+
 // Value
 
 Value& Value::setAssign(Ref target, Ref value) {
@@ -254,7 +256,7 @@ void traversePre(Ref node, std::function<void (Ref)> visit) {
   int index = 0;
   ArrayStorage* arr = &node->getArray();
   int arrsize = (int)arr->size();
-  Ref* arrdata = &(*arr)[0];
+  Ref* arrdata = arr->data();
   stack.push_back(TraverseInfo(node, arr));
   while (1) {
     if (index < arrsize) {
@@ -266,7 +268,7 @@ void traversePre(Ref node, std::function<void (Ref)> visit) {
         visit(sub);
         arr = &sub->getArray();
         arrsize = (int)arr->size();
-        arrdata = &(*arr)[0];
+        arrdata = arr->data();
         stack.push_back(TraverseInfo(sub, arr));
       }
     } else {
@@ -276,7 +278,7 @@ void traversePre(Ref node, std::function<void (Ref)> visit) {
       index = back.index;
       arr = back.arr;
       arrsize = (int)arr->size();
-      arrdata = &(*arr)[0];
+      arrdata = arr->data();
     }
   }
 }
@@ -289,7 +291,7 @@ void traversePrePost(Ref node, std::function<void (Ref)> visitPre, std::function
   int index = 0;
   ArrayStorage* arr = &node->getArray();
   int arrsize = (int)arr->size();
-  Ref* arrdata = &(*arr)[0];
+  Ref* arrdata = arr->data();
   stack.push_back(TraverseInfo(node, arr));
   while (1) {
     if (index < arrsize) {
@@ -301,7 +303,7 @@ void traversePrePost(Ref node, std::function<void (Ref)> visitPre, std::function
         visitPre(sub);
         arr = &sub->getArray();
         arrsize = (int)arr->size();
-        arrdata = &(*arr)[0];
+        arrdata = arr->data();
         stack.push_back(TraverseInfo(sub, arr));
       }
     } else {
@@ -312,7 +314,7 @@ void traversePrePost(Ref node, std::function<void (Ref)> visitPre, std::function
       index = back.index;
       arr = back.arr;
       arrsize = (int)arr->size();
-      arrdata = &(*arr)[0];
+      arrdata = arr->data();
     }
   }
 }
@@ -325,7 +327,7 @@ void traversePrePostConditional(Ref node, std::function<bool (Ref)> visitPre, st
   int index = 0;
   ArrayStorage* arr = &node->getArray();
   int arrsize = (int)arr->size();
-  Ref* arrdata = &(*arr)[0];
+  Ref* arrdata = arr->data();
   stack.push_back(TraverseInfo(node, arr));
   while (1) {
     if (index < arrsize) {
@@ -337,7 +339,7 @@ void traversePrePostConditional(Ref node, std::function<bool (Ref)> visitPre, st
           index = 0;
           arr = &sub->getArray();
           arrsize = (int)arr->size();
-          arrdata = &(*arr)[0];
+          arrdata = arr->data();
           stack.push_back(TraverseInfo(sub, arr));
         }
       }
@@ -349,7 +351,7 @@ void traversePrePostConditional(Ref node, std::function<bool (Ref)> visitPre, st
       index = back.index;
       arr = back.arr;
       arrsize = (int)arr->size();
-      arrdata = &(*arr)[0];
+      arrdata = arr->data();
     }
   }
 }
@@ -78,6 +78,14 @@ struct Ref {
 // receive an allocator, they all use the global one anyhow
 class GlobalMixedArena : public MixedArena {
 public:
+  // when set, allocations are made there instead (see ScopedArena)
+  MixedArena* redirect = nullptr;
+
+  void* allocSpace(size_t size) {
+    if (redirect) return redirect->allocSpace(size);
+    return MixedArena::allocSpace(size);
+  }
+
   template<class T>
   T* alloc() {
     auto* ret = static_cast<T*>(allocSpace(sizeof(T)));
@@ -88,14 +96,58 @@ public:
 
 extern GlobalMixedArena arena;
 
-class ArrayStorage : public ArenaVectorBase<ArrayStorage, Ref> {
+// The global arena is never freed. To free an AST when done with it, build
+// it while a ScopedArena exists: everything allocated meanwhile, on any
+// thread, goes into the ScopedArena, and is freed together with it.
+class ScopedArena {
+  MixedArena own;
+  MixedArena* previous;
+
 public:
-  void allocate(size_t size) {
-    allocatedElements = size;
-    data = static_cast<Ref*>(arena.allocSpace(sizeof(Ref) * allocatedElements));
+  ScopedArena() : previous(arena.redirect) {
+    arena.redirect = &own;
+  }
+  ~ScopedArena() {
+    assert(arena.redirect == &own);
+    arena.redirect = previous;
   }
 };
 
+// The elements of an array, in a single arena allocation together with
+// their count and capacity, so an array node is two allocations: the value,
+// and this. Growing it may reallocate it, so that is done by the value.
+class ArrayStorage {
+  uint32_t usedElements;
+  uint32_t allocatedElements;
+
+  friend struct Value;
+
+  static ArrayStorage* allocate(size_t size) {
+    if (size == 0) return &empty;
+    assert(size <= std::numeric_limits<uint32_t>::max());
+    auto* ret = static_cast<ArrayStorage*>(arena.allocSpace(sizeof(ArrayStorage) + sizeof(Ref) * size));
+    ret->usedElements = 0;
+    ret->allocatedElements = size;
+    return ret;
+  }
+
+  // all empty arrays start out here, and must allocate before adding. this is
+  // shared between threads, so it must never be written to
+  static ArrayStorage empty;
+
+public:
+  Ref* data() { return reinterpret_cast<Ref*>(this + 1); }
+  size_t size() const { return usedElements; }
+  Ref& operator[](size_t index) {
+    assert(index < usedElements);
+    return data()[index];
+  }
+  Ref* begin() { return data(); }
+  Ref* end() { return data() + usedElements; }
+};
+
+static_assert(sizeof(ArrayStorage) % alignof(Ref) == 0, "array elements must be aligned");
+
 struct Assign;
 struct AssignName;
 
@@ -139,8 +191,7 @@ struct Value {
     setNumber(n);
   }
   explicit Value(ArrayStorage &a) : type(Null) {
-    setArray();
-    *arr = a;
+    setArray(a);
   }
   // no bool constructor - would endanger the double one (int might convert the wrong way)
 
@@ -149,8 +200,7 @@ struct Value {
   }
 
   void free() {
-    if (type == Array) { arr->clear(); }
-    else if (type == Object) delete obj;
+    if (type == Object) delete obj;
     type = Null;
     num = 0;
   }
@@ -174,17 +224,20 @@ struct Value {
     return *this;
   }
   Value& setArray(ArrayStorage &a) {
+    auto* copy = ArrayStorage::allocate(a.size());
+    if (a.size() > 0) {
+      std::copy(a.begin(), a.end(), copy->data());
+      copy->usedElements = a.size();
+    }
     free();
     type = Array;
-    arr = arena.alloc<ArrayStorage>();
-    *arr = a;
+    arr = copy;
     return *this;
   }
   Value& setArray(size_t size_hint=0) {
     free();
     type = Array;
-    arr = arena.alloc<ArrayStorage>();
-    arr->reserve(size_hint);
+    arr = ArrayStorage::allocate(size_hint);
     return *this;
   }
   Value& setNull() {
@@ -321,7 +374,7 @@ struct Value {
       setArray();
       while (*curr != ']') {
         Ref temp = arena.alloc<Value>();
-        arr->push_back(temp);
+        push_back(temp);
         curr = temp->parse(curr);
         skip();
         if (*curr == ']') break;
@@ -397,11 +450,12 @@ struct Value {
   void setSize(size_t size) {
     assert(isArray());
     auto old = arr->size();
-    if (old != size) arr->resize(size);
-    if (old < size) {
-      for (auto i = old; i < size; i++) {
-        (*arr)[i] = arena.alloc<Value>();
-      }
+    // an empty array may be the shared empty storage, which we never write to
+    if (size == old) return;
+    reserve(size);
+    arr->usedElements = size;
+    for (auto i = old; i < size; i++) {
+      (*arr)[i] = arena.alloc<Value>();
     }
   }
 
@@ -412,25 +466,38 @@ struct Value {
 
   Value& push_back(Ref r) {
     assert(isArray());
-    arr->push_back(r);
+    if (arr->usedElements == arr->allocatedElements) {
+      reserve(std::max(size_t(arr->allocatedElements) * 2, size_t(4)));
+    }
+    arr->data()[arr->usedElements++] = r;
     return *this;
   }
   Ref pop_back() {
-    assert(isArray());
-    Ref ret = arr->back();
-    arr->pop_back();
-    return ret;
+    assert(isArray() && arr->size() > 0);
+    return arr->data()[--arr->usedElements];
   }
 
   Ref back() {
     assert(isArray());
     if (arr->size() == 0) return nullptr;
-    return arr->back();
+    return arr->data()[arr->usedElements - 1];
   }
 
   void splice(int x, int num) {
+    assert(isArray() && x + num <= int(arr->size()));
+    if (num == 0) return;
+    std::copy(arr->begin() + x + num, arr->end(), arr->begin() + x);
+    arr->usedElements -= num;
+  }
+
+  // makes room for at least this many elements
+  void reserve(size_t size) {
     assert(isArray());
-    arr->erase(arr->begin() + x, arr->begin() + x + num);
+    if (size <= arr->allocatedElements) return;
+    auto* grown = ArrayStorage::allocate(size);
+    std::copy(arr->begin(), arr->end(), grown->data());
+    grown->usedElements = arr->usedElements;
+    arr = grown;
   }
 
   int indexOf(Ref other) {
@@ -552,6 +619,21 @@ struct JSPrinter {
 
   Ref ast;
 
+  // When printing to a stream, the buffer is written out after each
+  // function in a top-level statement list (the toplevel, and the bodies of
+  // functions in it, like the functions of an asm.js module), once it holds
+  // at least this much. Those are the only places where nothing looks back
+  // at, or rewinds, what was printed before.
+  static const size_t FLUSH_SIZE = 64 * 1024;
+  std::ostream* out = nullptr;
+
+  // Optionally called on each function in a top-level statement list right
+  // before it is printed, returning what to print in its place. This lets a
+  // function be generated only when it is about to be printed, and freed
+  // once it has been, so that when printing to a stream, the output of an
+  // entire program never needs to exist at once.
+  std::function<Ref (Ref)> expandFunction;
+
   JSPrinter(bool pretty_, bool finalize_, Ref ast_) : pretty(pretty_), finalize(finalize_), buffer(0), size(0), used(0), indent(0), possibleSpace(false), ast(ast_) {}
 
   ~JSPrinter() {
@@ -563,6 +645,14 @@ struct JSPrinter {
     buffer[used] = 0;
   }
 
+  void printAst(std::ostream& o) {
+    out = &o;
+    print(ast);
+    out->write(buffer, used);
+    used = 0;
+    out = nullptr;
+  }
+
   // Utils
 
   void ensure(int safety=100) {
@@ -587,6 +677,14 @@ struct JSPrinter {
     }
   }
 
+  void flush() {
+    if (!out || used < FLUSH_SIZE) return;
+    // keep the last character, which emit() may look at
+    out->write(buffer, used - 1);
+    buffer[0] = buffer[used - 1];
+    used = 1;
+  }
+
   void emit(char c) {
     maybeSpace(c);
     if (!pretty && c == '}' && buffer[used-1] == ';') used--; // optimize ;} into }, the ; is not separating anything
@@ -753,13 +851,20 @@ struct JSPrinter {
     if (used == last) emit(otherwise);
   }
 
-  void printStats(Ref stats) {
+  void printStats(Ref stats, bool topLevel = false) {
     bool first = true;
     for (size_t i = 0; i < stats->size(); i++) {
       Ref curr = stats[i];
       if (!isNothing(curr)) {
         if (first) first = false;
         else newline();
+        if (topLevel && isDefun(curr)) {
+          if (expandFunction) curr = expandFunction(curr);
+          ensure();
+          printDefun(curr, true);
+          flush();
+          continue;
+        }
         print(curr);
         if (!isDefun(curr) && !isBlock(curr) && !isIf(curr)) {
           emit(';');
@@ -770,7 +875,7 @@ struct JSPrinter {
 
   void printToplevel(Ref node) {
     if (node[1]->size() > 0) {
-      printStats(node[1]);
+      printStats(node[1], true);
     }
   }
 
@@ -788,7 +893,7 @@ struct JSPrinter {
     emit('}');
   }
 
-  void printDefun(Ref node) {
+  void printDefun(Ref node, bool topLevel = false) {
     emit("function ");
     emit(node[1]->getCString());
     emit('(');
@@ -806,7 +911,7 @@ struct JSPrinter {
     emit('{');
     indent++;
     newline();
-    printStats(node[3]);
+    printStats(node[3], topLevel);
     indent--;
     newline();
     emit('}');
@@ -862,15 +967,16 @@ struct JSPrinter {
     // try to emit the fewest necessary characters
     bool integer = fmod(d, 1) == 0;
     #define BUFFERSIZE 1000
-    static char full_storage_f[BUFFERSIZE], full_storage_e[BUFFERSIZE]; // f is normal, e is scientific for float, x for integer
-    static char *storage_f = full_storage_f + 1, *storage_e = full_storage_e + 1; // full has one more char, for a possible '-'
+    // the storage is per thread, as modules may be printed in parallel
+    thread_local static char full_storage_f[BUFFERSIZE], full_storage_e[BUFFERSIZE]; // f is normal, e is scientific for float, x for integer
+    thread_local static char *storage_f = full_storage_f + 1, *storage_e = full_storage_e + 1; // full has one more char, for a possible '-'
     auto err_f = std::numeric_limits<double>::quiet_NaN();
     auto err_e = std::numeric_limits<double>::quiet_NaN();
     for (int e = 0; e <= 1; e++) {
       char *buffer = e ? storage_e : storage_f;
       double temp;
       if (!integer) {
-        static char format[6];
+        char format[6];
         for (int i = 0; i <= 18; i++) {
           format[0] = '%';
           format[1] = '.';
@@ -1361,23 +1467,31 @@ class ValueBuilder {
     return &arena.alloc<Value>()->setNull();
   }
 
+  // The type at the start of a node. All nodes of a type share it, so it
+  // must not be modified.
+  template<IString& type>
+  static Ref makeNodeType() {
+    static Value value(type.str);
+    return &value;
+  }
+
 public:
   static Ref makeRawArray(int size_hint=0) {
     return &arena.alloc<Value>()->setArray(size_hint);
   }
 
   static Ref makeToplevel() {
-    return &makeRawArray(2)->push_back(makeRawString(TOPLEVEL))
+    return &makeRawArray(2)->push_back(makeNodeType<TOPLEVEL>())
                             .push_back(makeRawArray());
   }
 
   static Ref makeString(IString str) {
-    return &makeRawArray(2)->push_back(makeRawString(STRING))
+    return &makeRawArray(2)->push_back(makeNodeType<STRING>())
                             .push_back(makeRawString(str));
   }
 
   static Ref makeBlock() {
-    return &makeRawArray(2)->push_back(makeRawString(BLOCK))
+    return &makeRawArray(2)->push_back(makeNodeType<BLOCK>())
                             .push_back(makeRawArray());
   }
 
@@ -1399,19 +1513,19 @@ public:
   }
 
   static Ref makeCall(Ref target) {
-    return &makeRawArray(3)->push_back(makeRawString(CALL))
+    return &makeRawArray(3)->push_back(makeNodeType<CALL>())
                             .push_back(target)
                             .push_back(makeRawArray());
   }
   static Ref makeCall(Ref target, Ref arg) {
-    Ref ret = &makeRawArray(3)->push_back(makeRawString(CALL))
+    Ref ret = &makeRawArray(3)->push_back(makeNodeType<CALL>())
                                .push_back(target)
                                .push_back(makeRawArray());
     ret[2]->push_back(arg);
     return ret;
   }
   static Ref makeCall(IString target) {
-    Ref ret = &makeRawArray(3)->push_back(makeRawString(CALL))
+    Ref ret = &makeRawArray(3)->push_back(makeNodeType<CALL>())
                                .push_back(makeName(target))
                                .push_back(makeRawArray());
     return ret;
@@ -1425,7 +1539,7 @@ public:
     for (size_t i = 0; i < nArgs; ++i) {
       callArgs->push_back(argArray[i]);
     }
-    return &makeRawArray(3)->push_back(makeRawString(CALL))
+    return &makeRawArray(3)->push_back(makeNodeType<CALL>())
         .push_back(makeName(target))
         .push_back(callArgs);
   }
@@ -1450,7 +1564,7 @@ public:
   }
 
   static Ref makeUnary(IString op, Ref value) {
-    return &makeRawArray(3)->push_back(makeRawString(UNARY_PREFIX))
+    return &makeRawArray(3)->push_back(makeNodeType<UNARY_PREFIX>())
                             .push_back(makeRawString(op))
                             .push_back(value);
   }
@@ -1463,11 +1577,11 @@ public:
         return &arena.alloc<Assign>()->setAssign(left, right);
       }
     } else if (op == COMMA) {
-      return &makeRawArray(3)->push_back(makeRawString(SEQ))
+      return &makeRawArray(3)->push_back(makeNodeType<SEQ>())
                               .push_back(left)
                               .push_back(right);
     } else {
-      return &makeRawArray(4)->push_back(makeRawString(BINARY))
+      return &makeRawArray(4)->push_back(makeNodeType<BINARY>())
                               .push_back(makeRawString(op))
                               .push_back(left)
                               .push_back(right);
@@ -1475,13 +1589,13 @@ public:
   }
 
   static Ref makePrefix(IString op, Ref right) {
-    return &makeRawArray(3)->push_back(makeRawString(UNARY_PREFIX))
+    return &makeRawArray(3)->push_back(makeNodeType<UNARY_PREFIX>())
                             .push_back(makeRawString(op))
                             .push_back(right);
   }
 
   static Ref makeFunction(IString name) {
-    return &makeRawArray(4)->push_back(makeRawString(DEFUN))
+    return &makeRawArray(4)->push_back(makeNodeType<DEFUN>())
                             .push_back(makeRawString(name))
                             .push_back(makeRawArray())
                             .push_back(makeRawArray());
@@ -1493,7 +1607,7 @@ public:
   }
 
   static Ref makeVar(bool is_const=false) {
-    return &makeRawArray(2)->push_back(makeRawString(VAR))
+    return &makeRawArray(2)->push_back(makeNodeType<VAR>())
                             .push_back(makeRawArray());
   }
 
@@ -1505,50 +1619,50 @@ public:
   }
 
   static Ref makeReturn(Ref value) {
-    return &makeRawArray(2)->push_back(makeRawString(RETURN))
+    return &makeRawArray(2)->push_back(makeNodeType<RETURN>())
                             .push_back(!!value ? value : makeNull());
   }
 
   static Ref makeIndexing(Ref target, Ref index) {
-    return &makeRawArray(3)->push_back(makeRawString(SUB))
+    return &makeRawArray(3)->push_back(makeNodeType<SUB>())
                             .push_back(target)
                             .push_back(index);
   }
 
   static Ref makeIf(Ref condition, Ref ifTrue, Ref ifFalse) {
-    return &makeRawArray(4)->push_back(makeRawString(IF))
+    return &makeRawArray(4)->push_back(makeNodeType<IF>())
                             .push_back(condition)
                             .push_back(ifTrue)
                             .push_back(!!ifFalse ? ifFalse : makeNull());
   }
 
   static Ref makeConditional(Ref condition, Ref ifTrue, Ref ifFalse) {
-    return &makeRawArray(4)->push_back(makeRawString(CONDITIONAL))
+    return &makeRawArray(4)->push_back(makeNodeType<CONDITIONAL>())
                             .push_back(condition)
                             .push_back(ifTrue)
                             .push_back(ifFalse);
   }
 
   static Ref makeSeq(Ref left, Ref right) {
-    return &makeRawArray(3)->push_back(makeRawString(SEQ))
+    return &makeRawArray(3)->push_back(makeNodeType<SEQ>())
                             .push_back(left)
                             .push_back(right);
   }
 
   static Ref makeDo(Ref body, Ref condition) {
-    return &makeRawArray(3)->push_back(makeRawString(DO))
+    return &makeRawArray(3)->push_back(makeNodeType<DO>())
                             .push_back(condition)
                             .push_back(body);
   }
 
   static Ref makeWhile(Ref condition, Ref body) {
-    return &makeRawArray(3)->push_back(makeRawString(WHILE))
+    return &makeRawArray(3)->push_back(makeNodeType<WHILE>())
                             .push_back(condition)
                             .push_back(body);
   }
 
   static Ref makeFor(Ref init, Ref condition, Ref inc, Ref body) {
-    return &makeRawArray(5)->push_back(makeRawString(FOR))
+    return &makeRawArray(5)->push_back(makeNodeType<FOR>())
                             .push_back(init)
                             .push_back(condition)
                             .push_back(inc)
@@ -1556,23 +1670,23 @@ public:
   }
 
   static Ref makeBreak(IString label) {
-    return &makeRawArray(2)->push_back(makeRawString(BREAK))
+    return &makeRawArray(2)->push_back(makeNodeType<BREAK>())
                             .push_back(!!label ? makeRawString(label) : makeNull());
   }
 
   static Ref makeContinue(IString label) {
-    return &makeRawArray(2)->push_back(makeRawString(CONTINUE))
+    return &makeRawArray(2)->push_back(makeNodeType<CONTINUE>())
                             .push_back(!!label ? makeRawString(label) : makeNull());
   }
 
   static Ref makeLabel(IString name, Ref body) {
-    return &makeRawArray(3)->push_back(makeRawString(LABEL))
+    return &makeRawArray(3)->push_back(makeNodeType<LABEL>())
                             .push_back(makeRawString(name))
                             .push_back(body);
   }
 
   static Ref makeSwitch(Ref input) {
-    return &makeRawArray(3)->push_back(makeRawString(SWITCH))
+    return &makeRawArray(3)->push_back(makeNodeType<SWITCH>())
                             .push_back(input)
                             .push_back(makeRawArray());
   }
@@ -1604,14 +1718,14 @@ public:
   static Ref makeTry(Ref try_, Ref arg, Ref catch_) {
     assert(try_[0] == BLOCK);
     assert(catch_[0] == BLOCK);
-    return &makeRawArray(3)->push_back(makeRawString(TRY))
+    return &makeRawArray(3)->push_back(makeNodeType<TRY>())
                             .push_back(try_)
                             .push_back(arg)
                             .push_back(catch_);
   }
 
   static Ref makeDot(Ref obj, IString key) {
-    return &makeRawArray(3)->push_back(makeRawString(DOT))
+    return &makeRawArray(3)->push_back(makeNodeType<DOT>())
                             .push_back(obj)
                             .push_back(makeRawString(key));
   }
@@ -1627,12 +1741,12 @@ public:
   }
 
   static Ref makeNew(Ref call) {
-    return &makeRawArray(2)->push_back(makeRawString(NEW))
+    return &makeRawArray(2)->push_back(makeNodeType<NEW>())
                             .push_back(call);
   }
 
   static Ref makeArray() {
-    return &makeRawArray(2)->push_back(makeRawString(ARRAY))
+    return &makeRawArray(2)->push_back(makeNodeType<ARRAY>())
                             .push_back(makeRawArray());
   }
 
@@ -1642,7 +1756,7 @@ public:
   }
 
   static Ref makeObject() {
-    return &makeRawArray(2)->push_back(makeRawString(OBJECT))
+    return &makeRawArray(2)->push_back(makeNodeType<OBJECT>())
                             .push_back(makeRawArray());
   }
 
@@ -1653,7 +1767,7 @@ public:
   }
 
   static Ref makeSub(Ref obj, Ref index) {
-    return &makeRawArray(2)->push_back(makeRawString(SUB))
+    return &makeRawArray(2)->push_back(makeNodeType<SUB>())
                             .push_back(obj)
                             .push_back(index);
   }
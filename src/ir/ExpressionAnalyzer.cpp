@@ -17,6 +17,7 @@
 #include "support/hash.h"
 #include "ir/utils.h"
 #include "ir/load-utils.h"
+#include "ir/iteration.h"
 
 namespace wasm {
 // Given a stack of expressions, checks if the topmost is used as a result.
@@ -312,15 +313,30 @@ bool ExpressionAnalyzer::flexibleEqual(Expression* left, Expression* right, Expr
 }
 
 
+// Adds a value into a digest. A 32-bit digest takes 64-bit values in two parts.
+static void addToDigest(uint32_t& digest, uint32_t value) {
+  digest = rehash(digest, value);
+}
+
+static void addToDigest(uint32_t& digest, uint64_t value) {
+  addToDigest(digest, uint32_t(value >> 32));
+  addToDigest(digest, uint32_t(value));
+}
+
+static void addToDigest(uint64_t& digest, uint64_t value) {
+  digest = rehash64(digest, value);
+}
+
 // hash an expression, ignoring superficial details like specific internal names
-uint32_t ExpressionAnalyzer::hash(Expression* curr) {
-  uint32_t digest = 0;
+template<typename HashType>
+static HashType hashExpression(Expression* curr, const ExpressionAnalyzer::ExprHole* isHole = nullptr) {
+  HashType digest = 0;
 
   auto hash = [&digest](uint32_t hash) {
-    digest = rehash(digest, hash);
+    addToDigest(digest, hash);
   };
   auto hash64 = [&digest](uint64_t hash) {
-    digest = rehash(rehash(digest, uint32_t(hash >> 32)), uint32_t(hash));
+    addToDigest(digest, hash);
   };
 
   std::vector<Name> nameStack;
@@ -368,6 +384,14 @@ uint32_t ExpressionAnalyzer::hash(Expression* curr) {
     // call_imports type, etc. The simplest thing is just to hash the
     // type for all of them.
     hash(curr->type);
+    if (isHole && (*isHole)(curr)) {
+      ChildIterator iterator(curr);
+      hash(iterator.children.size());
+      for (auto* child : iterator.children) {
+        stack.push_back(child);
+      }
+      continue;
+    }
 
     #define PUSH(clazz, what) \
       stack.push_back(curr->cast<clazz>()->what);
@@ -567,4 +591,17 @@ uint32_t ExpressionAnalyzer::hash(Expression* curr) {
   }
   return digest;
 }
+
+uint32_t ExpressionAnalyzer::hash(Expression* curr) {
+  return hashExpression<uint32_t>(curr);
+}
+
+uint64_t ExpressionAnalyzer::hash64(Expression* curr) {
+  return hashExpression<uint64_t>(curr);
+}
+
+uint64_t ExpressionAnalyzer::flexibleHash64(Expression* curr, ExprHole isHole) {
+  return hashExpression<uint64_t>(curr, &isHole);
+}
+
 } // namespace wasm
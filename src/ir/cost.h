@@ -22,11 +22,15 @@ namespace wasm {
 // Measure the execution cost of an AST. Very handwave-ey
 
 struct CostAnalyzer : public Visitor<CostAnalyzer, Index> {
-  CostAnalyzer(Expression *ast) {
+  // By default the values written by set_local and set_global are not
+  // counted, which optimization decisions are tuned for. Reports that want
+  // the cost of all the work done can count them.
+  CostAnalyzer(Expression *ast, bool countSetValues = false) : countSetValues(countSetValues) {
     assert(ast);
     cost = visit(ast);
   }
 
+  bool countSetValues;
   Index cost;
 
   Index maybeVisit(Expression* curr) {
@@ -69,13 +73,13 @@ struct CostAnalyzer : public Visitor<CostAnalyzer, Index> {
     return 0;
   }
   Index visitSetLocal(SetLocal *curr) {
-    return 1;
+    return 1 + (countSetValues ? visit(curr->value) : 0);
   }
   Index visitGetGlobal(GetGlobal *curr) {
     return 1;
   }
   Index visitSetGlobal(SetGlobal *curr) {
-    return 2;
+    return 2 + (countSetValues ? visit(curr->value) : 0);
   }
   Index visitLoad(Load *curr) {
     return 1 + visit(curr->ptr) + 10 * curr->isAtomic;
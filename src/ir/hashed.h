@@ -53,12 +53,13 @@ template<typename T>
 class HashedExpressionMap : public std::unordered_map<HashedExpression, T, ExpressionHasher, ExpressionComparer> {
 };
 
-// A pass that hashes all functions
+// A pass that hashes all functions. We use a 64-bit hash here, as modules can
+// have very many functions, and we want collisions to be negligible.
 
 struct FunctionHasher : public WalkerPass<PostWalker<FunctionHasher>> {
   bool isFunctionParallel() override { return true; }
 
-  typedef uint32_t HashType;
+  typedef uint64_t HashType;
 
   struct Map : public std::map<Function*, HashType> {};
 
@@ -77,22 +78,26 @@ struct FunctionHasher : public WalkerPass<PostWalker<FunctionHasher>> {
   }
 
   void doWalkFunction(Function* func) {
-    output->at(func) = hashFunction(func);
+    // only hash the functions in the map, so a subset can be rehashed
+    auto iter = output->find(func);
+    if (iter != output->end()) {
+      iter->second = hashFunction(func);
+    }
   }
 
   static HashType hashFunction(Function* func) {
     HashType ret = 0;
-    ret = rehash(ret, (HashType)func->getNumParams());
+    ret = rehash64(ret, (HashType)func->getNumParams());
     for (auto type : func->params) {
-      ret = rehash(ret, (HashType)type);
+      ret = rehash64(ret, (HashType)type);
     }
-    ret = rehash(ret, (HashType)func->getNumVars());
+    ret = rehash64(ret, (HashType)func->getNumVars());
     for (auto type : func->vars) {
-      ret = rehash(ret, (HashType)type);
+      ret = rehash64(ret, (HashType)type);
     }
-    ret = rehash(ret, (HashType)func->result);
-    ret = rehash(ret, HashType(func->type.is() ? std::hash<wasm::Name>{}(func->type) : HashType(0)));
-    ret = rehash(ret, (HashType)ExpressionAnalyzer::hash(func->body));
+    ret = rehash64(ret, (HashType)func->result);
+    ret = rehash64(ret, HashType(func->type.is() ? std::hash<wasm::Name>{}(func->type) : HashType(0)));
+    ret = rehash64(ret, ExpressionAnalyzer::hash64(func->body));
     return ret;
   }
 
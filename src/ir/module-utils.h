@@ -18,6 +18,7 @@
 #define wasm_ir_module_h
 
 #include "wasm.h"
+#include "wasm-traversal.h"
 #include "ir/manipulation.h"
 
 namespace wasm {
@@ -52,7 +53,8 @@ struct BinaryIndexes {
   }
 };
 
-inline void copyModule(Module& in, Module& out) {
+// Copies everything but the functions from one module to another.
+inline void copyModuleExceptFunctions(Module& in, Module& out) {
   // we use names throughout, not raw points, so simple copying is fine
   // for everything *but* expressions
   for (auto& curr : in.functionTypes) {
@@ -64,13 +66,10 @@ inline void copyModule(Module& in, Module& out) {
   for (auto& curr : in.exports) {
     out.addExport(new Export(*curr));
   }
-  for (auto& curr : in.functions) {
-    auto* func = new Function(*curr);
-    func->body = ExpressionManipulator::copy(func->body, out);
-    out.addFunction(func);
-  }
   for (auto& curr : in.globals) {
-    out.addGlobal(new Global(*curr));
+    auto* global = new Global(*curr);
+    global->init = ExpressionManipulator::copy(global->init, out);
+    out.addGlobal(global);
   }
   out.table = in.table;
   for (auto& segment : out.table.segments) {
@@ -85,6 +84,70 @@ inline void copyModule(Module& in, Module& out) {
   out.debugInfoFileNames = in.debugInfoFileNames;
 }
 
+// Copies a function body into a module, along with its debug info.
+inline void copyBody(Function* func, Module& out) {
+  auto* copy = ExpressionManipulator::copy(func->body, out);
+  if (!func->debugLocations.empty()) {
+    // the copy has the same shape, so nodes correspond by their order
+    struct Lister : public PostWalker<Lister, UnifiedExpressionVisitor<Lister>> {
+      std::vector<Expression*> list;
+      void visitExpression(Expression* curr) {
+        list.push_back(curr);
+      }
+    };
+    Lister original, copied;
+    original.walk(func->body);
+    copied.walk(copy);
+    assert(original.list.size() == copied.list.size());
+    std::unordered_map<Expression*, Function::DebugLocation> debugLocations;
+    for (Index i = 0; i < original.list.size(); i++) {
+      auto iter = func->debugLocations.find(original.list[i]);
+      if (iter != func->debugLocations.end()) {
+        debugLocations[copied.list[i]] = iter->second;
+      }
+    }
+    func->debugLocations.swap(debugLocations);
+  }
+  func->body = copy;
+}
+
+inline void copyModule(Module& in, Module& out) {
+  copyModuleExceptFunctions(in, out);
+  for (auto& curr : in.functions) {
+    auto* func = new Function(*curr);
+    func->bodyShare.reset();
+    copyBody(func, out);
+    out.addFunction(func);
+  }
+}
+
+// Clones a module cheaply: the function bodies are not copied, and instead
+// are shared by the two modules until one of them modifies a function. The
+// PassRunner takes care of that for passes, by calling unshareBody on
+// functions before running passes that modify them; code that modifies a
+// clone's function bodies in other ways must do that itself.
+//
+// Shared nodes remain in the arena of the module they were allocated in, so
+// the original module must outlive the clone.
+inline void cloneModule(Module& in, Module& out) {
+  copyModuleExceptFunctions(in, out);
+  for (auto& curr : in.functions) {
+    if (!curr->bodyShare) {
+      curr->bodyShare = std::make_shared<char>(0);
+    }
+    out.addFunction(new Function(*curr));
+  }
+}
+
+// Gives a function a body of its own, if it is shared with other functions,
+// so that it can be modified.
+inline void unshareBody(Module& wasm, Function* func) {
+  if (func->isBodyShared()) {
+    copyBody(func, wasm);
+  }
+  func->bodyShare.reset();
+}
+
 inline Function* copyFunction(Module& in, Module& out, Name name) {
   Function *ret = out.getFunctionOrNull(name);
   if (ret != nullptr) {
@@ -92,7 +155,8 @@ inline Function* copyFunction(Module& in, Module& out, Name name) {
   }
   auto* curr = in.getFunction(name);
   auto* func = new Function(*curr);
-  func->body = ExpressionManipulator::copy(func->body, out);
+  func->bodyShare.reset();
+  copyBody(func, out);
   func->type = Name();
   out.addFunction(func);
   return func;
@@ -67,6 +67,16 @@ struct ExpressionAnalyzer {
 
   // hash an expression, ignoring superficial details like specific internal names
   static uint32_t hash(Expression* curr);
+  // as hash(), but with a 64-bit digest, for when collisions must be very
+  // rare, like when hashing all the functions in a large module
+  static uint64_t hash64(Expression* curr);
+
+  // Hash an expression with "holes": a node for which isHole returns true
+  // contributes only its id and type to the hash, and not its contents (like
+  // the value of a const, or the target of a call). Its children are hashed
+  // normally.
+  using ExprHole = std::function<bool(Expression*)>;
+  static uint64_t flexibleHash64(Expression* curr, ExprHole isHole);
 };
 
 // Re-Finalizes all node types
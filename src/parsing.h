@@ -18,6 +18,7 @@
 #define wasm_parsing_h
 
 #include <cmath>
+#include <cstring>
 #include <ostream>
 #include <sstream>
 #include <string>
@@ -76,12 +77,11 @@ struct MapParseException {
   }
 };
 
-inline Expression* parseConst(cashew::IString s, Type type, MixedArena& allocator) {
-  const char *str = s.str;
+inline Expression* parseConst(const char* str, Type type, MixedArena& allocator) {
   auto ret = allocator.alloc<Const>();
   ret->type = type;
   if (isFloatType(type)) {
-    if (s == _INFINITY) {
+    if (strcmp(str, _INFINITY.str) == 0) {
       switch (type) {
         case f32: ret->value = Literal(std::numeric_limits<float>::infinity()); break;
         case f64: ret->value = Literal(std::numeric_limits<double>::infinity()); break;
@@ -90,7 +90,7 @@ inline Expression* parseConst(cashew::IString s, Type type, MixedArena& allocato
       //std::cerr << "make constant " << str << " ==> " << ret->value << '\n';
       return ret;
     }
-    if (s == NEG_INFINITY) {
+    if (strcmp(str, NEG_INFINITY.str) == 0) {
       switch (type) {
         case f32: ret->value = Literal(-std::numeric_limits<float>::infinity()); break;
         case f64: ret->value = Literal(-std::numeric_limits<double>::infinity()); break;
@@ -99,7 +99,7 @@ inline Expression* parseConst(cashew::IString s, Type type, MixedArena& allocato
       //std::cerr << "make constant " << str << " ==> " << ret->value << '\n';
       return ret;
     }
-    if (s == _NAN) {
+    if (strcmp(str, _NAN.str) == 0) {
       switch (type) {
         case f32: ret->value = Literal(float(std::nan(""))); break;
         case f64: ret->value = Literal(double(std::nan(""))); break;
@@ -154,7 +154,7 @@ inline Expression* parseConst(cashew::IString s, Type type, MixedArena& allocato
       //std::cerr << "make constant " << str << " ==> " << ret->value << '\n';
       return ret;
     }
-    if (s == NEG_NAN) {
+    if (strcmp(str, NEG_NAN.str) == 0) {
       switch (type) {
         case f32: ret->value = Literal(float(-std::nan(""))); break;
         case f64: ret->value = Literal(double(-std::nan(""))); break;
@@ -270,6 +270,7 @@ struct UniqueNameMapper {
     labelStack.clear();
     labelMappings.clear();
     reverseLabelMapping.clear();
+    otherIndex = 0;
   }
 
   // Given an expression, ensures all names are unique
@@ -174,6 +174,7 @@ protected:
 private:
   void doAdd(Pass* pass);
 
+  void runPass(Pass* pass);
   void runPassOnFunction(Pass* pass, Function* func);
 };
 
@@ -213,6 +214,12 @@ public:
   // function either (which could be very inefficient).
   virtual bool isFunctionParallel() { return false; }
 
+  // Whether the pass may modify the IR. Passes that only read it, like the
+  // printers, can say so here, which lets them run on function bodies that
+  // are shared with other modules (see ModuleUtils::cloneModule) without
+  // copying them first.
+  virtual bool modifiesBinaryenIR() { return true; }
+
   // This method is used to create instances per function for a function-parallel
   // pass. You may need to override this if you subclass a Walker, as otherwise
   // this will create the parent class.
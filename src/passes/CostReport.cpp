@@ -0,0 +1,177 @@
+/*
+ * Copyright 2018 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Reports the estimated execution cost (see ir/cost.h, in which code in
+// loops counts for more the deeper it is nested) and the binary size of each
+// function. When run more than once, for example
+//
+//   wasm-opt --cost-report --inlining --cost-report -O --cost-report
+//
+// each report after the first shows what changed since the last one: the
+// totals, and the functions whose cost grew and shrank the most, which
+// shows which passes hurt which functions, without running anything.
+//
+// Each function line is
+//
+//   cost-delta size-delta cost size name
+//
+// so that the report is easy to sort and diff.
+//
+
+#include <algorithm>
+#include <iomanip>
+#include <pass.h>
+#include <support/colors.h>
+#include <wasm.h>
+#include <wasm-binary.h>
+#include <ir/cost.h>
+
+namespace wasm {
+
+// how many functions to show in each part of a report
+static const size_t TOP = 10;
+
+struct FunctionCost {
+  int64_t cost = 0;
+  int64_t size = 0;
+};
+
+typedef std::map<Name, FunctionCost> FunctionCosts;
+
+static FunctionCosts lastFunctionCosts;
+static bool haveLastFunctionCosts = false;
+
+struct CostReport : public Pass {
+  bool modifiesBinaryenIR() override { return false; }
+
+  void run(PassRunner* runner, Module* module) override {
+    // compute binary info, so we know function sizes
+    BufferWithRandomAccess buffer;
+    WasmBinaryWriter writer(module, buffer);
+    writer.write();
+    FunctionCosts costs;
+    FunctionCost total;
+    for (Index i = 0; i < module->functions.size(); i++) {
+      auto* func = module->functions[i].get();
+      auto& info = costs[func->name];
+      info.cost = CostAnalyzer(func->body, true /* countSetValues */).cost;
+      info.size = writer.tableOfContents.functionBodies[i].size;
+      total.cost += info.cost;
+      total.size += info.size;
+    }
+    std::ostream& o = std::cout;
+    o << "cost report\n";
+    if (!haveLastFunctionCosts) {
+      printTotal(o, "[cost]", total.cost, nullptr);
+      printTotal(o, "[binary-bytes]", total.size, nullptr);
+      // show where the cost is
+      std::vector<std::pair<Name, FunctionCost>> items(costs.begin(), costs.end());
+      std::stable_sort(items.begin(), items.end(), [](const std::pair<Name, FunctionCost>& a, const std::pair<Name, FunctionCost>& b) {
+        return a.second.cost > b.second.cost;
+      });
+      if (items.size() > TOP) {
+        items.resize(TOP);
+      }
+      o << " most costly:\n";
+      for (auto& item : items) {
+        printFunction(o, item.first, FunctionCost(), item.second);
+      }
+    } else {
+      FunctionCost lastTotal;
+      for (auto& pair : lastFunctionCosts) {
+        lastTotal.cost += pair.second.cost;
+        lastTotal.size += pair.second.size;
+      }
+      printTotal(o, "[cost]", total.cost, &lastTotal.cost);
+      printTotal(o, "[binary-bytes]", total.size, &lastTotal.size);
+      // find what changed, including functions that were added or removed
+      struct Change {
+        Name name;
+        FunctionCost before, after;
+        int64_t costDelta() const { return after.cost - before.cost; }
+        int64_t sizeDelta() const { return after.size - before.size; }
+      };
+      std::vector<Change> changes;
+      auto note = [&](Name name) {
+        Change change;
+        change.name = name;
+        if (lastFunctionCosts.count(name)) change.before = lastFunctionCosts[name];
+        if (costs.count(name)) change.after = costs[name];
+        if (change.costDelta() != 0 || change.sizeDelta() != 0) {
+          changes.push_back(change);
+        }
+      };
+      for (auto& pair : costs) {
+        note(pair.first);
+      }
+      for (auto& pair : lastFunctionCosts) {
+        if (!costs.count(pair.first)) note(pair.first);
+      }
+      // worst first, by cost and then by size
+      std::stable_sort(changes.begin(), changes.end(), [](const Change& a, const Change& b) {
+        if (a.costDelta() != b.costDelta()) return a.costDelta() > b.costDelta();
+        return a.sizeDelta() > b.sizeDelta();
+      });
+      o << " top regressions:\n";
+      for (size_t i = 0; i < changes.size() && i < TOP; i++) {
+        auto& change = changes[i];
+        if (change.costDelta() < 0 || (change.costDelta() == 0 && change.sizeDelta() <= 0)) break;
+        printFunction(o, change.name, change.before, change.after);
+      }
+      o << " top improvements:\n";
+      for (size_t i = 0; i < changes.size() && i < TOP; i++) {
+        auto& change = changes[changes.size() - 1 - i];
+        if (change.costDelta() > 0 || (change.costDelta() == 0 && change.sizeDelta() >= 0)) break;
+        printFunction(o, change.name, change.before, change.after);
+      }
+    }
+    lastFunctionCosts = std::move(costs);
+    haveLastFunctionCosts = true;
+  }
+
+  void printDelta(std::ostream& o, int64_t delta) {
+    if (delta > 0) {
+      Colors::red(o);
+    } else if (delta < 0) {
+      Colors::green(o);
+    }
+    o << std::right << std::setw(8) << std::showpos << delta << std::noshowpos;
+    Colors::normal(o);
+  }
+
+  void printTotal(std::ostream& o, const char* title, int64_t value, int64_t* last) {
+    o << " " << std::left << std::setw(15) << title << ": " << std::setw(8) << value;
+    if (last && value != *last) {
+      printDelta(o, value - *last);
+    }
+    o << "\n";
+  }
+
+  void printFunction(std::ostream& o, Name name, FunctionCost before, FunctionCost after) {
+    o << "  ";
+    printDelta(o, after.cost - before.cost);
+    o << ' ';
+    printDelta(o, after.size - before.size);
+    o << ' ' << std::right << std::setw(8) << after.cost << ' ' << std::setw(8) << after.size << ' ' << name << "\n";
+  }
+};
+
+Pass *createCostReportPass() {
+  return new CostReport();
+}
+
+} // namespace wasm
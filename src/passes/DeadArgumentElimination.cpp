@@ -0,0 +1,355 @@
+/*
+ * Copyright 2018 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Dead argument elimination: removes parameters that are never read, and
+// return values that are always dropped, from functions whose calls we
+// can all see, that is, functions that are not exported, not in the
+// table, and not the start function (the same roots as in
+// RemoveUnusedModuleElements).
+//
+// A parameter is only removed if none of the calls sends it a value
+// with side effects, as we would need to keep those around.
+//
+// Removing a parameter can make a caller's own parameter unused, so we
+// repeat the analysis until we are done.
+//
+// Two versions are provided: dae and dae-optimizing. The optimizing
+// version also optimizes the functions we modified, as removing a
+// result leaves the values that were returned dropped, etc.
+//
+
+#include <wasm.h>
+#include <pass.h>
+#include <wasm-builder.h>
+#include <asm_v_wasm.h>
+#include <ir/effects.h>
+#include <ir/utils.h>
+
+namespace wasm {
+
+// Information about a function, as the callee and as a caller.
+struct DAEFunctionInfo {
+  // which of the params are read
+  std::vector<bool> readParams;
+  // the calls in this function
+  std::vector<Call*> calls;
+  // the calls in this function whose values are dropped
+  std::unordered_set<Call*> droppedCalls;
+};
+
+typedef std::unordered_map<Name, DAEFunctionInfo> DAEFunctionInfoMap;
+
+struct DAEScanner : public WalkerPass<PostWalker<DAEScanner>> {
+  bool isFunctionParallel() override { return true; }
+
+  DAEScanner(DAEFunctionInfoMap* infos) : infos(infos) {}
+
+  DAEScanner* create() override {
+    return new DAEScanner(infos);
+  }
+
+  DAEFunctionInfo* info;
+
+  void visitGetLocal(GetLocal* curr) {
+    if (getFunction()->isParam(curr->index)) {
+      info->readParams[curr->index] = true;
+    }
+  }
+
+  void visitCall(Call* curr) {
+    info->calls.push_back(curr);
+  }
+
+  void visitDrop(Drop* curr) {
+    if (auto* call = curr->value->dynCast<Call>()) {
+      info->droppedCalls.insert(call);
+    }
+  }
+
+  void doWalkFunction(Function* func) {
+    assert(infos->count(func->name) > 0); // can't add a new element in parallel
+    info = &(*infos)[func->name];
+    info->readParams.resize(func->getNumParams());
+    walk(func->body);
+  }
+
+private:
+  DAEFunctionInfoMap* infos;
+};
+
+// The changes we decided to make to a function's signature.
+struct SignatureChange {
+  std::vector<bool> removedParams;
+  bool removedResult = false;
+};
+
+typedef std::unordered_map<Name, SignatureChange> SignatureChangeMap;
+
+// Updates the calls to functions whose signatures we changed.
+struct CallUpdater : public WalkerPass<PostWalker<CallUpdater>> {
+  bool isFunctionParallel() override { return true; }
+
+  CallUpdater(SignatureChangeMap* changes) : changes(changes) {}
+
+  CallUpdater* create() override {
+    return new CallUpdater(changes);
+  }
+
+  void visitCall(Call* curr) {
+    auto iter = changes->find(curr->target);
+    if (iter == changes->end()) return;
+    auto& change = iter->second;
+    Index skip = 0;
+    for (Index i = 0; i < curr->operands.size(); i++) {
+      if (change.removedParams[i]) {
+        skip++;
+      } else if (skip) {
+        curr->operands[i - skip] = curr->operands[i];
+      }
+    }
+    curr->operands.resize(curr->operands.size() - skip);
+    if (change.removedResult && curr->type != unreachable) {
+      curr->type = none;
+    }
+  }
+
+  void visitDrop(Drop* curr) {
+    auto* call = curr->value->dynCast<Call>();
+    if (!call) return;
+    auto iter = changes->find(call->target);
+    if (iter != changes->end() && iter->second.removedResult) {
+      replaceCurrent(call);
+    }
+  }
+
+private:
+  SignatureChangeMap* changes;
+};
+
+struct DeadArgumentElimination : public Pass {
+  // whether to optimize the functions we modified
+  bool optimize = false;
+
+  Module* module;
+
+  std::unordered_set<Function*> modified;
+
+  // functions that may be called from outside of the module
+  std::unordered_set<Name> usedGlobally;
+
+  DAEFunctionInfoMap infos;
+
+  void run(PassRunner* runner, Module* module_) override {
+    module = module_;
+    for (auto& ex : module->exports) {
+      if (ex->kind == ExternalKind::Function) {
+        usedGlobally.insert(ex->value);
+      }
+    }
+    for (auto& segment : module->table.segments) {
+      for (auto name : segment.data) {
+        usedGlobally.insert(name);
+      }
+    }
+    if (module->start.is()) {
+      usedGlobally.insert(module->start);
+    }
+    while (iteration(runner)) {}
+    if (optimize && !modified.empty()) {
+      doOptimize(runner);
+    }
+  }
+
+  bool iteration(PassRunner* runner) {
+    infos.clear();
+    // fill in info, as we operate on it in parallel (each function to its own entry)
+    for (auto& func : module->functions) {
+      infos[func->name];
+    }
+    {
+      PassRunner runner(module);
+      runner.setIsNested(true);
+      runner.add<DAEScanner>(&infos);
+      runner.run();
+    }
+    // gather the calls to each function
+    std::unordered_map<Name, std::vector<Call*>> callsTo;
+    std::unordered_set<Name> resultUsed;
+    for (auto& func : module->functions) {
+      auto& info = infos[func->name];
+      for (auto* call : info.calls) {
+        callsTo[call->target].push_back(call);
+        if (!info.droppedCalls.count(call)) {
+          resultUsed.insert(call->target);
+        }
+      }
+    }
+    // decide what to remove
+    SignatureChangeMap changes;
+    for (auto& func : module->functions) {
+      if (usedGlobally.count(func->name)) continue;
+      auto& calls = callsTo[func->name];
+      SignatureChange change;
+      bool changed = false;
+      change.removedParams.resize(func->getNumParams());
+      for (Index i = 0; i < func->getNumParams(); i++) {
+        if (infos[func->name].readParams[i]) continue;
+        bool canRemove = true;
+        for (auto* call : calls) {
+          if (EffectAnalyzer(runner->options, call->operands[i]).hasSideEffects()) {
+            canRemove = false;
+            break;
+          }
+        }
+        if (canRemove) {
+          change.removedParams[i] = true;
+          changed = true;
+        }
+      }
+      if (isConcreteType(func->result) && !resultUsed.count(func->name)) {
+        change.removedResult = true;
+        changed = true;
+      }
+      if (changed) {
+        changes[func->name] = std::move(change);
+      }
+    }
+    if (changes.empty()) return false;
+    // update the functions, then the calls to them. we go in module order, as
+    // that is the order in which any new function types are added
+    for (auto& curr : module->functions) {
+      auto iter = changes.find(curr->name);
+      if (iter == changes.end()) continue;
+      auto* func = curr.get();
+      auto& change = iter->second;
+      if (change.removedResult) {
+        removeResult(func);
+      }
+      removeParams(func, change.removedParams);
+      func->type = ensureFunctionType(getSig(func), module)->name;
+      modified.insert(func);
+    }
+    {
+      PassRunner runner(module);
+      runner.setIsNested(true);
+      runner.add<CallUpdater>(&changes);
+      runner.run();
+    }
+    return true;
+  }
+
+  void removeResult(Function* func) {
+    struct ReturnUpdater : public PostWalker<ReturnUpdater> {
+      Module* module;
+      void visitReturn(Return* curr) {
+        auto* value = curr->value;
+        if (!value) return;
+        curr->value = nullptr;
+        Builder builder(*module);
+        replaceCurrent(builder.makeSequence(builder.makeDrop(value), curr));
+      }
+    } returnUpdater;
+    returnUpdater.module = module;
+    returnUpdater.walk(func->body);
+    if (isConcreteType(func->body->type)) {
+      func->body = Builder(*module).makeDrop(func->body);
+    }
+    func->result = none;
+    ReFinalize().walkFunctionInModule(func, module);
+  }
+
+  // Removes params by turning them into vars, which keeps any sets of
+  // them valid.
+  void removeParams(Function* func, std::vector<bool>& removedParams) {
+    auto numParams = func->getNumParams();
+    auto numLocals = func->getNumLocals();
+    std::vector<Index> mapping(numLocals);
+    std::vector<Type> params, vars;
+    for (Index i = 0; i < numParams; i++) {
+      if (!removedParams[i]) {
+        mapping[i] = params.size();
+        params.push_back(func->params[i]);
+      }
+    }
+    if (params.size() == numParams) return;
+    for (Index i = numParams; i < numLocals; i++) {
+      mapping[i] = params.size() + vars.size();
+      vars.push_back(func->getLocalType(i));
+    }
+    for (Index i = 0; i < numParams; i++) {
+      if (removedParams[i]) {
+        mapping[i] = params.size() + vars.size();
+        vars.push_back(func->params[i]);
+      }
+    }
+    struct LocalUpdater : public PostWalker<LocalUpdater> {
+      std::vector<Index>* mapping;
+      void visitGetLocal(GetLocal* curr) {
+        curr->index = (*mapping)[curr->index];
+      }
+      void visitSetLocal(SetLocal* curr) {
+        curr->index = (*mapping)[curr->index];
+      }
+    } localUpdater;
+    localUpdater.mapping = &mapping;
+    localUpdater.walk(func->body);
+    func->params.swap(params);
+    func->vars.swap(vars);
+    std::map<Index, Name> localNames;
+    std::map<Name, Index> localIndices;
+    for (auto& pair : func->localNames) {
+      localNames[mapping[pair.first]] = pair.second;
+      localIndices[pair.second] = mapping[pair.first];
+    }
+    func->localNames.swap(localNames);
+    func->localIndices.swap(localIndices);
+  }
+
+  // Run useful optimizations on the functions we modified.
+  void doOptimize(PassRunner* parentRunner) {
+    // save the full list of functions on the side
+    std::vector<std::unique_ptr<Function>> all;
+    all.swap(module->functions);
+    module->updateMaps();
+    for (auto* func : modified) {
+      module->addFunction(func);
+    }
+    PassRunner runner(module, parentRunner->options);
+    runner.setIsNested(true);
+    runner.setValidateGlobally(false); // not a full valid module
+    runner.addDefaultFunctionOptimizationPasses();
+    runner.run();
+    // restore all the funcs
+    for (auto& func : module->functions) {
+      func.release();
+    }
+    all.swap(module->functions);
+    module->updateMaps();
+  }
+};
+
+Pass *createDeadArgumentEliminationPass() {
+  return new DeadArgumentElimination();
+}
+
+Pass *createDeadArgumentEliminationOptimizingPass() {
+  auto* ret = new DeadArgumentElimination();
+  ret->optimize = true;
+  return ret;
+}
+
+} // namespace wasm
@@ -28,28 +28,88 @@
 
 namespace wasm {
 
-struct FunctionReplacer : public WalkerPass<PostWalker<FunctionReplacer>> {
+// The direct calls in each function, so that we can find the callers of
+// a function without scanning the entire module.
+typedef std::map<Function*, std::vector<Call*>> CallMap;
+
+struct DirectCallScanner : public WalkerPass<PostWalker<DirectCallScanner>> {
   bool isFunctionParallel() override { return true; }
 
-  FunctionReplacer(std::map<Name, Name>* replacements) : replacements(replacements) {}
+  DirectCallScanner(CallMap* calls) : calls(calls) {}
 
-  FunctionReplacer* create() override {
-    return new FunctionReplacer(replacements);
+  DirectCallScanner* create() override {
+    return new DirectCallScanner(calls);
   }
 
   void visitCall(Call* curr) {
-    auto iter = replacements->find(curr->target);
-    if (iter != replacements->end()) {
-      curr->target = iter->second;
+    calls->at(getFunction()).push_back(curr);
+  }
+
+private:
+  CallMap* calls;
+};
+
+// For each function we need to check, the functions with the same hash,
+// and the original function it duplicates, if there is one.
+struct DuplicateInfo {
+  std::vector<Function*>* group = nullptr;
+  Function* original = nullptr;
+};
+
+typedef std::map<Function*, DuplicateInfo> DuplicateInfoMap;
+
+// Finds the original of each function, which is the first function in its
+// hash group that it is equal to. As equality is transitive, that is the
+// same for all the functions that are equal to each other, so we can
+// do this for each function in parallel.
+struct DuplicateFinder : public WalkerPass<PostWalker<DuplicateFinder>> {
+  bool isFunctionParallel() override { return true; }
+
+  DuplicateFinder(DuplicateInfoMap* infos) : infos(infos) {}
+
+  DuplicateFinder* create() override {
+    return new DuplicateFinder(infos);
+  }
+
+  void doWalkFunction(Function* func) {
+    auto iter = infos->find(func);
+    if (iter == infos->end()) return;
+    auto& info = iter->second;
+    // The groups should be fairly small, and even if a group is large we should
+    // have almost all of them identical, so we should not hit actual O(N^2)
+    // here unless the hash is quite poor.
+    for (auto* other : *info.group) {
+      if (other == func) break;
+      if (FunctionUtils::equal(other, func)) {
+        info.original = other;
+        break;
+      }
     }
   }
 
 private:
-  std::map<Name, Name>* replacements;
+  DuplicateInfoMap* infos;
 };
 
 struct DuplicateFunctionElimination : public Pass {
-  void run(PassRunner* runner, Module* module) override {
+  Module* module;
+
+  // the position of each function in the module, which determines which of
+  // a set of duplicates we keep (the first)
+  std::map<Function*, Index> order;
+
+  FunctionHasher::Map hashes;
+  std::unordered_map<FunctionHasher::HashType, std::vector<Function*>> groups;
+
+  CallMap calls;
+  // the calls to each function, and the functions they are in
+  std::unordered_map<Name, std::vector<std::pair<Function*, Call*>>> callsTo;
+
+  // the duplicates we removed, whose calls we should ignore
+  std::unordered_set<Function*> removed;
+
+  void run(PassRunner* runner, Module* module_) override {
+    module = module_;
     // Multiple iterations may be necessary: A and B may be identical only after we
     // see the functions C1 and C2 that they call are in fact identical. Rarely, such
     // "chains" can be very long, so we limit how many we do.
@@ -62,83 +122,145 @@ struct DuplicateFunctionElimination : public Pass {
     } else {
       limit = 1;
     }
+    // Hash all the functions, and find the calls in them
+    hashes = FunctionHasher::createMap(module);
+    for (Index i = 0; i < module->functions.size(); i++) {
+      auto* func = module->functions[i].get();
+      order[func] = i;
+      calls[func];
+    }
+    {
+      PassRunner runner(module);
+      runner.setIsNested(true);
+      runner.add<FunctionHasher>(&hashes);
+      runner.add<DirectCallScanner>(&calls);
+      runner.run();
+    }
+    std::vector<Function*> toCheck;
+    for (auto& func : module->functions) {
+      groups[hashes[func.get()]].push_back(func.get());
+      for (auto* call : calls[func.get()]) {
+        callsTo[call->target].emplace_back(func.get(), call);
+      }
+      toCheck.push_back(func.get());
+    }
+    // After the first iteration, only the callers of functions we merged can
+    // have changed, so they are all we need to look at.
     while (limit > 0) {
       limit--;
-      // Hash all the functions
-      auto hashes = FunctionHasher::createMap(module);
-      PassRunner hasherRunner(module);
-      hasherRunner.setIsNested(true);
-      hasherRunner.add<FunctionHasher>(&hashes);
-      hasherRunner.run();
-      // Find hash-equal groups
-      std::map<uint32_t, std::vector<Function*>> hashGroups;
-      for (auto& func : module->functions) {
-        hashGroups[hashes[func.get()]].push_back(func.get());
+      auto replacements = findDuplicates(toCheck);
+      if (replacements.empty()) break;
+      toCheck = replace(replacements);
+    }
+  }
+
+  // Finds the duplicates among the functions in the same groups as the given
+  // ones, and returns a map of each duplicate to the function that replaces it.
+  std::map<Name, Name> findDuplicates(std::vector<Function*>& toCheck) {
+    DuplicateInfoMap infos;
+    for (auto* func : toCheck) {
+      auto& group = groups[hashes[func]];
+      if (group.size() == 1) continue;
+      for (auto* member : group) {
+        infos[member].group = &group;
       }
-      // Find actually equal functions and prepare to replace them
-      std::map<Name, Name> replacements;
-      std::set<Name> duplicates;
-      for (auto& pair : hashGroups) {
-        auto& group = pair.second;
-        Index size = group.size();
-        if (size == 1) continue;
-        // The groups should be fairly small, and even if a group is large we should
-        // have almost all of them identical, so we should not hit actual O(N^2)
-        // here unless the hash is quite poor.
-        for (Index i = 0; i < size - 1; i++) {
-          auto* first = group[i];
-          if (duplicates.count(first->name)) continue;
-          for (Index j = i + 1; j < size; j++) {
-            auto* second = group[j];
-            if (duplicates.count(second->name)) continue;
-            if (FunctionUtils::equal(first, second)) {
-              // great, we can replace the second with the first!
-              replacements[second->name] = first->name;
-              duplicates.insert(second->name);
-            }
-          }
-        }
+    }
+    std::map<Name, Name> replacements;
+    if (infos.empty()) return replacements;
+    {
+      PassRunner runner(module);
+      runner.setIsNested(true);
+      runner.add<DuplicateFinder>(&infos);
+      runner.run();
+    }
+    for (auto& pair : infos) {
+      if (pair.second.original) {
+        replacements[pair.first->name] = pair.second.original->name;
       }
-      // perform replacements
-      if (replacements.size() > 0) {
-        // remove the duplicates
-        auto& v = module->functions;
-        v.erase(std::remove_if(v.begin(), v.end(), [&](const std::unique_ptr<Function>& curr) {
-          return duplicates.count(curr->name) > 0;
-        }), v.end());
-        module->updateMaps();
-        // replace direct calls
-        PassRunner replacerRunner(module);
-        replacerRunner.setIsNested(true);
-        replacerRunner.add<FunctionReplacer>(&replacements);
-        replacerRunner.run();
-        // replace in table
-        for (auto& segment : module->table.segments) {
-          for (auto& name : segment.data) {
-            auto iter = replacements.find(name);
-            if (iter != replacements.end()) {
-              name = iter->second;
-            }
-          }
-        }
-        // replace in start
-        if (module->start.is()) {
-          auto iter = replacements.find(module->start);
-          if (iter != replacements.end()) {
-            module->start = iter->second;
-          }
-        }
-        // replace in exports
-        for (auto& exp : module->exports) {
-          auto iter = replacements.find(exp->value);
-          if (iter != replacements.end()) {
-            exp->value = iter->second;
-          }
+    }
+    return replacements;
+  }
+
+  // Replaces the duplicates, and returns the functions we modified.
+  std::vector<Function*> replace(std::map<Name, Name>& replacements) {
+    for (auto& pair : replacements) {
+      auto* func = module->getFunction(pair.first);
+      removed.insert(func);
+      auto& group = groups[hashes[func]];
+      group.erase(std::find(group.begin(), group.end(), func));
+      hashes.erase(func);
+      calls.erase(func);
+      order.erase(func);
+    }
+    // remove the duplicates
+    auto& v = module->functions;
+    v.erase(std::remove_if(v.begin(), v.end(), [&](const std::unique_ptr<Function>& curr) {
+      return replacements.count(curr->name) > 0;
+    }), v.end());
+    module->updateMaps();
+    // replace direct calls, by looking at the callers of the duplicates
+    std::set<Function*> modified;
+    for (auto& pair : replacements) {
+      auto iter = callsTo.find(pair.first);
+      if (iter == callsTo.end()) continue;
+      auto& newCalls = callsTo[pair.second];
+      for (auto& site : iter->second) {
+        if (removed.count(site.first)) continue;
+        site.second->target = pair.second;
+        newCalls.push_back(site);
+        modified.insert(site.first);
+      }
+      callsTo.erase(pair.first);
+    }
+    // replace in table
+    for (auto& segment : module->table.segments) {
+      for (auto& name : segment.data) {
+        auto iter = replacements.find(name);
+        if (iter != replacements.end()) {
+          name = iter->second;
         }
-      } else {
-        break;
       }
     }
+    // replace in start
+    if (module->start.is()) {
+      auto iter = replacements.find(module->start);
+      if (iter != replacements.end()) {
+        module->start = iter->second;
+      }
+    }
+    // replace in exports
+    for (auto& exp : module->exports) {
+      auto iter = replacements.find(exp->value);
+      if (iter != replacements.end()) {
+        exp->value = iter->second;
+      }
+    }
+    // rehash the modified functions, and move them to their new groups,
+    // keeping the groups in module order
+    FunctionHasher::Map newHashes;
+    for (auto* func : modified) {
+      auto& group = groups[hashes[func]];
+      group.erase(std::find(group.begin(), group.end(), func));
+      newHashes[func] = 0;
+    }
+    {
+      PassRunner runner(module);
+      runner.setIsNested(true);
+      runner.add<FunctionHasher>(&newHashes);
+      runner.run();
+    }
+    std::vector<Function*> ret;
+    for (auto& pair : newHashes) {
+      auto* func = pair.first;
+      hashes[func] = pair.second;
+      auto& group = groups[pair.second];
+      auto position = std::upper_bound(group.begin(), group.end(), func, [&](Function* a, Function* b) {
+        return order[a] < order[b];
+      });
+      group.insert(position, func);
+      ret.push_back(func);
+    }
+    return ret;
   }
 };
 
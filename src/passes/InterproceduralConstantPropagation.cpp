@@ -0,0 +1,382 @@
+/*
+ * Copyright 2018 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Interprocedural constant propagation.
+//
+//  * If all the calls to a function send the same constant (or the same
+//    immutable global) for a parameter, apply that value inside the
+//    function. The parameter is then unused, and can be removed by
+//    other passes.
+//  * If a function always returns the same constant, use that constant
+//    in the callers (the call remains, as it may have side effects, but
+//    its result is dropped).
+//  * When optimizing for speed, clone a function for a set of calls that
+//    send the same constants, if after propagating the constants in the
+//    clone it becomes much smaller than the original.
+//
+// Functions that are exported, or in the table, may be called from
+// places we cannot see, so we do not modify their parameters (but
+// we may still clone them).
+//
+// After modifying a function we optimize it, which can lead to more
+// opportunities, so we repeat that until we are done.
+//
+
+#include <wasm.h>
+#include <pass.h>
+#include <wasm-builder.h>
+#include <ir/find_all.h>
+#include <ir/utils.h>
+
+namespace wasm {
+
+// Never clone functions larger than this.
+static const Index MAX_CLONE_SIZE = 200;
+
+// How many clones we may create for a single function.
+static const Index MAX_CLONES_PER_FUNCTION = 4;
+
+// Information about the calls in a function, and about the function itself.
+struct CallerInfo {
+  // all the calls in the function, and where they are
+  std::vector<std::pair<Call*, Expression**>> calls;
+  // the calls whose values are dropped
+  std::unordered_set<Call*> droppedCalls;
+  // the constant this function always returns, if there is one
+  Const* constantReturn = nullptr;
+};
+
+typedef std::unordered_map<Name, CallerInfo> CallerInfoMap;
+
+struct CallScanner : public WalkerPass<PostWalker<CallScanner>> {
+  bool isFunctionParallel() override { return true; }
+
+  CallScanner(CallerInfoMap* infos) : infos(infos) {}
+
+  CallScanner* create() override {
+    return new CallScanner(infos);
+  }
+
+  void visitCall(Call* curr) {
+    assert(infos->count(getFunction()->name) > 0); // can't add a new element in parallel
+    (*infos)[getFunction()->name].calls.emplace_back(curr, getCurrentPointer());
+  }
+
+  void visitDrop(Drop* curr) {
+    if (auto* call = curr->value->dynCast<Call>()) {
+      (*infos)[getFunction()->name].droppedCalls.insert(call);
+    }
+  }
+
+  void visitFunction(Function* curr) {
+    (*infos)[curr->name].constantReturn = getConstantReturn(curr);
+  }
+
+private:
+  CallerInfoMap* infos;
+
+  static Const* getConstantReturn(Function* func) {
+    if (!isConcreteType(func->result)) return nullptr;
+    std::vector<Expression*> values;
+    for (auto* ret : FindAll<Return>(func->body).list) {
+      values.push_back(ret->value);
+    }
+    // the value falling through at the end of the function, if there is one
+    if (func->body->type != unreachable) {
+      auto* fallthrough = func->body;
+      if (auto* block = fallthrough->dynCast<Block>()) {
+        // a named block may be branched to with another value
+        if (block->name.is() || block->list.empty()) return nullptr;
+        fallthrough = block->list.back();
+      }
+      values.push_back(fallthrough);
+    }
+    Const* ret = nullptr;
+    for (auto* value : values) {
+      auto* c = value ? value->dynCast<Const>() : nullptr;
+      if (!c || (ret && !(ret->value == c->value))) return nullptr;
+      ret = c;
+    }
+    return ret;
+  }
+};
+
+struct InterproceduralConstantPropagation : public Pass {
+  Module* module;
+
+  // functions that may be called from outside of the module
+  std::unordered_set<Name> usedGlobally;
+
+  // parameters we already applied a value to
+  std::set<std::pair<Name, Index>> appliedParams;
+
+  CallerInfoMap infos;
+
+  // for each function, the calls to it
+  std::unordered_map<Name, std::vector<Call*>> callsTo;
+
+  void run(PassRunner* runner, Module* module_) override {
+    module = module_;
+    for (auto& ex : module->exports) {
+      if (ex->kind == ExternalKind::Function) {
+        usedGlobally.insert(ex->value);
+      }
+    }
+    for (auto& segment : module->table.segments) {
+      for (auto name : segment.data) {
+        usedGlobally.insert(name);
+      }
+    }
+    if (module->start.is()) {
+      usedGlobally.insert(module->start);
+    }
+    // propagate until we stop finding new opportunities
+    while (1) {
+      scan();
+      std::unordered_set<Function*> changed;
+      propagateParams(changed);
+      propagateReturns(changed);
+      if (changed.empty()) break;
+      optimize(changed, runner);
+    }
+    if (runner->options.optimizeLevel >= 3 && runner->options.shrinkLevel == 0) {
+      scan();
+      cloneFunctions(runner);
+    }
+  }
+
+  void scan() {
+    infos.clear();
+    callsTo.clear();
+    // fill in info, as we operate on it in parallel (each function to its own entry)
+    for (auto& func : module->functions) {
+      infos[func->name];
+      callsTo[func->name];
+    }
+    {
+      PassRunner runner(module);
+      runner.setIsNested(true);
+      runner.add<CallScanner>(&infos);
+      runner.run();
+    }
+    for (auto& func : module->functions) {
+      for (auto& pair : infos[func->name].calls) {
+        auto* call = pair.first;
+        // calls that are never reached do not matter
+        if (call->type == unreachable) continue;
+        callsTo[call->target].push_back(call);
+      }
+    }
+  }
+
+  // Returns the value sent in a call operand, if it is constant.
+  Expression* getConstantOperand(Expression* operand) {
+    if (operand->is<Const>()) return operand;
+    if (auto* get = operand->dynCast<GetGlobal>()) {
+      // imported globals are immutable
+      auto* global = module->getGlobalOrNull(get->name);
+      if (!global || !global->mutable_) return operand;
+    }
+    return nullptr;
+  }
+
+  // Returns the constant value sent to a parameter by all the given calls,
+  // if there is one.
+  Expression* getConstantParam(Name func, Index i, std::vector<Call*>& calls) {
+    if (appliedParams.count(std::make_pair(func, i))) return nullptr;
+    Expression* ret = nullptr;
+    for (auto* call : calls) {
+      auto* value = getConstantOperand(call->operands[i]);
+      if (!value || (ret && !ExpressionAnalyzer::equal(ret, value))) return nullptr;
+      ret = value;
+    }
+    return ret;
+  }
+
+  // Applies a value to a parameter, at the start of the function.
+  void applyParam(Function* func, Index i, Expression* value) {
+    Builder builder(*module);
+    func->body = builder.makeSequence(
+      builder.makeSetLocal(i, ExpressionManipulator::copy(value, *module)),
+      func->body
+    );
+    appliedParams.insert(std::make_pair(func->name, i));
+  }
+
+  void propagateParams(std::unordered_set<Function*>& changed) {
+    for (auto& func : module->functions) {
+      auto& calls = callsTo[func->name];
+      if (calls.empty() || usedGlobally.count(func->name)) continue;
+      for (Index i = 0; i < func->getNumParams(); i++) {
+        if (auto* value = getConstantParam(func->name, i, calls)) {
+          applyParam(func.get(), i, value);
+          changed.insert(func.get());
+        }
+      }
+    }
+  }
+
+  void propagateReturns(std::unordered_set<Function*>& changed) {
+    Builder builder(*module);
+    for (auto& func : module->functions) {
+      auto& info = infos[func->name];
+      for (auto& pair : info.calls) {
+        auto* call = pair.first;
+        auto* value = infos[call->target].constantReturn;
+        if (!value || !isConcreteType(call->type) || info.droppedCalls.count(call)) continue;
+        // if the call was the whole body, applying a param may have moved
+        // it into a block. the next iteration will find it there
+        if (*pair.second != call) continue;
+        // the call may still have side effects, so keep it around
+        *pair.second = builder.makeSequence(
+          builder.makeDrop(call),
+          builder.makeConst(value->value)
+        );
+        changed.insert(func.get());
+      }
+    }
+  }
+
+  // Clones a function for groups of calls that send the same constants to it,
+  // and keeps the clones that become much smaller after optimization.
+  void cloneFunctions(PassRunner* runner) {
+    struct CloneGroup {
+      Function* original;
+      std::vector<Expression*> values; // a constant value per param, or null
+      std::vector<Call*> calls;
+    };
+    std::vector<CloneGroup> groups;
+    for (auto& func : module->functions) {
+      auto& calls = callsTo[func->name];
+      if (calls.empty() || func->getNumParams() == 0 ||
+          Measurer::measure(func->body) > MAX_CLONE_SIZE) {
+        continue;
+      }
+      std::vector<CloneGroup> funcGroups;
+      for (auto* call : calls) {
+        std::vector<Expression*> values;
+        bool hasConstant = false;
+        for (Index i = 0; i < func->getNumParams(); i++) {
+          Expression* value = nullptr;
+          if (!appliedParams.count(std::make_pair(func->name, i))) {
+            value = getConstantOperand(call->operands[i]);
+          }
+          hasConstant = hasConstant || value;
+          values.push_back(value);
+        }
+        if (!hasConstant) continue;
+        auto iter = std::find_if(funcGroups.begin(), funcGroups.end(), [&](const CloneGroup& group) {
+          for (Index i = 0; i < values.size(); i++) {
+            auto* a = values[i];
+            auto* b = group.values[i];
+            if (!a != !b || (a && !ExpressionAnalyzer::equal(a, b))) return false;
+          }
+          return true;
+        });
+        if (iter == funcGroups.end()) {
+          funcGroups.push_back({ func.get(), values, {} });
+          iter = funcGroups.end() - 1;
+        }
+        iter->calls.push_back(call);
+      }
+      // prefer the groups with the most calls
+      std::stable_sort(funcGroups.begin(), funcGroups.end(), [](const CloneGroup& a, const CloneGroup& b) {
+        return a.calls.size() > b.calls.size();
+      });
+      if (funcGroups.size() > MAX_CLONES_PER_FUNCTION) {
+        funcGroups.resize(MAX_CLONES_PER_FUNCTION);
+      }
+      for (auto& group : funcGroups) {
+        groups.push_back(std::move(group));
+      }
+    }
+    if (groups.empty()) return;
+    // create the clones, and optimize them with the constants applied
+    std::unordered_map<Function*, Index> originalSizes;
+    std::vector<Function*> clones;
+    std::unordered_set<Function*> toOptimize;
+    for (auto& group : groups) {
+      auto* original = group.original;
+      if (!originalSizes.count(original)) {
+        originalSizes[original] = Measurer::measure(original->body);
+      }
+      auto* clone = new Function(*original);
+      // the clone gets its own body below
+      clone->bodyShare.reset();
+      Index counter = 0;
+      do {
+        clone->name = Name(std::string(original->name.str) + "$ipcp" + std::to_string(counter++));
+      } while (module->getFunctionOrNull(clone->name));
+      clone->body = ExpressionManipulator::copy(original->body, *module);
+      clone->debugLocations.clear();
+      module->addFunction(clone);
+      for (Index i = 0; i < group.values.size(); i++) {
+        if (group.values[i]) {
+          applyParam(clone, i, group.values[i]);
+        }
+      }
+      clones.push_back(clone);
+      toOptimize.insert(clone);
+    }
+    optimize(toOptimize, runner);
+    // keep the clones that are worth it, and send the calls to them
+    std::unordered_set<Name> removed;
+    for (Index i = 0; i < groups.size(); i++) {
+      auto* clone = clones[i];
+      auto originalSize = originalSizes[groups[i].original];
+      if (Measurer::measure(clone->body) * 4 <= originalSize * 3) {
+        for (auto* call : groups[i].calls) {
+          call->target = clone->name;
+        }
+      } else {
+        removed.insert(clone->name);
+      }
+    }
+    for (auto name : removed) {
+      module->removeFunction(name);
+    }
+  }
+
+  // Run useful optimizations on functions we modified.
+  void optimize(std::unordered_set<Function*>& funcs, PassRunner* parentRunner) {
+    // save the full list of functions on the side
+    std::vector<std::unique_ptr<Function>> all;
+    all.swap(module->functions);
+    module->updateMaps();
+    for (auto* func : funcs) {
+      module->addFunction(func);
+    }
+    PassRunner runner(module, parentRunner->options);
+    runner.setIsNested(true);
+    runner.setValidateGlobally(false); // not a full valid module
+    runner.add("precompute-propagate");
+    runner.addDefaultFunctionOptimizationPasses();
+    runner.run();
+    // restore all the funcs
+    for (auto& func : module->functions) {
+      func.release();
+    }
+    all.swap(module->functions);
+    module->updateMaps();
+  }
+};
+
+Pass *createInterproceduralConstantPropagationPass() {
+  return new InterproceduralConstantPropagation();
+}
+
+} // namespace wasm
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2018 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Loop Invariant Code Motion: hoists code that computes the same value
+// in every iteration of a loop into a local that is set once, right
+// before the loop (the "preheader"). For example,
+//
+//  (loop $l
+//    (i32.store (get_local $i) (i32.add (get_local $base) (get_local $off)))
+//    ..
+//  )
+//
+// computes $base + $off each time, and if neither is written to in the
+// loop, we can emit
+//
+//  (set_local $temp (i32.add (get_local $base) (get_local $off)))
+//  (loop $l
+//    (i32.store (get_local $i) (get_local $temp))
+//    ..
+//  )
+//
+// We only hoist code that is pure and cannot trap (or when traps are
+// ignored, using ignoreImplicitTraps), as the hoisted code may execute
+// even if the original location would not have been reached. Loads and
+// global reads are hoisted if the loop cannot modify what they read.
+//
+
+#include <wasm.h>
+#include <pass.h>
+#include <wasm-builder.h>
+#include <ir/effects.h>
+#include <ir/find_all.h>
+#include <ir/iteration.h>
+#include <ir/local-graph.h>
+
+namespace wasm {
+
+struct LoopInvariantCodeMotion : public WalkerPass<PostWalker<LoopInvariantCodeMotion>> {
+  bool isFunctionParallel() override { return true; }
+
+  Pass* create() override { return new LoopInvariantCodeMotion; }
+
+  std::unique_ptr<LocalGraph> localGraph;
+
+  // The locals we created for hoisted code, each of which has a single set
+  // (that the local graph is not aware of).
+  std::unordered_map<Index, SetLocal*> hoistedSets;
+
+  void doWalkFunction(Function* func) {
+    if (FindAll<Loop>(func->body).list.empty()) return;
+    localGraph = make_unique<LocalGraph>(func);
+    hoistedSets.clear();
+    walk(func->body);
+    localGraph.reset();
+  }
+
+  void visitLoop(Loop* curr) {
+    // there is no point in optimizing code that never reaches the next iteration
+    if (curr->type == unreachable) return;
+    Hoister hoister(curr, this);
+    if (hoister.preheader.empty()) return;
+    Builder builder(*getModule());
+    auto* block = builder.makeBlock(hoister.preheader);
+    block->list.push_back(curr);
+    block->finalize(curr->type);
+    replaceCurrent(block);
+  }
+
+private:
+  // Scans a single loop, and hoists the maximal invariant expressions in it.
+  struct Hoister : public PostWalker<Hoister, UnifiedExpressionVisitor<Hoister>> {
+    LoopInvariantCodeMotion* parent;
+    EffectAnalyzer loopEffects;
+    std::unordered_set<SetLocal*> loopSets;
+
+    std::unordered_set<Expression*> invariant;
+    std::unordered_map<Expression*, Expression**> locations;
+    // the roots of invariant trees whose parents are not invariant
+    std::vector<Expression**> candidates;
+
+    std::vector<Expression*> preheader;
+
+    Hoister(Loop* loop, LoopInvariantCodeMotion* parent) : parent(parent), loopEffects(parent->getPassOptions(), loop) {
+      for (auto* set : FindAll<SetLocal>(loop).list) {
+        loopSets.insert(set);
+      }
+      walk(loop->body);
+      if (invariant.count(loop->body)) {
+        candidates.push_back(&loop->body);
+      }
+      for (auto** currp : candidates) {
+        if (worthHoisting(*currp)) {
+          hoist(currp);
+        }
+      }
+    }
+
+    void visitExpression(Expression* curr) {
+      locations[curr] = getCurrentPointer();
+      bool childrenInvariant = true;
+      for (auto* child : ChildIterator(curr).children) {
+        if (!invariant.count(child)) {
+          childrenInvariant = false;
+          break;
+        }
+      }
+      if (childrenInvariant && isInvariant(curr)) {
+        invariant.insert(curr);
+        return;
+      }
+      for (auto* child : ChildIterator(curr).children) {
+        if (invariant.count(child)) {
+          candidates.push_back(locations[child]);
+        }
+      }
+    }
+
+    // Checks if the node itself (ignoring its children) computes the same
+    // value in each iteration, and can be executed speculatively.
+    bool isInvariant(Expression* curr) {
+      if (!isConcreteType(curr->type)) return false;
+      switch (curr->_id) {
+        case Expression::Id::ConstId:
+        case Expression::Id::SelectId: {
+          return true;
+        }
+        case Expression::Id::GetLocalId: {
+          return !dependsOnLoop(curr->cast<GetLocal>());
+        }
+        case Expression::Id::GetGlobalId: {
+          auto name = curr->cast<GetGlobal>()->name;
+          auto* global = parent->getModule()->getGlobalOrNull(name);
+          if (global && !global->mutable_) return true;
+          return !loopEffects.calls && !loopEffects.globalsWritten.count(name);
+        }
+        case Expression::Id::LoadId: {
+          auto* load = curr->cast<Load>();
+          if (load->isAtomic || !parent->getPassOptions().ignoreImplicitTraps) return false;
+          return !loopEffects.writesMemory && !loopEffects.calls && !loopEffects.isAtomic;
+        }
+        case Expression::Id::UnaryId:
+        case Expression::Id::BinaryId: {
+          // look at this node alone, the children were already checked
+          EffectAnalyzer effects(parent->getPassOptions());
+          effects.visit(curr);
+          return !effects.implicitTrap;
+        }
+        default: return false;
+      }
+    }
+
+    // Checks if any of the sets that a get may read from are in the loop.
+    bool dependsOnLoop(GetLocal* get) {
+      auto iter = parent->localGraph->getSetses.find(get);
+      if (iter != parent->localGraph->getSetses.end()) {
+        for (auto* set : iter->second) {
+          // nullptr is the initial value of the local, which is not in the loop
+          if (set && loopSets.count(set)) return true;
+        }
+        return false;
+      }
+      // otherwise, this may be a get of a local we hoisted to earlier
+      auto hoisted = parent->hoistedSets.find(get->index);
+      if (hoisted != parent->hoistedSets.end()) {
+        return loopSets.count(hoisted->second) > 0;
+      }
+      // this get is not known to us (e.g. it is in unreachable code)
+      return true;
+    }
+
+    bool worthHoisting(Expression* curr) {
+      if (!isConcreteType(curr->type)) return false;
+      // a get or a const is as cheap as the get we would replace it with
+      if (curr->is<GetLocal>() || curr->is<Const>()) return false;
+      // an immutable global is a constant as well
+      if (auto* get = curr->dynCast<GetGlobal>()) {
+        auto* global = parent->getModule()->getGlobalOrNull(get->name);
+        return !global || global->mutable_;
+      }
+      return true;
+    }
+
+    void hoist(Expression** currp) {
+      auto* curr = *currp;
+      auto* func = parent->getFunction();
+      Builder builder(*parent->getModule());
+      auto index = Builder::addVar(func, curr->type);
+      auto* set = builder.makeSetLocal(index, curr);
+      parent->hoistedSets[index] = set;
+      preheader.push_back(set);
+      *currp = builder.makeGetLocal(index, curr->type);
+    }
+  };
+};
+
+Pass *createLoopInvariantCodeMotionPass() {
+  return new LoopInvariantCodeMotion();
+}
+
+} // namespace wasm
@@ -14,62 +14,202 @@
  * limitations under the License.
  */
 
+//
+// Packs the data segments into as few bytes as possible in the binary.
+//
+// The constant-offset segments are first laid out into the bytes they
+// write, with later segments overwriting earlier ones, which merges
+// segments that are adjacent or overlap. The nonzero runs in those bytes
+// are then grouped into new segments, picking the grouping with the
+// smallest encoded size: a segment costs its offset expression and the
+// LEBs of its header, so a run of zeros is skipped only if that saves
+// more than a new segment costs.
+//
+// Segments with a non-constant offset cannot be moved or split, so only
+// their trailing zeros are removed. As in the binary format, they are
+// placed before the constant-offset ones.
+//
+
+#include <algorithm>
+#include <deque>
+#include <numeric>
+
 #include <wasm.h>
 #include <pass.h>
+#include <wasm-binary.h>
 #include <wasm-builder.h>
 
 namespace wasm {
 
-// Adding segments adds overhead, this is a rough estimate
-const Index OVERHEAD = 8;
+// The largest number of bytes the LEB of a segment's size can have
+static const Index MAX_SIZE_LEB = 5;
 
 struct MemoryPacking : public Pass {
+  // A range of memory that constant-offset segments write to
+  struct Chunk {
+    uint64_t start, end;
+    std::vector<char> data;
+  };
+
+  // A range of nonzero bytes in a chunk
+  struct Run {
+    uint64_t start, end;
+    const char* data;
+  };
+
   void run(PassRunner* runner, Module* module) override {
     if (!module->memory.exists) return;
     std::vector<Memory::Segment> packed;
+    std::vector<Memory::Segment*> constant;
     for (auto& segment : module->memory.segments) {
-      // skip final zeros
-      while (segment.data.size() > 0 && segment.data.back() == 0) {
-        segment.data.pop_back();
-      }
-      // we can only handle a constant offset for splitting
-      if (auto* offset = segment.offset->dynCast<Const>()) {
-        // Find runs of zeros, and split
-        auto& data = segment.data;
-        auto base = offset->value.geti32();
-        Index start = 0;
-        // create new segments
-        while (start < data.size()) {
-          // skip initial zeros
-          while (start < data.size() && data[start] == 0) {
-            start++;
-          }
-          Index end = start; // end of data-containing part
-          Index next = end; // after zeros we can skip. preserves next >= end
-          while (next < data.size() && (next - end < OVERHEAD)) {
-            if (data[end] != 0) {
-              end++;
-              next = end; // we can try to skip zeros from here
-            } else {
-              // end is on a zero, we are looking to skip
-              if (data[next] != 0) {
-                end = next; // we must extend the segment, including some zeros
-              } else {
-                next++;
-              }
-            }
-          }
-          if (end != start) {
-            packed.emplace_back(Builder(*module).makeConst(Literal(int32_t(base + start))), &data[start], end - start);
-          }
-          start = next;
-        }
+      if (segment.offset->is<Const>()) {
+        constant.push_back(&segment);
       } else {
+        // skip final zeros
+        while (segment.data.size() > 0 && segment.data.back() == 0) {
+          segment.data.pop_back();
+        }
         packed.push_back(segment);
       }
     }
+    auto chunks = layOut(constant);
+    auto runs = findRuns(chunks);
+    emitSegments(runs, packed, *module);
     module->memory.segments.swap(packed);
   }
+
+  static uint64_t getStart(Memory::Segment* segment) {
+    return uint32_t(segment->offset->cast<Const>()->value.geti32());
+  }
+
+  std::vector<Chunk> layOut(std::vector<Memory::Segment*>& segments) {
+    std::vector<Index> order(segments.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](Index a, Index b) {
+      return getStart(segments[a]) < getStart(segments[b]);
+    });
+    // group the segments that overlap or are adjacent into chunks
+    std::vector<Chunk> chunks;
+    std::vector<std::vector<Index>> chunkSegments;
+    for (auto i : order) {
+      auto* segment = segments[i];
+      if (segment->data.empty()) continue;
+      auto start = getStart(segment);
+      auto end = start + segment->data.size();
+      if (chunks.empty() || start > chunks.back().end) {
+        chunks.emplace_back();
+        chunks.back().start = start;
+        chunks.back().end = end;
+        chunkSegments.emplace_back();
+      } else {
+        chunks.back().end = std::max(chunks.back().end, end);
+      }
+      chunkSegments.back().push_back(i);
+    }
+    // write the segments in their original order, so later ones win
+    for (Index i = 0; i < chunks.size(); i++) {
+      auto& chunk = chunks[i];
+      auto& indexes = chunkSegments[i];
+      std::sort(indexes.begin(), indexes.end());
+      chunk.data.resize(chunk.end - chunk.start);
+      for (auto index : indexes) {
+        auto* segment = segments[index];
+        std::copy(segment->data.begin(), segment->data.end(), chunk.data.begin() + (getStart(segment) - chunk.start));
+      }
+    }
+    return chunks;
+  }
+
+  std::vector<Run> findRuns(std::vector<Chunk>& chunks) {
+    std::vector<Run> runs;
+    for (auto& chunk : chunks) {
+      auto& data = chunk.data;
+      Index i = 0;
+      while (i < data.size()) {
+        if (data[i] == 0) {
+          i++;
+          continue;
+        }
+        Index start = i;
+        while (i < data.size() && data[i] != 0) {
+          i++;
+        }
+        runs.push_back(Run{ chunk.start + start, chunk.start + i, &data[start] });
+      }
+    }
+    return runs;
+  }
+
+  // Finds the grouping of the runs into segments that takes the fewest
+  // bytes, and emits those segments.
+  //
+  // A segment from run i to run j takes
+  //
+  //   1 (memory index) + 1 (i32.const) + S32LEB(start_i) + 1 (end)
+  //     + U32LEB(end_j - start_i) + end_j - start_i
+  //
+  // bytes. Apart from the size LEB, that is a part that depends only on i
+  // plus a part that depends only on j, so for each possible size of the
+  // size LEB we keep a sliding window of the runs a segment ending at j
+  // can start at, ordered so that the best of them is in front. That makes
+  // finding the best grouping linear in the number of runs.
+  void emitSegments(std::vector<Run>& runs, std::vector<Memory::Segment>& packed, Module& module) {
+    auto num = runs.size();
+    // best[j] is the fewest bytes the first j runs can be emitted in, and
+    // split[j] is the run the last segment in that starts at
+    std::vector<uint64_t> best(num + 1);
+    std::vector<Index> split(num + 1);
+    // the part of the cost of a segment that depends on its first run
+    std::vector<int64_t> startCost(num);
+    std::deque<Index> windows[MAX_SIZE_LEB];
+    best[0] = 0;
+    for (Index j = 0; j < num; j++) {
+      startCost[j] = int64_t(best[j]) + int64_t(S32LEB(int32_t(runs[j].start)).size()) - int64_t(runs[j].start);
+      bool found = false;
+      for (Index k = 0; k < MAX_SIZE_LEB; k++) {
+        // a run that costs more than a later one is never the best start
+        // again, as the later one stays in range for longer. on ties the
+        // earlier run is kept, which means fewer segments
+        auto& window = windows[k];
+        while (!window.empty() && startCost[window.back()] > startCost[j]) {
+          window.pop_back();
+        }
+        window.push_back(j);
+        // runs that are too far back for the size to fit in k + 1 bytes
+        // are never in range again
+        if (k + 1 < MAX_SIZE_LEB) {
+          auto limit = uint64_t(1) << (7 * (k + 1));
+          while (!window.empty() && runs[j].end - runs[window.front()].start >= limit) {
+            window.pop_front();
+          }
+        }
+        if (window.empty()) continue;
+        auto i = window.front();
+        auto cost = uint64_t(startCost[i] + int64_t(runs[j].end)) + 3 + (k + 1);
+        if (!found || cost < best[j + 1]) {
+          best[j + 1] = cost;
+          split[j + 1] = i;
+          found = true;
+        }
+      }
+      assert(found);
+    }
+    // emit the segments, which we find from the last
+    std::vector<Memory::Segment> segments;
+    Builder builder(module);
+    for (Index j = num; j > 0; j = split[j]) {
+      auto& first = runs[split[j]];
+      auto& last = runs[j - 1];
+      segments.emplace_back(builder.makeConst(Literal(int32_t(first.start))));
+      auto& data = segments.back().data;
+      data.resize(last.end - first.start);
+      for (Index i = split[j]; i < j; i++) {
+        auto& run = runs[i];
+        std::copy(run.data, run.data + (run.end - run.start), data.begin() + (run.start - first.start));
+      }
+    }
+    packed.insert(packed.end(), segments.rbegin(), segments.rend());
+  }
 };
 
 Pass *createMemoryPackingPass() {
@@ -77,4 +217,3 @@ Pass *createMemoryPackingPass() {
 }
 
 } // namespace wasm
-
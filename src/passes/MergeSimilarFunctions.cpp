@@ -0,0 +1,413 @@
+/*
+ * Copyright 2018 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Merges functions that are identical except for some constants and call
+// targets, which is common with C++ templates. For example,
+//
+//  (func $a (param $x i32) (result i32)
+//    (i32.add (get_local $x) (i32.const 1))
+//  )
+//  (func $b (param $x i32) (result i32)
+//    (i32.add (get_local $x) (i32.const 2))
+//  )
+//
+// becomes a single shared function that receives the differing values as
+// extra params, plus thin thunks that call it:
+//
+//  (func $a$merged (param $x i32) (param $1 i32) (result i32)
+//    (i32.add (get_local $x) (get_local $1))
+//  )
+//  (func $a (param $x i32) (result i32)
+//    (call $a$merged (get_local $x) (i32.const 1))
+//  )
+//  (func $b (param $x i32) (result i32)
+//    (call $a$merged (get_local $x) (i32.const 2))
+//  )
+//
+// Differing call targets are passed as table indexes, and called using
+// call_indirect, which adds them to the table if they are not already
+// there. We do that only if the table is not imported, so that we can
+// grow it.
+//
+// As this adds a call and extra params, it is only worthwhile for code
+// size, when the functions are large enough.
+//
+
+#include <wasm.h>
+#include <pass.h>
+#include <wasm-builder.h>
+#include <asm_v_wasm.h>
+#include <ir/find_all.h>
+#include <ir/utils.h>
+
+namespace wasm {
+
+// the most extra params we add to the shared function
+static const Index MAX_EXTRA_PARAMS = 4;
+
+typedef std::map<Function*, uint64_t> SimilarHashMap;
+
+static bool isHole(Expression* curr) {
+  return curr->is<Const>() || curr->is<Call>();
+}
+
+// Hashes functions, ignoring the values of constants and call targets.
+struct SimilarFunctionHasher : public WalkerPass<PostWalker<SimilarFunctionHasher>> {
+  bool isFunctionParallel() override { return true; }
+
+  SimilarFunctionHasher(SimilarHashMap* output) : output(output) {}
+
+  SimilarFunctionHasher* create() override {
+    return new SimilarFunctionHasher(output);
+  }
+
+  void doWalkFunction(Function* func) {
+    uint64_t ret = 0;
+    ret = rehash64(ret, func->getNumParams());
+    for (auto type : func->params) {
+      ret = rehash64(ret, type);
+    }
+    ret = rehash64(ret, func->getNumVars());
+    for (auto type : func->vars) {
+      ret = rehash64(ret, type);
+    }
+    ret = rehash64(ret, func->result);
+    ret = rehash64(ret, ExpressionAnalyzer::flexibleHash64(func->body, isHole));
+    output->at(func) = ret;
+  }
+
+private:
+  SimilarHashMap* output;
+};
+
+// A position in a function's body in which similar functions differ.
+struct Hole {
+  // which extra param of the shared function provides the value
+  Index param;
+  // whether this is a call, or else a const
+  bool isCall;
+  // the index of the call or const, in the order FindAll sees them
+  Index index;
+};
+
+struct MergeSimilarFunctions : public Pass {
+  Module* module;
+
+  // The table indexes of functions, for calls we turn into indirect ones.
+  std::unordered_map<Name, Index> tableIndexes;
+  Table::Segment* newSegment = nullptr;
+
+  void run(PassRunner* runner, Module* module_) override {
+    module = module_;
+    SimilarHashMap hashes;
+    for (auto& func : module->functions) {
+      hashes[func.get()] = 0; // ensure an entry for each function - we must not modify the map shape in parallel, just the values
+    }
+    {
+      PassRunner runner(module);
+      runner.setIsNested(true);
+      runner.add<SimilarFunctionHasher>(&hashes);
+      runner.run();
+    }
+    // Find hash-equal groups, in module order
+    std::vector<uint64_t> hashOrder;
+    std::unordered_map<uint64_t, std::vector<Function*>> hashGroups;
+    for (auto& func : module->functions) {
+      auto hash = hashes[func.get()];
+      auto& group = hashGroups[hash];
+      if (group.empty()) hashOrder.push_back(hash);
+      group.push_back(func.get());
+    }
+    // Within each group, find the classes of actually similar functions.
+    std::vector<std::vector<Function*>> classes;
+    for (auto hash : hashOrder) {
+      auto& group = hashGroups[hash];
+      if (group.size() == 1) continue;
+      std::vector<std::vector<Function*>> groupClasses;
+      for (auto* func : group) {
+        bool found = false;
+        for (auto& curr : groupClasses) {
+          if (areSimilar(curr[0], func)) {
+            curr.push_back(func);
+            found = true;
+            break;
+          }
+        }
+        if (!found) {
+          groupClasses.push_back({ func });
+        }
+      }
+      for (auto& curr : groupClasses) {
+        if (curr.size() > 1) {
+          classes.push_back(std::move(curr));
+        }
+      }
+    }
+    if (classes.empty()) return;
+    noteTableIndexes();
+    for (auto& curr : classes) {
+      merge(curr);
+    }
+  }
+
+  // Checks if two functions are identical, except for consts and call
+  // targets (to functions with the same signature).
+  bool areSimilar(Function* left, Function* right) {
+    if (left->params != right->params) return false;
+    if (left->vars != right->vars) return false;
+    if (left->result != right->result) return false;
+    FindAll<Call> leftCalls(left->body);
+    FindAll<Call> rightCalls(right->body);
+    if (leftCalls.list.size() != rightCalls.list.size()) return false;
+    for (Index i = 0; i < leftCalls.list.size(); i++) {
+      auto* leftTarget = module->getFunction(leftCalls.list[i]->target);
+      auto* rightTarget = module->getFunction(rightCalls.list[i]->target);
+      if (leftTarget->params != rightTarget->params ||
+          leftTarget->result != rightTarget->result) {
+        return false;
+      }
+    }
+    // Temporarily make the call targets the same, and compare ignoring const
+    // values. As the calls are visited in the same order on both sides, if
+    // the bodies are equal then the calls we retargeted correspond.
+    std::vector<Name> rightTargets;
+    for (Index i = 0; i < rightCalls.list.size(); i++) {
+      rightTargets.push_back(rightCalls.list[i]->target);
+      rightCalls.list[i]->target = leftCalls.list[i]->target;
+    }
+    auto comparer = [](Expression* left, Expression* right) {
+      return left->is<Const>() && right->is<Const>() && left->type == right->type;
+    };
+    bool ret = ExpressionAnalyzer::flexibleEqual(left->body, right->body, comparer);
+    for (Index i = 0; i < rightCalls.list.size(); i++) {
+      rightCalls.list[i]->target = rightTargets[i];
+    }
+    return ret;
+  }
+
+  void merge(std::vector<Function*>& funcs) {
+    auto* first = funcs[0];
+    // Find the holes, where the functions differ. Holes that have the
+    // same values in all the functions can share a param.
+    std::vector<FindAll<Const>> consts;
+    std::vector<FindAll<Call>> calls;
+    for (auto* func : funcs) {
+      consts.emplace_back(func->body);
+      calls.emplace_back(func->body);
+    }
+    std::vector<Hole> holes;
+    std::vector<Type> extraParams;
+    // for each extra param, the value for each function
+    std::vector<std::vector<Literal>> constValues;
+    std::vector<std::vector<Name>> callValues;
+    auto noteHole = [&](bool isCall, Index index, std::vector<Literal>& values, std::vector<Name>& targets) {
+      for (Index i = 0; i < extraParams.size(); i++) {
+        if (isCall ? callValues[i] == targets : constValues[i] == values) {
+          holes.push_back({ i, isCall, index });
+          return;
+        }
+      }
+      holes.push_back({ Index(extraParams.size()), isCall, index });
+      extraParams.push_back(isCall ? i32 : values[0].type);
+      constValues.push_back(values);
+      callValues.push_back(targets);
+    };
+    for (Index i = 0; i < consts[0].list.size(); i++) {
+      std::vector<Literal> values;
+      bool differs = false;
+      for (auto& curr : consts) {
+        values.push_back(curr.list[i]->value);
+        if (!values.back().bitwiseEqual(values[0])) differs = true;
+      }
+      if (differs) {
+        std::vector<Name> targets;
+        noteHole(false, i, values, targets);
+      }
+    }
+    bool hasCallHoles = false;
+    for (Index i = 0; i < calls[0].list.size(); i++) {
+      std::vector<Name> targets;
+      bool differs = false;
+      for (auto& curr : calls) {
+        targets.push_back(curr.list[i]->target);
+        if (targets.back() != targets[0]) differs = true;
+      }
+      if (differs) {
+        std::vector<Literal> values;
+        noteHole(true, i, values, targets);
+        hasCallHoles = true;
+      }
+    }
+    if (extraParams.empty() || extraParams.size() > MAX_EXTRA_PARAMS) return;
+    if (hasCallHoles && !canAddToTable()) return;
+    // Each thunk is a call with a get for each param, and a const for each
+    // extra param. Check that this saves code size overall.
+    Index size = Measurer::measure(first->body);
+    Index thunkSize = 1 + first->getNumParams() + extraParams.size();
+    if ((funcs.size() - 1) * size <= funcs.size() * thunkSize) return;
+    // Create the shared function from a copy of the first.
+    auto* shared = new Function();
+    Index counter = 0;
+    do {
+      shared->name = Name(std::string(first->name.str) + "$merged" + (counter > 0 ? std::to_string(counter) : ""));
+      counter++;
+    } while (module->getFunctionOrNull(shared->name));
+    Index numParams = first->getNumParams();
+    Index numExtra = extraParams.size();
+    shared->params = first->params;
+    for (auto type : extraParams) {
+      shared->params.push_back(type);
+    }
+    shared->vars = first->vars;
+    shared->result = first->result;
+    for (auto& pair : first->localNames) {
+      auto index = pair.first >= numParams ? pair.first + numExtra : pair.first;
+      shared->localNames[index] = pair.second;
+      shared->localIndices[pair.second] = index;
+    }
+    shared->body = ExpressionManipulator::copy(first->body, *module);
+    fillHoles(shared, numParams, numExtra, holes);
+    shared->type = ensureFunctionType(getSig(shared), module)->name;
+    // Turn the functions into thunks.
+    Builder builder(*module);
+    for (Index i = 0; i < funcs.size(); i++) {
+      auto* func = funcs[i];
+      std::vector<Expression*> args;
+      for (Index j = 0; j < numParams; j++) {
+        args.push_back(builder.makeGetLocal(j, func->getLocalType(j)));
+      }
+      for (Index j = 0; j < numExtra; j++) {
+        if (!callValues[j].empty()) {
+          args.push_back(builder.makeConst(Literal(int32_t(getTableIndex(callValues[j][i])))));
+        } else {
+          args.push_back(builder.makeConst(constValues[j][i]));
+        }
+      }
+      func->body = builder.makeCall(shared->name, args, func->result);
+      func->vars.clear();
+      std::map<Index, Name> localNames;
+      std::map<Name, Index> localIndices;
+      for (auto& pair : func->localNames) {
+        if (pair.first < numParams) {
+          localNames[pair.first] = pair.second;
+          localIndices[pair.second] = pair.first;
+        }
+      }
+      func->localNames.swap(localNames);
+      func->localIndices.swap(localIndices);
+    }
+    module->addFunction(shared);
+  }
+
+  // Makes the shared function's body read the extra params in the holes,
+  // and moves the vars past the extra params.
+  void fillHoles(Function* shared, Index numParams, Index numExtra, std::vector<Hole>& holes) {
+    struct HoleFiller : public PostWalker<HoleFiller> {
+      Module* module;
+      Index numParams, numExtra;
+      std::map<Index, Index> constHoles, callHoles; // index => extra param
+      Index constIndex = 0, callIndex = 0;
+
+      void visitGetLocal(GetLocal* curr) {
+        if (curr->index >= numParams) curr->index += numExtra;
+      }
+      void visitSetLocal(SetLocal* curr) {
+        if (curr->index >= numParams) curr->index += numExtra;
+      }
+      void visitConst(Const* curr) {
+        auto iter = constHoles.find(constIndex++);
+        if (iter == constHoles.end()) return;
+        replaceCurrent(Builder(*module).makeGetLocal(numParams + iter->second, curr->type));
+      }
+      void visitCall(Call* curr) {
+        auto iter = callHoles.find(callIndex++);
+        if (iter == callHoles.end()) return;
+        Builder builder(*module);
+        auto* type = ensureFunctionType(getSig(module->getFunction(curr->target)), module);
+        std::vector<Expression*> args;
+        for (auto* operand : curr->operands) {
+          args.push_back(operand);
+        }
+        auto* call = builder.makeCallIndirect(type, builder.makeGetLocal(numParams + iter->second, i32), args);
+        call->finalize();
+        replaceCurrent(call);
+      }
+    } filler;
+    filler.module = module;
+    filler.numParams = numParams;
+    filler.numExtra = numExtra;
+    for (auto& hole : holes) {
+      (hole.isCall ? filler.callHoles : filler.constHoles)[hole.index] = hole.param;
+    }
+    filler.walk(shared->body);
+  }
+
+  void noteTableIndexes() {
+    for (auto& segment : module->table.segments) {
+      auto* offset = segment.offset->dynCast<Const>();
+      if (!offset) continue;
+      for (Index i = 0; i < segment.data.size(); i++) {
+        auto index = offset->value.geti32() + i;
+        if (!tableIndexes.count(segment.data[i])) {
+          tableIndexes[segment.data[i]] = index;
+        }
+      }
+    }
+  }
+
+  // We can add to the table if we know its size and can grow it.
+  bool canAddToTable() {
+    if (module->table.imported) return false;
+    for (auto& segment : module->table.segments) {
+      if (!segment.offset->is<Const>()) return false;
+    }
+    return true;
+  }
+
+  Index getTableIndex(Name name) {
+    auto iter = tableIndexes.find(name);
+    if (iter != tableIndexes.end()) return iter->second;
+    auto& table = module->table;
+    if (!newSegment) {
+      if (!table.exists) {
+        table.exists = true;
+        table.initial = 0;
+      }
+      Address end = table.initial;
+      for (auto& segment : table.segments) {
+        end = std::max(end, Address(segment.offset->cast<Const>()->value.geti32() + segment.data.size()));
+      }
+      table.segments.emplace_back(Builder(*module).makeConst(Literal(int32_t(end))));
+      newSegment = &table.segments.back();
+      table.initial = end;
+    }
+    Index index = table.initial;
+    newSegment->data.push_back(name);
+    table.initial = table.initial + 1;
+    if (table.hasMax() && table.max < table.initial) {
+      table.max = table.initial;
+    }
+    tableIndexes[name] = index;
+    return index;
+  }
+};
+
+Pass *createMergeSimilarFunctionsPass() {
+  return new MergeSimilarFunctions();
+}
+
+} // namespace wasm
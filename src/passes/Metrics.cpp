@@ -38,6 +38,8 @@ struct Metrics : public WalkerPass<PostWalker<Metrics, UnifiedExpressionVisitor<
 
   Metrics(bool byFunction) : byFunction(byFunction) {}
 
+  bool modifiesBinaryenIR() override { return false; }
+
   void visitExpression(Expression* curr) {
     auto name = getExpressionName(curr);
     counts[name]++;
@@ -110,13 +112,13 @@ struct Metrics : public WalkerPass<PostWalker<Metrics, UnifiedExpressionVisitor<
       size_t baseline;
       {
         Module test;
-        ModuleUtils::copyModule(*module, test);
+        ModuleUtils::cloneModule(*module, test);
         baseline = sizeAfterGlobalCleanup(&test);
       }
       for (auto& exp : module->exports) {
         // create a test module where we remove the export and then see how much can be removed thanks to that
         Module test;
-        ModuleUtils::copyModule(*module, test);
+        ModuleUtils::cloneModule(*module, test);
         test.removeExport(exp->name);
         counts.clear();
         counts["[removable-bytes-without-it]"] = baseline - sizeAfterGlobalCleanup(&test);
@@ -125,7 +127,7 @@ struct Metrics : public WalkerPass<PostWalker<Metrics, UnifiedExpressionVisitor<
       // check how much size depends on the start method
       if (!module->start.isNull()) {
         Module test;
-        ModuleUtils::copyModule(*module, test);
+        ModuleUtils::cloneModule(*module, test);
         test.start = Name();
         counts.clear();
         counts["[removable-bytes-without-it]"] = baseline - sizeAfterGlobalCleanup(&test);
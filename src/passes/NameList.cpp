@@ -25,6 +25,8 @@
 namespace wasm {
 
 struct NameList : public Pass {
+  bool modifiesBinaryenIR() override { return false; }
+
   void run(PassRunner* runner, Module* module) override {
     for (auto& func : module->functions) {
       std::cout << "    " << func->name << " : " << Measurer::measure(func->body) << '\n';
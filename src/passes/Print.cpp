@@ -23,6 +23,7 @@
 #include <pass.h>
 #include <pretty_printing.h>
 #include <ir/module-utils.h>
+#include <support/threads.h>
 
 namespace wasm {
 
@@ -33,6 +34,55 @@ static bool isFullForced() {
   return false;
 }
 
+// A stream buffer that writes into a string, whose contents we can then take
+// without a copy. Text is written directly into the string's storage, which
+// grows geometrically, so each small write is just a copy into memory.
+class StringBuffer : public std::streambuf {
+  std::string data;
+
+public:
+  StringBuffer() {
+    reset();
+  }
+
+  // Returns the text written so far, and empties the buffer.
+  std::string take() {
+    data.resize(pptr() - pbase());
+    std::string ret;
+    ret.swap(data);
+    reset();
+    return ret;
+  }
+
+protected:
+  int_type overflow(int_type c) override {
+    size_t used = pptr() - pbase();
+    data.resize(std::max(data.size() * 2, size_t(4096)));
+    setPutArea(used);
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      data[used] = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+private:
+  void reset() {
+    data.resize(4096);
+    setPutArea(0);
+  }
+
+  void setPutArea(size_t used) {
+    setp(&data[0], &data[0] + data.size());
+    // pbump takes an int
+    while (used > 0) {
+      int step = std::min(used, size_t(std::numeric_limits<int>::max()));
+      pbump(step);
+      used -= step;
+    }
+  }
+};
+
 struct PrintSExpression : public Visitor<PrintSExpression> {
   std::ostream& o;
   unsigned indent = 0;
@@ -863,11 +913,7 @@ struct PrintSExpression : public Visitor<PrintSExpression> {
       printOpening(o, "start") << ' ' << curr->start << ')';
       o << maybeNewLine;
     }
-    for (auto& child : curr->functions) {
-      doIndent(o, indent);
-      visitFunction(child.get());
-      o << maybeNewLine;
-    }
+    printFunctions(curr);
     for (auto& section : curr->userSections) {
       doIndent(o, indent);
       o << ";; custom section \"" << section.name << "\", size " << section.data.size();
@@ -877,6 +923,75 @@ struct PrintSExpression : public Visitor<PrintSExpression> {
     o << maybeNewLine;
     currModule = nullptr;
   }
+
+  // Prints each function into a buffer of its own, in parallel if we can, and
+  // writes the buffers to the output in order. Writing large chunks is also
+  // much faster than writing many small pieces to the output stream.
+  void printFunctions(Module* curr) {
+    struct FunctionPrinter {
+      StringBuffer buffer;
+      std::ostream stream;
+      PrintSExpression print;
+
+      FunctionPrinter(PrintSExpression& parent) : stream(&buffer), print(stream) {
+        print.setMinify(parent.minify);
+        print.setFull(parent.full);
+        print.indent = parent.indent;
+        print.currModule = parent.currModule;
+        print.functionIndexes = parent.functionIndexes;
+      }
+
+      std::string printFunction(Function* func) {
+        doIndent(stream, print.indent);
+        print.visitFunction(func);
+        stream << print.maybeNewLine;
+        return buffer.take();
+      }
+    };
+
+    auto& functions = curr->functions;
+    if (functions.empty()) return;
+    // visitFunction fills this lazily, which it must not do in parallel
+    if (!minify && functionIndexes.empty()) {
+      ModuleUtils::BinaryIndexes indexes(*curr);
+      functionIndexes = std::move(indexes.functionIndexes);
+    }
+    auto* pool = ThreadPool::get();
+    size_t num = pool->size();
+    if (num <= 1 || functions.size() <= 1 || pool->isRunning()) {
+      FunctionPrinter printer(*this);
+      for (auto& func : functions) {
+        auto text = printer.printFunction(func.get());
+        o.write(text.data(), text.size());
+      }
+      return;
+    }
+    std::vector<std::string> texts(functions.size());
+    std::vector<std::unique_ptr<FunctionPrinter>> printers;
+    std::vector<std::function<ThreadWorkState ()>> doWorkers;
+    std::atomic<size_t> nextFunction;
+    nextFunction.store(0);
+    for (size_t i = 0; i < num; i++) {
+      printers.emplace_back(new FunctionPrinter(*this));
+      doWorkers.push_back([&, i]() {
+        auto index = nextFunction.fetch_add(1);
+        // get the next task, if there is one
+        if (index >= functions.size()) {
+          return ThreadWorkState::Finished; // nothing left
+        }
+        texts[index] = printers[i]->printFunction(functions[index].get());
+        if (index + 1 == functions.size()) {
+          return ThreadWorkState::Finished; // we did the last one
+        }
+        return ThreadWorkState::More;
+      });
+    }
+    pool->work(doWorkers);
+    for (auto& text : texts) {
+      o.write(text.data(), text.size());
+      std::string().swap(text);
+    }
+  }
 };
 
 // Prints out a module
@@ -888,6 +1003,8 @@ public:
   Printer() : o(std::cout) {}
   Printer(std::ostream* o) : o(*o) {}
 
+  bool modifiesBinaryenIR() override { return false; }
+
   void run(PassRunner* runner, Module* module) override {
     PrintSExpression print(o);
     print.visitModule(module);
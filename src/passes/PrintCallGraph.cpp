@@ -29,6 +29,8 @@
 namespace wasm {
 
 struct PrintCallGraph : public Pass {
+  bool modifiesBinaryenIR() override { return false; }
+
   void run(PassRunner* runner, Module* module) override {
     std::ostream &o = std::cout;
     o << "digraph call {\n"
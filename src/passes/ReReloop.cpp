@@ -301,6 +301,7 @@ struct ReReloop final : public Pass {
     // first, traverse the function body. note how we don't need to traverse
     // into expressions, as we know they contain no control flow
     builder = make_unique<Builder>(*module);
+    relooper.Module = module;
     auto* entry = startCFGBlock();
     stack.push_back(TaskPtr(new TriageTask(*this, function->body)));
     // main loop
@@ -22,6 +22,7 @@
 #include <pass.h>
 #include <wasm-validator.h>
 #include <wasm-io.h>
+#include <ir/module-utils.h>
 
 namespace wasm {
 
@@ -70,6 +71,9 @@ void PassRegistry::registerPasses() {
   registerPass("code-pushing", "push code forward, potentially making it not always execute", createCodePushingPass);
   registerPass("code-folding", "fold code, merging duplicates", createCodeFoldingPass);
   registerPass("const-hoisting", "hoist repeated constants to a local", createConstHoistingPass);
+  registerPass("cost-report", "reports the estimated cost and size of functions, and how they changed since the last report", createCostReportPass);
+  registerPass("dae", "removes arguments to calls that are never used, and return values that are always dropped", createDeadArgumentEliminationPass);
+  registerPass("dae-optimizing", "removes arguments to calls that are never used, and return values that are always dropped, and optimizes where we removed", createDeadArgumentEliminationOptimizingPass);
   registerPass("dce", "removes unreachable code", createDeadCodeEliminationPass);
   registerPass("duplicate-function-elimination", "removes duplicate functions", createDuplicateFunctionEliminationPass);
   registerPass("extract-function", "leaves just one function (useful for debugging)", createExtractFunctionPass);
@@ -78,7 +82,9 @@ void PassRegistry::registerPasses() {
   registerPass("func-metrics", "reports function metrics", createFunctionMetricsPass);
   registerPass("inlining", "inline functions (you probably want inlining-optimizing)", createInliningPass);
   registerPass("inlining-optimizing", "inline functions and optimizes where we inlined", createInliningOptimizingPass);
+  registerPass("ipcp", "interprocedural constant propagation of parameters and return values", createInterproceduralConstantPropagationPass);
   registerPass("legalize-js-interface", "legalizes i64 types on the import/export boundary", createLegalizeJSInterfacePass);
+  registerPass("licm", "loop invariant code motion", createLoopInvariantCodeMotionPass);
   registerPass("local-cse", "common subexpression elimination inside basic blocks", createLocalCSEPass);
   registerPass("log-execution", "instrument the build with logging of where execution goes", createLogExecutionPass);
   registerPass("i64-to-i32-lowering", "lower all uses of i64s to use i32s instead", createI64ToI32LoweringPass);
@@ -87,6 +93,7 @@ void PassRegistry::registerPasses() {
   registerPass("memory-packing", "packs memory into separate segments, skipping zeros", createMemoryPackingPass);
   registerPass("merge-blocks", "merges blocks to their parents", createMergeBlocksPass);
   registerPass("merge-locals", "merges locals when beneficial", createMergeLocalsPass);
+  registerPass("merge-similar-functions", "merges functions that differ only in constants and call targets", createMergeSimilarFunctionsPass);
   registerPass("metrics", "reports metrics", createMetricsPass);
   registerPass("nm", "name list", createNameListPass);
   registerPass("optimize-instructions", "optimizes instruction combinations", createOptimizeInstructionsPass);
@@ -158,6 +165,9 @@ void PassRunner::addDefaultFunctionOptimizationPasses() {
   }
   add("simplify-locals-nostructure"); // don't create if/block return values yet, as coalesce can remove copies that that could inhibit
   add("vacuum"); // previous pass creates garbage
+  if (options.optimizeLevel >= 3) {
+    add("licm"); // after simplify-locals nested code, so invariant trees are larger
+  }
   add("reorder-locals");
   add("remove-unused-brs"); // simplify-locals opens opportunities for optimizations
   // if we are willing to work hard, also optimize copies before coalescing
@@ -192,6 +202,10 @@ void PassRunner::addDefaultGlobalOptimizationPrePasses() {
 }
 
 void PassRunner::addDefaultGlobalOptimizationPostPasses() {
+  if (options.optimizeLevel >= 3) {
+    add("ipcp");
+    add("dae-optimizing"); // remove the params ipcp applied inside functions
+  }
   // inline when working hard, and when not preserving debug info
   // (inlining+optimizing can remove the annotations)
   if ((options.optimizeLevel >= 2 || options.shrinkLevel >= 2) &&
@@ -199,6 +213,9 @@ void PassRunner::addDefaultGlobalOptimizationPostPasses() {
     add("inlining-optimizing");
   }
   add("duplicate-function-elimination"); // optimizations show more functions as duplicate
+  if (options.shrinkLevel >= 2) {
+    add("merge-similar-functions");
+  }
   add("remove-unused-module-elements");
   add("memory-packing");
 }
@@ -252,7 +269,7 @@ void PassRunner::run() {
           runPassOnFunction(pass, func.get());
         }
       } else {
-        pass->run(this, wasm);
+        runPass(pass);
       }
       auto after = std::chrono::steady_clock::now();
       std::chrono::duration<double> diff = after - before;
@@ -286,7 +303,15 @@ void PassRunner::run() {
     // to run as many passes as possible on a single function before moving to the next
     std::vector<Pass*> stack;
     auto flush = [&]() {
-      if (stack.size() > 0) {
+      if (stack.size() > 0 && ThreadPool::get()->isRunning()) {
+        // we are already on a pool thread, for example because several
+        // modules are being optimized in parallel, so run serially here
+        for (auto& func : wasm->functions) {
+          for (auto* pass : stack) {
+            runPassOnFunction(pass, func.get());
+          }
+        }
+      } else if (stack.size() > 0) {
         // run the stack of passes on all the functions, in parallel
         size_t num = ThreadPool::get()->size();
         std::vector<std::function<ThreadWorkState ()>> doWorkers;
@@ -320,7 +345,7 @@ void PassRunner::run() {
         stack.push_back(pass);
       } else {
         flush();
-        pass->run(this, wasm);
+        runPass(pass);
       }
     }
     flush();
@@ -347,8 +372,36 @@ void PassRunner::doAdd(Pass* pass) {
   pass->prepareToRun(this, wasm);
 }
 
+// Does nothing itself, but as it is function-parallel and may modify the IR,
+// running it gives each function a body of its own, in parallel.
+struct BodyUnsharer : public Pass {
+  bool isFunctionParallel() override { return true; }
+  Pass* create() override { return new BodyUnsharer; }
+  void runOnFunction(PassRunner* runner, Module* module, Function* function) override {}
+};
+
+void PassRunner::runPass(Pass* pass) {
+  assert(!pass->isFunctionParallel());
+  // a whole-module pass may modify any function
+  if (pass->modifiesBinaryenIR()) {
+    for (auto& func : wasm->functions) {
+      if (func->bodyShare) {
+        PassRunner runner(wasm);
+        runner.setIsNested(true);
+        runner.add<BodyUnsharer>();
+        runner.run();
+        break;
+      }
+    }
+  }
+  pass->run(this, wasm);
+}
+
 void PassRunner::runPassOnFunction(Pass* pass, Function* func) {
   assert(pass->isFunctionParallel());
+  if (func->bodyShare && pass->modifiesBinaryenIR()) {
+    ModuleUtils::unshareBody(*wasm, func);
+  }
   // function-parallel passes get a new instance per function
   auto instance = std::unique_ptr<Pass>(pass->create());
   instance->runOnFunction(this, wasm, func);
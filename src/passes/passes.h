@@ -27,6 +27,9 @@ Pass* createCoalesceLocalsWithLearningPass();
 Pass* createCodeFoldingPass();
 Pass* createCodePushingPass();
 Pass* createConstHoistingPass();
+Pass* createCostReportPass();
+Pass* createDeadArgumentEliminationPass();
+Pass* createDeadArgumentEliminationOptimizingPass();
 Pass* createDeadCodeEliminationPass();
 Pass* createDuplicateFunctionEliminationPass();
 Pass* createExtractFunctionPass();
@@ -37,14 +40,17 @@ Pass* createFunctionMetricsPass();
 Pass* createI64ToI32LoweringPass();
 Pass* createInliningPass();
 Pass* createInliningOptimizingPass();
+Pass* createInterproceduralConstantPropagationPass();
 Pass* createLegalizeJSInterfacePass();
 Pass* createLocalCSEPass();
+Pass* createLoopInvariantCodeMotionPass();
 Pass* createLogExecutionPass();
 Pass* createInstrumentLocalsPass();
 Pass* createInstrumentMemoryPass();
 Pass* createMemoryPackingPass();
 Pass* createMergeBlocksPass();
 Pass* createMergeLocalsPass();
+Pass* createMergeSimilarFunctionsPass();
 Pass* createMinifiedPrinterPass();
 Pass* createMetricsPass();
 Pass* createNameListPass();
@@ -42,6 +42,20 @@ inline uint64_t rehash(uint64_t x, uint64_t y) {
   return rehash(ret, uint32_t(y >> 32));
 }
 
+// A stronger combiner with a full 64-bit result. Unlike rehash(), all the
+// bits of the input affect the output, so it is suitable for digests of
+// large amounts of data.
+inline uint64_t rehash64(uint64_t x, uint64_t y) {
+  // mix y (using the splitmix64 finalizer), then fold it into x
+  y ^= y >> 30;
+  y *= 0xbf58476d1ce4e5b9ULL;
+  y ^= y >> 27;
+  y *= 0x94d049bb133111ebULL;
+  y ^= y >> 31;
+  x = (x << 5) | (x >> 59);
+  return (x ^ y) * 0x9e3779b97f4a7c15ULL;
+}
+
 } // namespace wasm
 
 #endif // wasm_support_hash_h
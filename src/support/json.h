@@ -14,8 +14,11 @@
  * limitations under the License.
  */
 
-// An arena-free version of emscripten-optimizer/simple_ast.h's JSON
-// class TODO: use this instead of that
+// A JSON value class for reading tool inputs, such as the metadce graph,
+// which can be tens of MB. Parsing is zero-copy: strings are NUL-terminated
+// in the input and used straight from it, and nested values, arrays and
+// objects are allocated in an arena, so the whole tree is freed at once
+// along with it.
 
 #ifndef wasm_support_json_h
 #define wasm_support_json_h
@@ -38,6 +41,7 @@
 #include <vector>
 
 #include "emscripten-optimizer/istring.h"
+#include "mixed_arena.h"
 #include "support/safe_integer.h"
 
 namespace json {
@@ -46,15 +50,22 @@ typedef cashew::IString IString;
 
 // Main value type
 struct Value {
-  struct Ref : public std::shared_ptr<Value> {
-    Ref() : std::shared_ptr<Value>() {}
-    Ref(Value* value) : std::shared_ptr<Value>(value) {}
+  struct Ref {
+    Value* inst;
+
+    Ref() : inst(nullptr) {}
+    Ref(Value* value) : inst(value) {}
+
+    Value* get() const { return inst; }
+    Value* operator->() const { return inst; }
+    Value& operator*() const { return *inst; }
+    explicit operator bool() const { return inst != nullptr; }
 
     Ref& operator[](size_t x) {
-      return (*this->get())[x];
+      return (*inst)[x];
     }
     Ref& operator[](IString x) {
-      return (*this->get())[x];
+      return (*inst)[x];
     }
   };
 
@@ -69,49 +80,38 @@ struct Value {
 
   Type type;
 
-  typedef std::vector<Ref> ArrayStorage;
-  typedef std::unordered_map<IString, Ref> ObjectStorage;
+  typedef ArenaVector<Ref> ArrayStorage;
+  // objects in tool inputs have few keys, so a flat list is faster to build
+  // and to search than a hash map. later keys override earlier ones.
+  typedef ArenaVector<std::pair<IString, Ref>> ObjectStorage;
 
 #ifdef _MSC_VER // MSVC does not allow unrestricted unions: http://www.open-std.org/jtc1/sc22/wg21/docs/papers/2008/n2544.pdf
   IString str;
 #endif
-  union { // TODO: optimize
+  union {
 #ifndef _MSC_VER
     IString str;
 #endif
     double num;
-    ArrayStorage *arr; // manually allocated/freed
+    ArrayStorage *arr; // allocated in an arena
     bool boo;
-    ObjectStorage *obj; // manually allocated/freed
-    Ref ref;
+    ObjectStorage *obj; // allocated in an arena
   };
 
   // constructors all copy their input
   Value() : type(Null), num(0) {}
+  // for MixedArena::alloc
+  explicit Value(MixedArena& allocator) : Value() {}
   explicit Value(const char *s) : type(Null) {
     setString(s);
   }
   explicit Value(double n) : type(Null) {
     setNumber(n);
   }
-  explicit Value(ArrayStorage &a) : type(Null) {
-    setArray();
-    *arr = a;
-  }
   // no bool constructor - would endanger the double one (int might convert the wrong way)
 
-  ~Value() {
-    free();
-  }
-
+  // arrays and objects live in an arena, so there is nothing to free here
   void free() {
-    if (type == Array) {
-      delete arr;
-      arr = nullptr;
-    } else if (type == Object) {
-      delete obj;
-      obj = nullptr;
-    }
     type = Null;
     num = 0;
   }
@@ -134,17 +134,10 @@ struct Value {
     num = n;
     return *this;
   }
-  Value& setArray(ArrayStorage &a) {
-    free();
-    type = Array;
-    arr = new ArrayStorage;
-    *arr = a;
-    return *this;
-  }
-  Value& setArray(size_t size_hint=0) {
+  Value& setArray(MixedArena& allocator, size_t size_hint=0) {
     free();
     type = Array;
-    arr = new ArrayStorage;
+    arr = allocator.alloc<ArrayStorage>();
     arr->reserve(size_hint);
     return *this;
   }
@@ -159,10 +152,11 @@ struct Value {
     boo = b;
     return *this;
   }
-  Value& setObject() {
+  Value& setObject(MixedArena& allocator, size_t size_hint=0) {
     free();
     type = Object;
-    obj = new ObjectStorage();
+    obj = allocator.alloc<ObjectStorage>();
+    obj->reserve(size_hint);
     return *this;
   }
 
@@ -203,26 +197,31 @@ struct Value {
     return ret;
   }
 
+  // arrays and objects are shared, not copied, as they live in an arena
   Value& operator=(const Value& other) {
     free();
+    type = other.type;
     switch (other.type) {
       case String:
-        setString(other.str);
+        str = other.str;
         break;
       case Number:
-        setNumber(other.num);
+        num = other.num;
         break;
       case Array:
-        setArray(*other.arr);
+        arr = other.arr;
         break;
       case Null:
-        setNull();
+        num = 0;
         break;
       case Bool:
-        setBool(other.boo);
+        boo = other.boo;
+        break;
+      case Object:
+        obj = other.obj;
         break;
       default:
-        abort(); // TODO
+        abort();
     }
     return *this;
   }
@@ -235,20 +234,101 @@ struct Value {
       case Number:
         return num == other.num;
       case Array:
-        return this == &other; // if you want a deep compare, use deepCompare
+        return arr == other.arr; // if you want a deep compare, use deepCompare
       case Null:
         break;
       case Bool:
         return boo == other.boo;
       case Object:
-        return this == &other; // if you want a deep compare, use deepCompare
+        return obj == other.obj; // if you want a deep compare, use deepCompare
       default:
         abort();
     }
     return true;
   }
 
-  char* parse(char* curr) {
+  // Parses the JSON text at curr into this value, returning a pointer just
+  // after it. The input is modified in place and strings point into it, so
+  // it must outlive the parsed values, which are allocated in the arena.
+  char* parse(char* curr, MixedArena& allocator) {
+    ParseStack stack;
+    return parse(curr, allocator, stack);
+  }
+
+  // String operations
+
+  // Number operations
+
+  // Array operations
+
+  size_t size() {
+    assert(isArray());
+    return arr->size();
+  }
+
+  void setSize(size_t size, MixedArena& allocator) {
+    assert(isArray());
+    auto old = arr->size();
+    if (old != size) arr->resize(size);
+    if (old < size) {
+      for (auto i = old; i < size; i++) {
+        (*arr)[i] = Ref(allocator.alloc<Value>());
+      }
+    }
+  }
+
+  Ref& operator[](unsigned x) {
+    assert(isArray());
+    return (*arr)[x];
+  }
+
+  Value& push_back(Ref r) {
+    assert(isArray());
+    arr->push_back(r);
+    return *this;
+  }
+  Ref pop_back() {
+    assert(isArray());
+    return arr->pop_back();
+  }
+
+  Ref back() {
+    assert(isArray());
+    if (arr->size() == 0) return nullptr;
+    return arr->back();
+  }
+
+  // Null operations
+
+  // Bool operations
+
+  // Object operations
+
+  Ref& operator[](IString x) {
+    assert(isObject());
+    if (auto* found = find(x)) {
+      return *found;
+    }
+    obj->push_back(std::make_pair(x, Ref()));
+    return obj->back().second;
+  }
+
+  bool has(IString x) {
+    assert(isObject());
+    return find(x) != nullptr;
+  }
+
+private:
+  // Children are gathered here while their parent is parsed, so that each
+  // array and object is allocated in the arena once, at its final size.
+  // The stacks are shared by the whole parse, each nesting level using the
+  // items after its parent's.
+  struct ParseStack {
+    std::vector<Ref> items;
+    std::vector<std::pair<IString, Ref>> fields;
+  };
+
+  char* parse(char* curr, MixedArena& allocator, ParseStack& stack) {
     #define is_json_space(x) (x == 32 || x == 9 || x == 10 || x == 13) /* space, tab, linefeed/newline, or return */
     #define skip() { while (*curr && is_json_space(*curr)) curr++; }
     skip();
@@ -264,11 +344,11 @@ struct Value {
       // Array
       curr++;
       skip();
-      setArray();
+      auto start = stack.items.size();
       while (*curr != ']') {
-        Ref temp = Ref(new Value());
-        arr->push_back(temp);
-        curr = temp->parse(curr);
+        Ref temp = Ref(allocator.alloc<Value>());
+        curr = temp->parse(curr, allocator, stack);
+        stack.items.push_back(temp);
         skip();
         if (*curr == ']') break;
         assert(*curr == ',');
@@ -276,6 +356,11 @@ struct Value {
         skip();
       }
       curr++;
+      setArray(allocator, stack.items.size() - start);
+      for (auto i = start; i < stack.items.size(); i++) {
+        arr->push_back(stack.items[i]);
+      }
+      stack.items.resize(start);
     } else if (*curr == 'n') {
       // Null
       assert(strncmp(curr, "null", 4) == 0);
@@ -295,7 +380,7 @@ struct Value {
       // Object
       curr++;
       skip();
-      setObject();
+      auto start = stack.fields.size();
       while (*curr != '}') {
         assert(*curr == '"');
         curr++;
@@ -308,9 +393,9 @@ struct Value {
         assert(*curr == ':');
         curr++;
         skip();
-        Ref value = Ref(new Value());
-        curr = value->parse(curr);
-        (*obj)[key] = value;
+        Ref value = Ref(allocator.alloc<Value>());
+        curr = value->parse(curr, allocator, stack);
+        stack.fields.push_back(std::make_pair(key, value));
         skip();
         if (*curr == '}') break;
         assert(*curr == ',');
@@ -318,6 +403,11 @@ struct Value {
         skip();
       }
       curr++;
+      setObject(allocator, stack.fields.size() - start);
+      for (auto i = start; i < stack.fields.size(); i++) {
+        obj->push_back(stack.fields[i]);
+      }
+      stack.fields.resize(start);
     } else {
       // Number
       char *after;
@@ -325,69 +415,16 @@ struct Value {
       curr = after;
     }
     return curr;
+    #undef skip
+    #undef is_json_space
   }
 
-  void stringify(std::ostream &os, bool pretty=false);
-
-  // String operations
-
-  // Number operations
-
-  // Array operations
-
-  size_t size() {
-    assert(isArray());
-    return arr->size();
-  }
-
-  void setSize(size_t size) {
-    assert(isArray());
-    auto old = arr->size();
-    if (old != size) arr->resize(size);
-    if (old < size) {
-      for (auto i = old; i < size; i++) {
-        (*arr)[i] = Ref(new Value());
-      }
+  Ref* find(IString x) {
+    for (size_t i = obj->size(); i > 0; i--) {
+      auto& pair = (*obj)[i - 1];
+      if (pair.first == x) return &pair.second;
     }
-  }
-
-  Ref& operator[](unsigned x) {
-    assert(isArray());
-    return (*arr)[x];
-  }
-
-  Value& push_back(Ref r) {
-    assert(isArray());
-    arr->push_back(r);
-    return *this;
-  }
-  Ref pop_back() {
-    assert(isArray());
-    Ref ret = arr->back();
-    arr->pop_back();
-    return ret;
-  }
-
-  Ref back() {
-    assert(isArray());
-    if (arr->size() == 0) return nullptr;
-    return arr->back();
-  }
-
-  // Null operations
-
-  // Bool operations
-
-  // Object operations
-
-  Ref& operator[](IString x) {
-    assert(isObject());
-    return (*obj)[x];
-  }
-
-  bool has(IString x) {
-    assert(isObject());
-    return obj->count(x) > 0;
+    return nullptr;
   }
 };
 
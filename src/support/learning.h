@@ -18,7 +18,9 @@
 #define wasm_learning_h
 
 #include <algorithm>
+#include <memory>
 #include <random>
+#include <vector>
 
 namespace wasm {
 
@@ -76,7 +78,7 @@ public:
   }
 
   unique_ptr acquireBest() {
-    return population[0];
+    return std::move(population[0]);
   }
 
   void runGeneration() {
@@ -154,8 +154,12 @@ int main(int argc, const char *argv[]) {
   char *start = pre.process(input.data());
 
   if (options.debug) std::cerr << "parsing..." << std::endl;
-  cashew::Parser<Ref, DotZeroValueBuilder> builder;
-  Ref asmjs = builder.parseToplevel(start);
+  // the AST is freed once we have converted it
+  auto astArena = make_unique<cashew::ScopedArena>();
+  // function bodies are parsed later, in parallel
+  Asm2WasmBuilder::AsmParser builder;
+  std::vector<Asm2WasmBuilder::AsmParser::LazyFunction> lazyFunctions;
+  Ref asmjs = builder.parseToplevelLazily(start, lazyFunctions);
 
   if (options.debug) std::cerr << "wasming..." << std::endl;
   Module wasm;
@@ -182,7 +186,8 @@ int main(int argc, const char *argv[]) {
 
   // compile the code
   Asm2WasmBuilder asm2wasm(wasm, pre, options.debug, trapMode, options.passOptions, legalizeJavaScriptFFI, options.runningDefaultOptimizationPasses(), wasmOnly);
-  asm2wasm.processAsm(asmjs);
+  asm2wasm.processAsm(asmjs, &lazyFunctions);
+  astArena.reset();
 
   // finalize the imported mem init
   if (memInit != options.extra.end()) {
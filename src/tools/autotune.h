@@ -0,0 +1,292 @@
+/*
+ * Copyright 2018 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Searches for a pass pipeline that does well on a particular module,
+// starting from the default optimization pipeline and learning from there
+// using a genetic algorithm.
+//
+// A pipeline is a list of passes together with the optimize and shrink
+// levels to run them at. Each candidate is measured by running it on a
+// clone of the module and then measuring the binary size, or the estimated
+// execution cost, of the result. The candidates of a generation are
+// measured in parallel.
+//
+
+#include <atomic>
+#include <map>
+#include <random>
+#include <set>
+
+#include "pass.h"
+#include "wasm-binary.h"
+#include "ir/cost.h"
+#include "ir/module-utils.h"
+#include "support/learning.h"
+#include "support/threads.h"
+
+namespace wasm {
+
+class Autotuner {
+public:
+  enum Goal {
+    Size, // smallest binary, then lowest cost
+    Cost  // lowest estimated execution cost, then smallest binary
+  };
+
+  // what we try to minimize, in order of importance
+  typedef std::pair<int64_t, int64_t> Fitness;
+
+  struct Pipeline {
+    std::vector<std::string> passes;
+    int optimizeLevel;
+    int shrinkLevel;
+
+    Pipeline(Autotuner& parent) : parent(parent) {}
+
+    Fitness getFitness() {
+      if (!measured) {
+        parent.measurePending();
+        assert(measured);
+      }
+      return fitness;
+    }
+
+    // A description of the pipeline as wasm-opt arguments.
+    std::string toString() const {
+      std::string ret = "--optimize-level " + std::to_string(optimizeLevel) +
+                        " --shrink-level " + std::to_string(shrinkLevel);
+      for (auto& pass : passes) {
+        ret += " --" + pass;
+      }
+      return ret;
+    }
+
+  private:
+    friend class Autotuner;
+
+    Autotuner& parent;
+    bool measured = false;
+    Fitness fitness;
+  };
+
+  Autotuner(Module& wasm, PassOptions options, Goal goal) : wasm(wasm), options(options), goal(goal), noise(1337) {
+    if (this->options.optimizeLevel == 0 && this->options.shrinkLevel == 0) {
+      this->options.setDefaultOptimizationOptions();
+    }
+    this->options.debug = false;
+    // the pipeline we start from is the one -O would run
+    PassRunner runner(&wasm, this->options);
+    runner.addDefaultOptimizationPasses();
+    for (auto* pass : runner.passes) {
+      baseline.push_back(pass->name);
+    }
+    // passes are picked from all the default pipelines
+    for (auto levels : { std::make_pair(2, 1), std::make_pair(3, 0), std::make_pair(2, 2), std::make_pair(4, 0) }) {
+      PassOptions levelOptions = this->options;
+      levelOptions.optimizeLevel = levels.first;
+      levelOptions.shrinkLevel = levels.second;
+      PassRunner runner(&wasm, levelOptions);
+      runner.addDefaultOptimizationPasses();
+      for (auto* pass : runner.passes) {
+        if (std::find(candidates.begin(), candidates.end(), pass->name) == candidates.end()) {
+          candidates.push_back(pass->name);
+        }
+      }
+    }
+  }
+
+  // Searches for up to the given number of generations, returning the best
+  // pipeline found. The default pipeline is always a candidate, so the
+  // result is never worse than it.
+  std::unique_ptr<Pipeline> run(size_t generations, size_t populationSize = 12) {
+    GeneticLearner<Pipeline, Fitness, Autotuner> learner(*this, populationSize);
+    auto best = learner.getBest()->getFitness();
+    size_t stale = 0;
+    for (size_t i = 0; i < generations; i++) {
+      learner.runGeneration();
+      auto currBest = learner.getBest()->getFitness();
+      if (currBest == best) {
+        // give up if we have not improved for a while
+        if (++stale == 2) break;
+      } else {
+        best = currBest;
+        stale = 0;
+      }
+    }
+    return learner.acquireBest();
+  }
+
+  // Generator interface for GeneticLearner
+
+  Pipeline* makeRandom() {
+    auto* ret = new Pipeline(*this);
+    ret->passes = baseline;
+    ret->optimizeLevel = options.optimizeLevel;
+    ret->shrinkLevel = options.shrinkLevel;
+    if (sawBaseline) {
+      // mutate the baseline a little, and pick new levels
+      ret->optimizeLevel = 1 + noise() % 3;
+      ret->shrinkLevel = noise() % 3;
+      mutate(ret->passes, 1 + noise() % 4);
+    }
+    sawBaseline = true;
+    pending.push_back(ret);
+    return ret;
+  }
+
+  Pipeline* makeMixture(Pipeline* left, Pipeline* right) {
+    // one-point crossover, cutting both at the same relative position
+    auto* ret = new Pipeline(*this);
+    double cut = double(noise() % 1000) / 1000;
+    size_t leftCut = size_t(cut * left->passes.size());
+    size_t rightCut = size_t(cut * right->passes.size());
+    ret->passes.insert(ret->passes.end(), left->passes.begin(), left->passes.begin() + leftCut);
+    ret->passes.insert(ret->passes.end(), right->passes.begin() + rightCut, right->passes.end());
+    ret->optimizeLevel = (noise() & 1 ? left : right)->optimizeLevel;
+    ret->shrinkLevel = (noise() & 1 ? left : right)->shrinkLevel;
+    if (noise() % 4 == 0) {
+      mutate(ret->passes, 1);
+    }
+    pending.push_back(ret);
+    return ret;
+  }
+
+private:
+  Module& wasm;
+  PassOptions options;
+  Goal goal;
+  std::mt19937 noise;
+
+  std::vector<std::string> baseline, candidates;
+  bool sawBaseline = false;
+
+  // pipelines created but not yet measured. the learner sorts each
+  // generation right after creating it, so the first fitness query
+  // measures them all together, and none are freed before that.
+  std::vector<Pipeline*> pending;
+
+  // pipelines that are created more than once are measured only once
+  std::map<std::string, Fitness> measuredFitness;
+
+  void mutate(std::vector<std::string>& passes, size_t times) {
+    for (size_t i = 0; i < times; i++) {
+      auto size = passes.size();
+      auto index = size ? noise() % size : 0;
+      switch (noise() % 4) {
+        case 0: {
+          passes.insert(passes.begin() + index, candidates[noise() % candidates.size()]);
+          break;
+        }
+        case 1: {
+          if (size > 0) passes.erase(passes.begin() + index);
+          break;
+        }
+        case 2: {
+          if (size > 1) std::swap(passes[index], passes[noise() % size]);
+          break;
+        }
+        case 3: {
+          if (size > 0) passes[index] = candidates[noise() % candidates.size()];
+          break;
+        }
+      }
+    }
+  }
+
+  void measurePending() {
+    // find the distinct pipelines we have not seen before
+    std::vector<Pipeline*> todo;
+    std::vector<Fitness> results;
+    std::set<std::string> seen;
+    for (auto* pipeline : pending) {
+      auto key = pipeline->toString();
+      if (!measuredFitness.count(key) && seen.insert(key).second) {
+        todo.push_back(pipeline);
+      }
+    }
+    results.resize(todo.size());
+    // clone here, as the first clone of a module modifies it
+    std::vector<std::unique_ptr<Module>> clones;
+    for (size_t i = 0; i < todo.size(); i++) {
+      clones.emplace_back(make_unique<Module>());
+      ModuleUtils::cloneModule(wasm, *clones.back());
+    }
+    auto measure = [&](size_t index) {
+      auto* pipeline = todo[index];
+      auto& clone = *clones[index];
+      PassOptions pipelineOptions = options;
+      pipelineOptions.optimizeLevel = pipeline->optimizeLevel;
+      pipelineOptions.shrinkLevel = pipeline->shrinkLevel;
+      PassRunner runner(&clone, pipelineOptions);
+      for (auto& pass : pipeline->passes) {
+        runner.add(pass);
+      }
+      runner.run();
+      int64_t size = getSize(clone), cost = getCost(clone);
+      results[index] = goal == Size ? Fitness(-size, -cost) : Fitness(-cost, -size);
+      clones[index].reset();
+    };
+    auto* pool = ThreadPool::get();
+    size_t num = pool->size();
+    if (num <= 1 || todo.size() <= 1 || pool->isRunning()) {
+      for (size_t i = 0; i < todo.size(); i++) {
+        measure(i);
+      }
+    } else {
+      // each candidate runs its passes serially, on its own pool thread
+      std::atomic<size_t> next;
+      next.store(0);
+      std::vector<std::function<ThreadWorkState ()>> doWorkers;
+      for (size_t i = 0; i < num; i++) {
+        doWorkers.push_back([&]() {
+          auto index = next.fetch_add(1);
+          if (index >= todo.size()) {
+            return ThreadWorkState::Finished;
+          }
+          measure(index);
+          return index + 1 == todo.size() ? ThreadWorkState::Finished : ThreadWorkState::More;
+        });
+      }
+      pool->work(doWorkers);
+    }
+    for (size_t i = 0; i < todo.size(); i++) {
+      measuredFitness[todo[i]->toString()] = results[i];
+    }
+    for (auto* pipeline : pending) {
+      pipeline->fitness = measuredFitness[pipeline->toString()];
+      pipeline->measured = true;
+    }
+    pending.clear();
+  }
+
+  static int64_t getSize(Module& wasm) {
+    BufferWithRandomAccess buffer;
+    WasmBinaryWriter writer(&wasm, buffer);
+    writer.write();
+    return buffer.size();
+  }
+
+  static int64_t getCost(Module& wasm) {
+    int64_t ret = 0;
+    for (auto& func : wasm.functions) {
+      ret += CostAnalyzer(func->body).cost;
+    }
+    return ret;
+  }
+};
+
+} // namespace wasm
@@ -82,10 +82,9 @@ int main(int argc, const char *argv[]) {
 
   try {
     if (options.debug) std::cerr << "s-parsing..." << std::endl;
-    SExpressionParser parser(const_cast<char*>(input.c_str()));
-    Element& root = *parser.root;
+    SExpressionModuleParser parser(const_cast<char*>(input.c_str()));
     if (options.debug) std::cerr << "w-parsing..." << std::endl;
-    SExpressionWasmBuilder builder(wasm, *root[0]);
+    SExpressionWasmBuilder builder(wasm, parser);
   } catch (ParseException& p) {
     p.dump(std::cerr);
     Fatal() << "error in parsing input";
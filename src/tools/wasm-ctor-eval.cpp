@@ -22,8 +22,12 @@
 // startup later.
 //
 
+#include <cmath>
+#include <functional>
+#include <map>
 #include <memory>
 
+#include "asm_v_wasm.h"
 #include "pass.h"
 #include "support/command-line.h"
 #include "support/file.h"
@@ -31,7 +35,7 @@
 #include "wasm-io.h"
 #include "wasm-interpreter.h"
 #include "wasm-builder.h"
-#include "ir/memory-utils.h"
+#include "asmjs/shared-constants.h"
 #include "ir/global-utils.h"
 #include "ir/import-utils.h"
 #include "ir/literal-utils.h"
@@ -154,16 +158,223 @@ public:
     auto total = STACK_START + STACK_SIZE;
     memorySize = total / Memory::kPageSize;
   }
+};
+
+// The memory that ctors run on, which begins as the data segments laid out
+// in order. Writes are tracked by page, so that a ctor that fails can be
+// undone by restoring just the pages it wrote, and so that at the end only
+// the bytes that changed need to be written back into the module.
+class EvallingMemory {
+  static const Index PAGE_SIZE = 4096;
+
+  std::vector<char> data;
+
+  enum PageState : uint8_t {
+    Clean,
+    Committed, // written to by ctors that succeeded
+    Written    // written to by the current ctor
+  };
+  std::vector<PageState> pageStates;
+
+  // the contents of pages before any ctor wrote to them, and before the
+  // current ctor did
+  std::map<Index, std::vector<char>> originalPages;
+  std::map<Index, std::pair<PageState, std::vector<char>>> snapshotPages;
+  size_t sizeBeforeCurrent = 0;
+
+  std::vector<char> copyPage(Index page) {
+    auto start = std::min(size_t(page) * PAGE_SIZE, data.size());
+    auto end = std::min(start + PAGE_SIZE, data.size());
+    return std::vector<char>(data.begin() + start, data.begin() + end);
+  }
+
+  void notePageWritten(Index page) {
+    if (page >= pageStates.size()) {
+      pageStates.resize(page + 1, Clean);
+    }
+    auto state = pageStates[page];
+    if (state == Written) return;
+    if (state == Clean) {
+      originalPages[page] = copyPage(page);
+    }
+    snapshotPages[page] = std::make_pair(state, copyPage(page));
+    pageStates[page] = Written;
+  }
+
+public:
+  // returns false if the segments cannot be laid out, which is the case
+  // if their offsets are not constant
+  bool init(Memory& memory) {
+    for (auto& segment : memory.segments) {
+      if (!segment.offset->is<Const>()) return false;
+    }
+    for (auto& segment : memory.segments) {
+      size_t start = segment.offset->cast<Const>()->value.getInteger();
+      auto end = start + segment.data.size();
+      if (end > data.size()) {
+        data.resize(end);
+      }
+      std::copy(segment.data.begin(), segment.data.end(), data.begin() + start);
+    }
+    sizeBeforeCurrent = data.size();
+    return true;
+  }
+
+  char* get(Address address, size_t size, bool write) {
+    auto end = size_t(address) + size;
+    if (end > data.size()) {
+      data.resize(end);
+    }
+    if (write) {
+      notePageWritten(address / PAGE_SIZE);
+      notePageWritten((end - 1) / PAGE_SIZE);
+    }
+    return &data[address];
+  }
 
-  // flatten memory into a single segment
-  void flattenMemory() {
-    MemoryUtils::flatten(wasm.memory);
+  // the current ctor succeeded, keep its writes
+  void commit() {
+    for (auto& pair : snapshotPages) {
+      pageStates[pair.first] = Committed;
+    }
+    snapshotPages.clear();
+    sizeBeforeCurrent = data.size();
+  }
+
+  // the current ctor failed, undo its writes
+  void rollback() {
+    for (auto& pair : snapshotPages) {
+      auto page = pair.first;
+      auto& contents = pair.second.second;
+      std::copy(contents.begin(), contents.end(), data.begin() + size_t(page) * PAGE_SIZE);
+      pageStates[page] = pair.second.first;
+      if (pageStates[page] == Clean) {
+        originalPages.erase(page);
+      }
+    }
+    snapshotPages.clear();
+    data.resize(sizeBeforeCurrent);
+  }
+
+  // Writes the bytes that ctors changed into the module. Where the module
+  // has segments, they are updated in place, and new segments are added for
+  // the rest, so that the segments that ctors did not touch are left as
+  // they were.
+  void applyTo(Module& wasm) {
+    assert(snapshotPages.empty());
+    // find the changed ranges, joining ones that are close together, as
+    // each segment has some overhead
+    const size_t MAX_GAP = 8;
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (auto& pair : originalPages) {
+      auto start = size_t(pair.first) * PAGE_SIZE;
+      auto& original = pair.second;
+      auto end = std::min(start + PAGE_SIZE, data.size());
+      for (auto i = start; i < end; i++) {
+        auto before = i - start < original.size() ? original[i - start] : 0;
+        if (data[i] == before) continue;
+        if (!ranges.empty() && i - ranges.back().second <= MAX_GAP) {
+          ranges.back().second = i + 1;
+        } else {
+          ranges.emplace_back(i, i + 1);
+        }
+      }
+    }
+    if (ranges.empty()) return;
+    // update existing segments in place
+    std::vector<std::pair<size_t, size_t>> covered;
+    for (auto& segment : wasm.memory.segments) {
+      size_t start = segment.offset->cast<Const>()->value.getInteger();
+      auto end = start + segment.data.size();
+      for (auto& range : ranges) {
+        auto from = std::max(start, range.first);
+        auto to = std::min(end, range.second);
+        if (from < to) {
+          std::copy(data.begin() + from, data.begin() + to, segment.data.begin() + (from - start));
+        }
+      }
+      covered.emplace_back(start, end);
+    }
+    // add what is not covered by existing segments. a piece that is close
+    // to a segment extends it, and otherwise becomes a new segment
+    std::sort(covered.begin(), covered.end());
+    std::vector<std::pair<size_t, size_t>> pieces;
+    for (auto& range : ranges) {
+      auto curr = range.first;
+      for (auto& segment : covered) {
+        if (curr >= range.second) break;
+        if (segment.second <= curr) continue;
+        if (segment.first >= range.second) break;
+        if (segment.first > curr) {
+          pieces.emplace_back(curr, segment.first);
+        }
+        curr = std::max(curr, segment.second);
+      }
+      if (curr < range.second) {
+        pieces.emplace_back(curr, range.second);
+      }
+    }
+    auto& segments = wasm.memory.segments;
+    auto numOriginal = segments.size();
+    Builder builder(wasm);
+    for (auto& piece : pieces) {
+      // find the closest segment, before or after the piece
+      size_t best = numOriginal, bestGap = MAX_GAP + 1;
+      for (size_t i = 0; i < numOriginal; i++) {
+        auto& segment = segments[i];
+        size_t start = segment.offset->cast<Const>()->value.getInteger();
+        auto end = start + segment.data.size();
+        size_t gap = bestGap;
+        if (end <= piece.first) {
+          gap = piece.first - end;
+        } else if (start >= piece.second) {
+          gap = start - piece.second;
+        }
+        if (gap < bestGap) {
+          best = i;
+          bestGap = gap;
+        }
+      }
+      bool extended = best < numOriginal;
+      if (extended) {
+        auto& segment = segments[best];
+        auto* offset = segment.offset->cast<Const>();
+        size_t start = offset->value.getInteger();
+        auto end = start + segment.data.size();
+        if (end <= piece.first) {
+          segment.data.insert(segment.data.end(), data.begin() + end, data.begin() + piece.second);
+        } else {
+          segment.data.insert(segment.data.begin(), data.begin() + piece.first, data.begin() + start);
+          offset->value = Literal(int32_t(piece.first));
+        }
+      }
+      if (!extended) {
+        segments.emplace_back(
+          builder.makeConst(Literal(int32_t(piece.first))),
+          &data[piece.first],
+          piece.second - piece.first
+        );
+      }
+    }
   }
 };
 
+struct CtorEvalExternalInterface;
+
+// An import that is safe to call at compile time, as it is pure and
+// exactly specified, or only accesses memory, which we emulate.
+struct SafeImport {
+  // the signature the import must have, like "iii" (see getSig)
+  std::string sig;
+  std::function<Literal (CtorEvalExternalInterface&, LiteralList&)> run;
+};
+
+static const SafeImport* getSafeImport(Name module, Name base);
+
 struct CtorEvalExternalInterface : EvallingModuleInstance::ExternalInterface {
   Module* wasm;
   EvallingModuleInstance* instance;
+  EvallingMemory memory;
 
   void init(Module& wasm_, EvallingModuleInstance& instance_) override {
     wasm = &wasm_;
@@ -200,6 +411,12 @@ struct CtorEvalExternalInterface : EvallingModuleInstance::ExternalInterface {
   }
 
   Literal callImport(Import *import, LiteralList& arguments) override {
+    if (auto* safe = getSafeImport(import->module, import->base)) {
+      auto* type = wasm->getFunctionTypeOrNull(import->functionType);
+      if (type && getSig(type) == safe->sig) {
+        return safe->run(*this, arguments);
+      }
+    }
     std::string extra;
     if (import->module == "env" && import->base == "___cxa_atexit") {
       extra = "\nrecommendation: build with -s NO_EXIT_RUNTIME=1 so that calls to atexit are not emitted";
@@ -258,11 +475,38 @@ struct CtorEvalExternalInterface : EvallingModuleInstance::ExternalInterface {
     throw FailToEvalException(std::string("trap: ") + why);
   }
 
+  // memory operations for safe imports, which have memmove semantics
+
+  void copyMemory(Address dest, Address source, Address size) {
+    checkRange(dest, size);
+    checkRange(source, size);
+    std::vector<uint8_t> temp(size);
+    for (size_t i = 0; i < size; i++) {
+      temp[i] = doLoad<uint8_t>(source + i);
+    }
+    for (size_t i = 0; i < size; i++) {
+      doStore<uint8_t>(dest + i, temp[i]);
+    }
+  }
+
+  void fillMemory(Address dest, uint8_t value, Address size) {
+    checkRange(dest, size);
+    for (size_t i = 0; i < size; i++) {
+      doStore<uint8_t>(dest + i, value);
+    }
+  }
+
 private:
   // TODO: handle unaligned too, see shell-interface
 
+  void checkRange(Address address, Address size) {
+    if (uint64_t(address) + size > uint64_t(wasm->memory.initial) * Memory::kPageSize) {
+      throw FailToEvalException("safe import accessed memory out of bounds");
+    }
+  }
+
   template <typename T>
-  T* getMemory(Address address) {
+  T* getMemory(Address address, bool write) {
     // if memory is on the stack, use the stack
     if (address >= STACK_START) {
       Address relative = address - STACK_START;
@@ -273,50 +517,116 @@ private:
       return (T*)(&instance->stack[relative]);
     }
 
-    // otherwise, this must be in the singleton segment. resize as needed
-    if (wasm->memory.segments.size() == 0) {
-      std::vector<char> temp;
-      Builder builder(*wasm);
-      wasm->memory.segments.push_back(
-        Memory::Segment(
-          builder.makeConst(Literal(int32_t(0))),
-          temp
-        )
-      );
-    }
-    assert(wasm->memory.segments[0].offset->cast<Const>()->value.getInteger() == 0);
-    auto max = address + sizeof(T);
-    auto& data = wasm->memory.segments[0].data;
-    if (max > data.size()) {
-      data.resize(max);
-    }
-    return (T*)(&data[address]);
+    // otherwise, this is in the memory the segments are laid out in
+    return (T*)memory.get(address, sizeof(T), write);
   }
 
   template <typename T>
   void doStore(Address address, T value) {
     // do a memcpy to avoid undefined behavior if unaligned
-    memcpy(getMemory<T>(address), &value, sizeof(T));
+    memcpy(getMemory<T>(address, true), &value, sizeof(T));
   }
 
   template <typename T>
   T doLoad(Address address) {
     // do a memcpy to avoid undefined behavior if unaligned
     T ret;
-    memcpy(&ret, getMemory<T>(address), sizeof(T));
+    memcpy(&ret, getMemory<T>(address, false), sizeof(T));
     return ret;
   }
 };
 
+typedef std::map<std::pair<Name, Name>, SafeImport> SafeImports;
+
+static SafeImports& getSafeImports() {
+  static SafeImports imports;
+  return imports;
+}
+
+// Registers an import that ctors may call. Imports from env are also
+// registered with the leading underscore that asm.js symbols have.
+static void addSafeImport(Name module, Name base, std::string sig, std::function<Literal (CtorEvalExternalInterface&, LiteralList&)> run) {
+  getSafeImports()[std::make_pair(module, base)] = SafeImport{ sig, run };
+  if (module == ENV) {
+    getSafeImports()[std::make_pair(module, Name(std::string("_") + base.str))] = SafeImport{ sig, run };
+  }
+}
+
+static void addDefaultSafeImports() {
+  // memory copies and fills, which return the destination
+  auto copy = [](CtorEvalExternalInterface& interface, LiteralList& arguments) {
+    interface.copyMemory(arguments[0].geti32(), arguments[1].geti32(), arguments[2].geti32());
+    return arguments[0];
+  };
+  addSafeImport(ENV, "emscripten_memcpy_big", "iiii", copy);
+  addSafeImport(ENV, "memcpy", "iiii", copy);
+  addSafeImport(ENV, "memmove", "iiii", copy);
+  addSafeImport(ENV, "memset", "iiii", [](CtorEvalExternalInterface& interface, LiteralList& arguments) {
+    interface.fillMemory(arguments[0].geti32(), arguments[1].geti32(), arguments[2].geti32());
+    return arguments[0];
+  });
+  // asm2wasm support functions, which have JS semantics
+  addSafeImport(ASM2WASM, F64_REM, "ddd", [](CtorEvalExternalInterface& interface, LiteralList& arguments) {
+    return Literal(std::fmod(arguments[0].getf64(), arguments[1].getf64()));
+  });
+  addSafeImport(ASM2WASM, F64_TO_INT, "id", [](CtorEvalExternalInterface& interface, LiteralList& arguments) {
+    // ToInt32: truncate and wrap modulo 2^32, with NaN and the infinities
+    // becoming 0
+    double value = arguments[0].getf64();
+    if (!std::isfinite(value)) return Literal(int32_t(0));
+    double wrapped = std::fmod(std::trunc(value), 4294967296.0);
+    if (wrapped < 0) wrapped += 4294967296.0;
+    return Literal(int32_t(uint32_t(wrapped)));
+  });
+  // the Math functions whose results JS specifies exactly. pow, exp, sin
+  // etc. are left out, as VMs approximate them differently, and we must
+  // compute what would have been computed at runtime
+  typedef Literal (Literal::*Unary)() const;
+  typedef Literal (Literal::*Binary)(const Literal&) const;
+  auto addUnary = [](Name base, std::string sig, Unary op) {
+    addSafeImport(GLOBAL_MATH, base, sig, [op](CtorEvalExternalInterface& interface, LiteralList& arguments) {
+      return (arguments[0].*op)();
+    });
+  };
+  auto addBinary = [](Name base, std::string sig, Binary op) {
+    addSafeImport(GLOBAL_MATH, base, sig, [op](CtorEvalExternalInterface& interface, LiteralList& arguments) {
+      return (arguments[0].*op)(arguments[1]);
+    });
+  };
+  addUnary(ABS, "dd", &Literal::abs);
+  addUnary(FLOOR, "dd", &Literal::floor);
+  addUnary(CEIL, "dd", &Literal::ceil);
+  addUnary(SQRT, "dd", &Literal::sqrt);
+  addUnary(CLZ32, "ii", &Literal::countLeadingZeroes);
+  addBinary(MIN, "ddd", &Literal::min);
+  addBinary(MAX, "ddd", &Literal::max);
+  addBinary(IMUL, "iii", &Literal::mul);
+}
+
+static const SafeImport* getSafeImport(Name module, Name base) {
+  auto& imports = getSafeImports();
+  if (imports.empty()) {
+    addDefaultSafeImports();
+  }
+  auto iter = imports.find(std::make_pair(module, base));
+  if (iter == imports.end()) return nullptr;
+  return &iter->second;
+}
+
 void evalCtors(Module& wasm, std::vector<std::string> ctors) {
   CtorEvalExternalInterface interface;
+  // lay out the memory, so we do not depend on the layout of data segments
+  if (!interface.memory.init(wasm.memory)) {
+    std::cerr << "  ...stopping since memory segments have non-constant offsets\n";
+    return;
+  }
   try {
     // create an instance for evalling
     EvallingModuleInstance instance(wasm, &interface);
-    // flatten memory, so we do not depend on the layout of data segments
-    instance.flattenMemory();
     // set up the stack area and other environment details
     instance.setupEnvironment();
+    // keep what the start function wrote, if there is one
+    interface.memory.commit();
     // we should not add new globals from here on; as a result, using
     // an imported global will fail, as it is missing and so looks new
     instance.globals.seal();
@@ -324,10 +634,9 @@ void evalCtors(Module& wasm, std::vector<std::string> ctors) {
     // TODO: if we knew priorities, we could reorder?
     for (auto& ctor : ctors) {
       std::cerr << "trying to eval " << ctor << '\n';
-      // snapshot memory, as either the entire function is done, or none
-      auto memoryBefore = wasm.memory;
       // snapshot globals (note that STACKTOP might be modified, but should
-      // be returned, so that works out)
+      // be returned, so that works out). memory is snapshotted as pages are
+      // written, as either the entire function is done, or none
       auto globalsBefore = instance.globals;
       try {
         instance.callExport(ctor);
@@ -335,15 +644,16 @@ void evalCtors(Module& wasm, std::vector<std::string> ctors) {
         // that's it, we failed, so stop here, cleaning up partial
         // memory changes first
         std::cerr << "  ...stopping since could not eval: " << fail.why << "\n";
-        wasm.memory = memoryBefore;
-        return;
+        interface.memory.rollback();
+        break;
       }
       if (instance.globals != globalsBefore) {
         std::cerr << "  ...stopping since globals modified\n";
-        wasm.memory = memoryBefore;
-        return;
+        interface.memory.rollback();
+        break;
       }
       std::cerr << "  ...success on " << ctor << ".\n";
+      interface.memory.commit();
       // success, the entire function was evalled!
       auto* exp = wasm.getExport(ctor);
       auto* func = wasm.getFunction(exp->value);
@@ -354,6 +664,8 @@ void evalCtors(Module& wasm, std::vector<std::string> ctors) {
     std::cerr << "  ...stopping since could not create module instance: " << fail.why << "\n";
     return;
   }
+  // write the changes of the ctors that succeeded into the module
+  interface.memory.applyTo(wasm);
 }
 
 //
@@ -421,7 +733,7 @@ int main(int argc, const char* argv[]) {
   // Do some useful optimizations after the evalling
   {
     PassRunner passRunner(&wasm);
-    passRunner.add("memory-packing"); // we flattened it, so re-optimize
+    passRunner.add("memory-packing"); // re-optimize, including the changed ranges
     passRunner.add("remove-unused-names");
     passRunner.add("dce");
     passRunner.add("merge-blocks");
@@ -141,6 +141,9 @@ int main(int argc, const char *argv[]) {
   generator.generateMemoryGrowthFunction();
   generator.generateDynCallThunks();
   generator.generateJSCallThunks(numReservedFunctionPointers);
+  // generating the metadata modifies the module (it renames the EM_ASM
+  // imports), so it must happen before we write the module, and we keep it
+  // until then as a (small) string
   std::string metadata = generator.generateEmscriptenMetadata(dataSize, initializerFunctions, numReservedFunctionPointers);
 
   if (options.debug) {
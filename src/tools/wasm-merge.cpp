@@ -21,7 +21,10 @@
 // This is *not* a real linker. It just does naive merging.
 //
 
+#include <atomic>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "parsing.h"
 #include "pass.h"
@@ -30,6 +33,7 @@
 #include "asm_v_wasm.h"
 #include "support/command-line.h"
 #include "support/file.h"
+#include "support/threads.h"
 #include "wasm-io.h"
 #include "wasm-binary.h"
 #include "wasm-builder.h"
@@ -48,6 +52,109 @@ static void findImportsByBase(Module& wasm, Name base, std::function<void (Name)
   }
 }
 
+// Runs work(i) for each i in [0, size), in parallel on the thread pool
+// if it has more than one thread.
+static void doInParallel(size_t size, std::function<void (size_t)> work) {
+  auto* pool = ThreadPool::get();
+  size_t num = pool->size();
+  if (num <= 1 || size <= 1 || pool->isRunning()) {
+    for (size_t i = 0; i < size; i++) {
+      work(i);
+    }
+    return;
+  }
+  std::atomic<size_t> next;
+  next.store(0);
+  std::vector<std::function<ThreadWorkState ()>> doWorkers;
+  for (size_t i = 0; i < num; i++) {
+    doWorkers.push_back([&]() {
+      auto index = next.fetch_add(1);
+      if (index >= size) {
+        return ThreadWorkState::Finished;
+      }
+      work(index);
+      return index + 1 == size ? ThreadWorkState::Finished : ThreadWorkState::More;
+    });
+  }
+  pool->work(doWorkers);
+}
+
+// old name => new name. lookups use getMapped, which does not modify the
+// map, so that they can be done in parallel
+typedef std::unordered_map<Name, Name> NameMapping;
+
+static Name getMapped(const NameMapping& mapping, Name name) {
+  auto iter = mapping.find(name);
+  if (iter == mapping.end()) return Name();
+  return iter->second;
+}
+
+// Collects the names of the imports and globals that an expression uses,
+// that is, the targets of call_imports and the names of get_globals.
+static void noteUse(std::vector<Name>* uses, Name name) {
+  if (uses) uses->push_back(name);
+}
+
+// Which functions in the output use each import, so that when a merged
+// input implements some imports, only the functions using them are updated,
+// and not the entire output, which grows with every merge. This is built
+// the first time it is needed, and then kept up to date as functions are
+// merged in.
+struct ImportUses {
+  bool built = false;
+  std::unordered_map<Name, std::vector<Function*>> functions;
+
+  // note the uses of a function that is in the output, which may include
+  // names that are not imports, and duplicates
+  void note(Module& wasm, Function* func, std::vector<Name>& uses) {
+    std::sort(uses.begin(), uses.end(), [](Name a, Name b) { return a.str < b.str; });
+    uses.erase(std::unique(uses.begin(), uses.end()), uses.end());
+    for (auto name : uses) {
+      if (wasm.getImportOrNull(name)) {
+        functions[name].push_back(func);
+      }
+    }
+  }
+
+  void build(Module& wasm);
+};
+
+struct ImportUseScanner : public PostWalker<ImportUseScanner, Visitor<ImportUseScanner>> {
+  std::vector<Name>* uses;
+
+  ImportUseScanner(std::vector<Name>* uses) : uses(uses) {}
+
+  void visitCallImport(CallImport* curr) {
+    noteUse(uses, curr->target);
+  }
+  void visitGetGlobal(GetGlobal* curr) {
+    noteUse(uses, curr->name);
+  }
+};
+
+void ImportUses::build(Module& wasm) {
+  std::vector<std::vector<Name>> uses(wasm.functions.size());
+  doInParallel(wasm.functions.size(), [&](size_t i) {
+    ImportUseScanner scanner(&uses[i]);
+    scanner.walkFunctionInModule(wasm.functions[i].get(), &wasm);
+  });
+  for (size_t i = 0; i < wasm.functions.size(); i++) {
+    note(wasm, wasm.functions[i].get(), uses[i]);
+  }
+  built = true;
+}
+
+// What we keep about the output across merges, so that the work for each
+// merge depends on the input, and not on the output, which grows with every
+// merge.
+struct OutputIndex {
+  ImportUses importUses;
+
+  // the suffix to start from when looking for a new name for something
+  // (see getNonColliding), by its original name
+  std::unordered_map<Name, Index> functionTypeSuffixes, functionSuffixes, globalSuffixes;
+};
+
 // Ensure a memory or table is of at least a size
 template<typename T>
 static void ensureSize(T& what, Index size) {
@@ -81,8 +188,8 @@ struct Mergeable {
 
   // Imported functions and globals provided by the other mergeable
   // are fused together. We track those here, then remove them
-  std::map<Name, Name> implementedFunctionImports;
-  std::map<Name, Name> implementedGlobalImports;
+  NameMapping implementedFunctionImports;
+  NameMapping implementedGlobalImports;
 
   // setups
 
@@ -167,14 +274,18 @@ struct Mergeable {
 
   // utilities
 
-  Name getNonColliding(Name initial, std::function<bool (Name)> checkIfCollides) {
+  // if nextSuffix is provided, the search starts from there, and it is
+  // updated for next time. that is only valid for names that are never
+  // removed, so that a suffix that collided once always does.
+  Name getNonColliding(Name initial, std::function<bool (Name)> checkIfCollides, Index* nextSuffix = nullptr) {
     if (!checkIfCollides(initial)) {
       return initial;
     }
-    int x = 0;
+    Index x = nextSuffix ? *nextSuffix : 0;
     while (1) {
       auto curr = Name(std::string(initial.str) + '$' + std::to_string(x));
       if (!checkIfCollides(curr)) {
+        if (nextSuffix) *nextSuffix = x;
         return curr;
       }
       x++;
@@ -242,7 +353,14 @@ struct Mergeable {
 // logic to update it for the new data, namely, when an import is provided
 // by the other merged unit, we resolve to access that value directly.
 struct OutputMergeable : public PostWalker<OutputMergeable, Visitor<OutputMergeable>>, public Mergeable {
-  OutputMergeable(Module& wasm) : Mergeable(wasm) {}
+  OutputMergeable(Module& wasm, OutputIndex& index) : Mergeable(wasm), index(index), importUses(index.importUses) {}
+
+  OutputIndex& index;
+  ImportUses& importUses;
+
+  // get_globals that now use a global from the input, which may be an
+  // import once the input is merged in
+  std::vector<std::pair<Function*, Name>> newUses;
 
   void visitCallImport(CallImport* curr) {
     auto iter = implementedFunctionImports.find(curr->target);
@@ -258,7 +376,57 @@ struct OutputMergeable : public PostWalker<OutputMergeable, Visitor<OutputMergea
       // this global is now in the module - get it
       curr->name = iter->second;
       assert(curr->name.is());
+      if (getFunction()) {
+        newUses.emplace_back(getFunction(), curr->name);
+      }
+    }
+  }
+
+  // update the output for the implemented imports. only the functions that
+  // use them are walked, along with the global initializers and segment
+  // offsets
+  void update() {
+    if (!importUses.built) {
+      importUses.build(wasm);
+    }
+    std::vector<Function*> functions;
+    std::unordered_set<Function*> seen;
+    auto noteFunctions = [&](const NameMapping& implemented) {
+      for (auto& pair : implemented) {
+        auto iter = importUses.functions.find(pair.first);
+        if (iter == importUses.functions.end()) continue;
+        for (auto* func : iter->second) {
+          if (seen.insert(func).second) {
+            functions.push_back(func);
+          }
+        }
+        // the import is removed, and its name may be reused later
+        importUses.functions.erase(iter);
+      }
+    };
+    noteFunctions(implementedFunctionImports);
+    noteFunctions(implementedGlobalImports);
+    for (auto* func : functions) {
+      walkFunctionInModule(func, &wasm);
+    }
+    setModule(&wasm);
+    for (auto& curr : wasm.globals) {
+      walkGlobal(curr.get());
     }
+    walkTable(&wasm.table);
+    walkMemory(&wasm.memory);
+    visitModule(&wasm);
+    setModule(nullptr);
+  }
+
+  // after the input is merged in, note the new uses of imports from it
+  void noteNewUses() {
+    for (auto& pair : newUses) {
+      if (wasm.getImportOrNull(pair.second)) {
+        importUses.functions[pair.second].push_back(pair.first);
+      }
+    }
+    newUses.clear();
   }
 
   void visitModule(Module* curr) {
@@ -272,80 +440,36 @@ struct OutputMergeable : public PostWalker<OutputMergeable, Visitor<OutputMergea
   }
 };
 
+struct InputRelocator;
+
 // A mergeable that is an input, that is, that we merge into another.
 // This adds logic to disambiguate its names from the other, and to
 // perform all other merging operations.
-struct InputMergeable : public ExpressionStackWalker<InputMergeable, Visitor<InputMergeable>>, public Mergeable {
+struct InputMergeable : public Mergeable {
   InputMergeable(Module& wasm, OutputMergeable& outputMergeable) : Mergeable(wasm), outputMergeable(outputMergeable) {}
 
   // The unit we are being merged into
   OutputMergeable& outputMergeable;
 
   // mappings (after disambiguating with the other mergeable), old name => new name
-  std::map<Name, Name> ftNames; // function types
-  std::map<Name, Name> eNames; // exports
-  std::map<Name, Name> fNames; // functions
-  std::map<Name, Name> gNames; // globals
-
-  void visitCall(Call* curr) {
-    curr->target = fNames[curr->target];
-    assert(curr->target.is());
-  }
-
-  void visitCallImport(CallImport* curr) {
-    auto iter = implementedFunctionImports.find(curr->target);
-    if (iter != implementedFunctionImports.end()) {
-      // this import is now in the module - call it
-      replaceCurrent(Builder(*getModule()).makeCall(iter->second, curr->operands, curr->type));
-      return;
-    }
-    curr->target = fNames[curr->target];
-    assert(curr->target.is());
-  }
-
-  void visitCallIndirect(CallIndirect* curr) {
-    curr->fullType = ftNames[curr->fullType];
-    assert(curr->fullType.is());
-  }
-
-  void visitGetGlobal(GetGlobal* curr) {
-    auto iter = implementedGlobalImports.find(curr->name);
-    if (iter != implementedGlobalImports.end()) {
-      // this import is now in the module - use it
-      curr->name = iter->second;
-      return;
-    }
-    curr->name = gNames[curr->name];
-    assert(curr->name.is());
-    // if this is the memory or table base, add the bump
-    if (memoryBaseGlobals.count(curr->name)) {
-      addBump(outputMergeable.totalMemorySize);
-    } else if (tableBaseGlobals.count(curr->name)) {
-      addBump(outputMergeable.totalTableSize);
-    }
-  }
-
-  void visitSetGlobal(SetGlobal* curr) {
-    curr->name = gNames[curr->name];
-    assert(curr->name.is());
-  }
+  NameMapping ftNames; // function types
+  NameMapping eNames; // exports
+  NameMapping fNames; // functions
+  NameMapping gNames; // globals
 
   void merge() {
     // find function imports in us that are implemented in the output
-    // TODO make maps, avoid N^2
     for (auto& imp : wasm.imports) {
       // per wasm dynamic library rules, we expect to see exports on 'env'
       if ((imp->kind == ExternalKind::Function || imp->kind == ExternalKind::Global) && imp->module == ENV) {
         // seek an export on the other side that matches
-        for (auto& exp : outputMergeable.wasm.exports) {
-          if (exp->kind == imp->kind && exp->name == imp->base) {
-            // fits!
-            if (imp->kind == ExternalKind::Function) {
-              implementedFunctionImports[imp->name] = exp->value;
-            } else {
-              implementedGlobalImports[imp->name] = exp->value;
-            }
-            break;
+        auto* exp = outputMergeable.wasm.getExportOrNull(imp->base);
+        if (exp && exp->kind == imp->kind) {
+          // fits!
+          if (imp->kind == ExternalKind::Function) {
+            implementedFunctionImports[imp->name] = exp->value;
+          } else {
+            implementedGlobalImports[imp->name] = exp->value;
           }
         }
       }
@@ -362,7 +486,7 @@ struct InputMergeable : public ExpressionStackWalker<InputMergeable, Visitor<Inp
     for (auto& curr : wasm.functionTypes) {
       curr->name = ftNames[curr->name] = getNonColliding(curr->name, [&](Name name) -> bool {
         return outputMergeable.wasm.getFunctionTypeOrNull(name);
-      });
+      }, &outputMergeable.index.functionTypeSuffixes[curr->name]);
     }
     for (auto& curr : wasm.imports) {
       if (curr->kind == ExternalKind::Function) {
@@ -378,12 +502,12 @@ struct InputMergeable : public ExpressionStackWalker<InputMergeable, Visitor<Inp
     for (auto& curr : wasm.functions) {
       curr->name = fNames[curr->name] = getNonColliding(curr->name, [&](Name name) -> bool {
         return outputMergeable.wasm.getFunctionOrNull(name);
-      });
+      }, &outputMergeable.index.functionSuffixes[curr->name]);
     }
     for (auto& curr : wasm.globals) {
       curr->name = gNames[curr->name] = getNonColliding(curr->name, [&](Name name) -> bool {
         return outputMergeable.wasm.getGlobalOrNull(name);
-      });
+      }, &outputMergeable.index.globalSuffixes[curr->name]);
     }
 
     // update global names in input
@@ -405,14 +529,12 @@ struct InputMergeable : public ExpressionStackWalker<InputMergeable, Visitor<Inp
     // find function imports in output that are implemented in the input
     for (auto& imp : outputMergeable.wasm.imports) {
       if ((imp->kind == ExternalKind::Function || imp->kind == ExternalKind::Global) && imp->module == ENV) {
-        for (auto& exp : wasm.exports) {
-          if (exp->kind == imp->kind && exp->name == imp->base) {
-            if (imp->kind == ExternalKind::Function) {
-              outputMergeable.implementedFunctionImports[imp->name] = fNames[exp->value];
-            } else {
-              outputMergeable.implementedGlobalImports[imp->name] = gNames[exp->value];
-            }
-            break;
+        auto* exp = wasm.getExportOrNull(imp->base);
+        if (exp && exp->kind == imp->kind) {
+          if (imp->kind == ExternalKind::Function) {
+            outputMergeable.implementedFunctionImports[imp->name] = fNames[exp->value];
+          } else {
+            outputMergeable.implementedGlobalImports[imp->name] = gNames[exp->value];
           }
         }
       }
@@ -421,15 +543,18 @@ struct InputMergeable : public ExpressionStackWalker<InputMergeable, Visitor<Inp
     // update the output before bringing anything in. avoid doing so when possible, as in the
     // common case the output module is very large.
     if (outputMergeable.implementedFunctionImports.size() + outputMergeable.implementedGlobalImports.size() > 0) {
-      outputMergeable.walkModule(&outputMergeable.wasm);
+      outputMergeable.update();
     }
 
     // memory&table: we place the new memory segments at a higher position. after the existing ones.
     copySegments(outputMergeable.wasm.memory, wasm.memory, [](char x) -> char { return x; });
     copySegments(outputMergeable.wasm.table, wasm.table, [&](Name x) -> Name { return fNames[x]; });
 
-    // update the new contents about to be merged in
-    walkModule(&wasm);
+    // update the new contents about to be merged in. functions are
+    // independent of each other, so they are updated in parallel, noting
+    // which imports each uses as we go
+    std::vector<std::vector<Name>> functionUses(wasm.functions.size());
+    relocate(functionUses);
 
     // handle the dylink post-instantiate. this is special, as if it exists in both, we must in fact call both
     Name POST_INSTANTIATE("__post_instantiate");
@@ -485,6 +610,90 @@ struct InputMergeable : public ExpressionStackWalker<InputMergeable, Visitor<Inp
     for (auto& curr : wasm.globals) {
       outputMergeable.wasm.addGlobal(curr.release());
     }
+
+    // the imports are now in the output, so we can note which functions use
+    // them. the functions' expressions remain in our arena, so the caller
+    // must keep our module alive, which avoids copying them.
+    auto& importUses = outputMergeable.importUses;
+    if (importUses.built) {
+      auto& output = outputMergeable.wasm;
+      auto first = output.functions.size() - functionUses.size();
+      for (size_t i = 0; i < functionUses.size(); i++) {
+        importUses.note(output, output.functions[first + i].get(), functionUses[i]);
+      }
+      outputMergeable.noteNewUses();
+    }
+  }
+
+private:
+  friend struct InputRelocator;
+
+  void relocate(std::vector<std::vector<Name>>& functionUses);
+};
+
+// Updates an input's code for merging: renames what it refers to, and
+// relocates the memory and table bases
+struct InputRelocator : public ExpressionStackWalker<InputRelocator, Visitor<InputRelocator>> {
+  InputRelocator(InputMergeable& input, std::vector<Name>* uses) : input(input), uses(uses) {}
+
+  InputMergeable& input;
+
+  // if provided, we note the names of imports and globals used here
+  std::vector<Name>* uses;
+
+  void visitCall(Call* curr) {
+    curr->target = getMapped(input.fNames, curr->target);
+    assert(curr->target.is());
+  }
+
+  void visitCallImport(CallImport* curr) {
+    auto iter = input.implementedFunctionImports.find(curr->target);
+    if (iter != input.implementedFunctionImports.end()) {
+      // this import is now in the module - call it
+      replaceCurrent(Builder(*getModule()).makeCall(iter->second, curr->operands, curr->type));
+      return;
+    }
+    curr->target = getMapped(input.fNames, curr->target);
+    assert(curr->target.is());
+    noteUse(uses, curr->target);
+  }
+
+  void visitCallIndirect(CallIndirect* curr) {
+    curr->fullType = getMapped(input.ftNames, curr->fullType);
+    assert(curr->fullType.is());
+  }
+
+  void visitGetGlobal(GetGlobal* curr) {
+    auto iter = input.implementedGlobalImports.find(curr->name);
+    if (iter != input.implementedGlobalImports.end()) {
+      // this import is now in the module - use it
+      curr->name = iter->second;
+      noteUse(uses, curr->name);
+      return;
+    }
+    curr->name = getMapped(input.gNames, curr->name);
+    assert(curr->name.is());
+    noteUse(uses, curr->name);
+    // if this is the memory or table base, add the bump
+    if (input.memoryBaseGlobals.count(curr->name)) {
+      addBump(input.outputMergeable.totalMemorySize);
+    } else if (input.tableBaseGlobals.count(curr->name)) {
+      addBump(input.outputMergeable.totalTableSize);
+    }
+  }
+
+  void visitSetGlobal(SetGlobal* curr) {
+    curr->name = getMapped(input.gNames, curr->name);
+    assert(curr->name.is());
+  }
+
+  // functions are relocated separately, in parallel
+  void doWalkModule(Module* module) {
+    for (auto& curr : module->globals) {
+      walkGlobal(curr.get());
+    }
+    walkTable(&module->table);
+    walkMemory(&module->memory);
   }
 
 private:
@@ -513,6 +722,15 @@ private:
   }
 };
 
+void InputMergeable::relocate(std::vector<std::vector<Name>>& functionUses) {
+  doInParallel(wasm.functions.size(), [&](size_t i) {
+    InputRelocator relocator(*this, &functionUses[i]);
+    relocator.walkFunctionInModule(wasm.functions[i].get(), &wasm);
+  });
+  InputRelocator relocator(*this, nullptr);
+  relocator.walkModule(&wasm);
+}
+
 // Finalize the memory/table bases, assinging concrete values into them
 void finalizeBases(Module& wasm, Index memory, Index table) {
   struct FinalizableMergeable : public Mergeable, public PostWalker<FinalizableMergeable, Visitor<FinalizableMergeable>> {
@@ -594,35 +812,31 @@ int main(int argc, const char* argv[]) {
                       });
   options.parse(argc, argv);
 
-  Module output;
-  std::vector<std::unique_ptr<Module>> otherModules; // keep all inputs alive, to save copies
-  bool first = true;
-  for (auto& filename : filenames) {
+  // read all the inputs, in parallel. we keep them all alive, as the merged
+  // functions remain in their arenas, which saves copying them
+  std::vector<std::unique_ptr<Module>> modules(filenames.size());
+  doInParallel(filenames.size(), [&](size_t i) {
+    modules[i] = wasm::make_unique<Module>();
     ModuleReader reader;
-    if (first) {
-      // read the first right into output, don't waste time merging into an empty module
-      try {
-        reader.read(filename, output);
-      } catch (ParseException& p) {
-        p.dump(std::cerr);
-        Fatal() << "error in parsing input";
-      }
-      first = false;
-    } else {
-      std::unique_ptr<Module> input = wasm::make_unique<Module>();
-      try {
-        reader.read(filename, *input);
-      } catch (ParseException& p) {
-        p.dump(std::cerr);
-        Fatal() << "error in parsing input";
-      }
-      // perform the merge
-      OutputMergeable outputMergeable(output);
-      InputMergeable inputMergeable(*input, outputMergeable);
-      inputMergeable.merge();
-      // retain the linked in module as we may depend on parts of it
-      otherModules.push_back(std::unique_ptr<Module>(input.release()));
+    try {
+      reader.read(filenames[i], *modules[i]);
+    } catch (ParseException& p) {
+      p.dump(std::cerr);
+      Fatal() << "error in parsing input";
     }
+  });
+
+  if (modules.empty()) {
+    modules.emplace_back(wasm::make_unique<Module>());
+  }
+
+  // merge each into the first, don't waste time merging into an empty module
+  Module& output = *modules[0];
+  OutputIndex index;
+  for (size_t i = 1; i < modules.size(); i++) {
+    OutputMergeable outputMergeable(output, index);
+    InputMergeable inputMergeable(*modules[i], outputMergeable);
+    inputMergeable.merge();
   }
 
   if (verbose) {
@@ -29,6 +29,7 @@
 #include "pass.h"
 #include "support/command-line.h"
 #include "support/file.h"
+#include "support/hash.h"
 #include "support/json.h"
 #include "support/colors.h"
 #include "wasm-io.h"
@@ -37,105 +38,141 @@
 
 using namespace wasm;
 
-// Generic reachability graph of abstract nodes
-
-struct DCENode {
-  Name name;
-  std::vector<Name> reaches; // the other nodes this one can reach
-  DCENode() {}
-  DCENode(Name name) : name(name) {}
-};
-
-// A meta DCE graph with wasm integration
+// A meta DCE graph with wasm integration. Nodes are referred to by their
+// index, and once the graph is complete, the edges are stored in compressed
+// sparse row form, so that the reachability walk only touches two flat
+// arrays.
 struct MetaDCEGraph {
-  std::unordered_map<Name, DCENode> nodes;
-  std::unordered_set<Name> roots;
-
-  std::unordered_map<Name, Name> exportToDCENode; // export exported name => DCE name
-  std::unordered_map<Name, Name> functionToDCENode; // function name => DCE name
-  std::unordered_map<Name, Name> globalToDCENode; // global name => DCE name
-
-  std::unordered_map<Name, Name> DCENodeToExport; // reverse maps
-  std::unordered_map<Name, Name> DCENodeToFunction;
-  std::unordered_map<Name, Name> DCENodeToGlobal;
+  // index => name
+  std::vector<Name> names;
+  std::unordered_map<Name, Index> nodeIndexes;
+  // Whether a node was defined, either by the outside graph or for a part of
+  // the wasm, as opposed to just mentioned in an edge. Only defined nodes are
+  // reported as unused.
+  std::vector<bool> defined;
+  std::vector<Index> roots;
+
+  // Edges, while we build the graph. Those from functions are found in
+  // parallel, each function adding to its own list.
+  std::vector<std::pair<Index, Index>> edges;
+  std::vector<std::vector<Index>> functionEdges; // function index => targets
+
+  // The edges of node i are targets[offsets[i]] .. targets[offsets[i + 1] - 1]
+  std::vector<Index> offsets, targets;
+
+  std::unordered_map<Name, Index> exportToDCENode; // export exported name => DCE node
+  std::unordered_map<Name, Index> functionToDCENode; // function name => DCE node
+  std::unordered_map<Name, Index> globalToDCENode; // global name => DCE node
+  std::unordered_map<Name, Index> functionIndexes; // function name => index in the module
+
+  std::unordered_map<Index, Name> DCENodeToExport; // reverse maps
+  std::unordered_map<Index, Name> DCENodeToFunction;
+  std::unordered_map<Index, Name> DCENodeToGlobal;
 
   // imports are not mapped 1:1 to DCE nodes in the wasm, since env.X might
   // be imported twice, for example. So we don't map a DCE node to an Import,
   // but rather the module.base pair ("id") for the import.
-  // TODO: implement this in a safer way, not a string with a magic separator
-  typedef Name ImportId;
-
-  ImportId getImportId(Name module, Name base) {
-    return std::string(module.str) + " (*) " + std::string(base.str);
-  }
+  typedef std::pair<Name, Name> ImportId;
 
-  ImportId getImportId(Name name) {
-    auto* imp = wasm.getImport(name);
-    return getImportId(imp->module, imp->base);
-  }
+  struct ImportIdHash {
+    size_t operator()(const ImportId& id) const {
+      auto digest = std::hash<Name>()(id.first);
+      digest = rehash(digest, std::hash<Name>()(id.second));
+      return digest;
+    }
+  };
 
-  std::unordered_map<Name, Name> importIdToDCENode; // import module.base => DCE name
+  std::unordered_map<ImportId, Index, ImportIdHash> importIdToDCENode; // import module.base => DCE node
+  std::unordered_map<Name, Index> importToDCENode; // import name => DCE node
 
   Module& wasm;
 
   MetaDCEGraph(Module& wasm) : wasm(wasm) {}
 
+  // Gets the node with a name, adding it if it is new.
+  Index getNode(Name name) {
+    auto iter = nodeIndexes.find(name);
+    if (iter != nodeIndexes.end()) {
+      return iter->second;
+    }
+    return nodeIndexes[name] = addNode(name);
+  }
+
+  // Defines a node of the outside graph. If it was defined before, the
+  // new definition replaces the old one.
+  void defineNode(Index node) {
+    if (defined[node]) {
+      edges.erase(std::remove_if(edges.begin(), edges.end(), [&](const std::pair<Index, Index>& edge) {
+        return edge.first == node;
+      }), edges.end());
+    }
+    defined[node] = true;
+  }
+
+  void addEdge(Index from, Index to) {
+    edges.emplace_back(from, to);
+  }
+
   // populate the graph with info from the wasm, integrating with potentially-existing
   // nodes for imports and exports that the graph may already contain.
   void scanWebAssembly() {
     // Add an entry for everything we might need ahead of time, so parallel work
-    // does not alter parent state, just adds to things pointed by it, independently
-    // (each thread will add for one function, etc.)
-    for (auto& func : wasm.functions) {
-      auto dceName = getName("func", func->name.str);
-      DCENodeToFunction[dceName] = func->name;
-      functionToDCENode[func->name] = dceName;
-      nodes[dceName] = DCENode(dceName);
+    // only reads the maps, and adds edges to the list for its own function
+    for (Index i = 0; i < wasm.functions.size(); i++) {
+      auto& func = wasm.functions[i];
+      auto dceNode = addDefinedNode(getName("func", func->name.str));
+      DCENodeToFunction[dceNode] = func->name;
+      functionToDCENode[func->name] = dceNode;
+      functionIndexes[func->name] = i;
     }
+    functionEdges.resize(wasm.functions.size());
     for (auto& global : wasm.globals) {
-      auto dceName = getName("global", global->name.str);
-      DCENodeToGlobal[dceName] = global->name;
-      globalToDCENode[global->name] = dceName;
-      nodes[dceName] = DCENode(dceName);
+      auto dceNode = addDefinedNode(getName("global", global->name.str));
+      DCENodeToGlobal[dceNode] = global->name;
+      globalToDCENode[global->name] = dceNode;
     }
     for (auto& imp : wasm.imports) {
       // only process function and global imports - the table and memory are always there
       if (imp->kind == ExternalKind::Function || imp->kind == ExternalKind::Global) {
-        auto id = getImportId(imp->module, imp->base);
-        if (importIdToDCENode.find(id) == importIdToDCENode.end()) {
-          auto dceName = getName("importId", imp->name.str);
-          importIdToDCENode[id] = dceName;
+        auto id = ImportId(imp->module, imp->base);
+        auto iter = importIdToDCENode.find(id);
+        if (iter == importIdToDCENode.end()) {
+          // this node is not in the outside graph, and is never reported as
+          // unused, so it does not need to be findable by name
+          auto dceNode = addNode(getName("importId", imp->name.str));
+          iter = importIdToDCENode.emplace(id, dceNode).first;
         }
+        importToDCENode[imp->name] = iter->second;
       }
     }
     for (auto& exp : wasm.exports) {
       if (exportToDCENode.find(exp->name) == exportToDCENode.end()) {
-        auto dceName = getName("export", exp->name.str);
-        DCENodeToExport[dceName] = exp->name;
-        exportToDCENode[exp->name] = dceName;
-        nodes[dceName] = DCENode(dceName);
+        auto dceNode = addDefinedNode(getName("export", exp->name.str));
+        DCENodeToExport[dceNode] = exp->name;
+        exportToDCENode[exp->name] = dceNode;
       }
       // we can also link the export to the thing being exported
-      auto& node = nodes[exportToDCENode[exp->name]];
+      auto node = exportToDCENode[exp->name];
       if (exp->kind == ExternalKind::Function) {
         if (wasm.getFunctionOrNull(exp->value)) {
-          node.reaches.push_back(functionToDCENode[exp->value]);
+          addEdge(node, functionToDCENode[exp->value]);
         } else {
-          node.reaches.push_back(importIdToDCENode[getImportId(exp->value)]);
+          addEdge(node, importToDCENode[exp->value]);
         }
       } else if (exp->kind == ExternalKind::Global) {
         if (wasm.getGlobalOrNull(exp->value)) {
-          node.reaches.push_back(globalToDCENode[exp->value]);
+          addEdge(node, globalToDCENode[exp->value]);
         } else {
-          node.reaches.push_back(importIdToDCENode[getImportId(exp->value)]);
+          addEdge(node, importToDCENode[exp->value]);
         }
       }
     }
     // Add initializer dependencies
-    // if we provide a parent DCE name, that is who can reach what we see
-    // if none is provided, then it is something we must root
+    // if we provide a parent DCE node, that is who can reach what we see
+    // if none is provided, the thing is not removable anyhow (a segment
+    // offset), and nothing is added
     struct InitScanner : public PostWalker<InitScanner> {
-      InitScanner(MetaDCEGraph* parent, Name parentDceName) : parent(parent), parentDceName(parentDceName) {}
+      InitScanner(MetaDCEGraph* parent, Index parentDceNode) : parent(parent), parentDceNode(parentDceNode) {}
 
       void visitGetGlobal(GetGlobal* curr) {
         handleGlobal(curr->name);
@@ -146,21 +183,11 @@ struct MetaDCEGraph {
 
     private:
       MetaDCEGraph* parent;
-      Name parentDceName;
+      Index parentDceNode;
 
       void handleGlobal(Name name) {
-        Name dceName;
-        if (getModule()->getGlobalOrNull(name)) {
-          // its a global
-          dceName = parent->globalToDCENode[name];
-        } else {
-          // it's an import.
-          dceName = parent->importIdToDCENode[parent->getImportId(name)];
-        }
-        if (parentDceName.isNull()) {
-          parent->roots.insert(parentDceName);
-        } else {
-          parent->nodes[parentDceName].reaches.push_back(dceName);
+        if (parentDceNode != Index(-1)) {
+          parent->addEdge(parentDceNode, parent->getGlobalNode(name));
         }
       }
     };
@@ -170,16 +197,16 @@ struct MetaDCEGraph {
       scanner.walk(global->init);
     }
     // we can't remove segments, so root what they need
-    InitScanner rooter(this, Name());
+    InitScanner rooter(this, Index(-1));
     rooter.setModule(&wasm);
     for (auto& segment : wasm.table.segments) {
       // TODO: currently, all functions in the table are roots, but we
       //       should add an option to refine that
       for (auto& name : segment.data) {
         if (wasm.getFunctionOrNull(name)) {
-          roots.insert(functionToDCENode[name]);
+          roots.push_back(functionToDCENode[name]);
         } else {
-          roots.insert(importIdToDCENode[getImportId(name)]);
+          roots.push_back(importToDCENode[name]);
         }
       }
       rooter.walk(segment.offset);
@@ -198,45 +225,35 @@ struct MetaDCEGraph {
         return new Scanner(parent);
       }
 
+      void doWalkFunction(Function* func) {
+        reaches = &parent->functionEdges[parent->functionIndexes.at(func->name)];
+        walk(func->body);
+      }
+
       void visitCall(Call* curr) {
-        parent->nodes[parent->functionToDCENode[getFunction()->name]].reaches.push_back(
-          parent->functionToDCENode[curr->target]
-        );
+        reaches->push_back(parent->functionToDCENode.at(curr->target));
       }
       void visitCallImport(CallImport* curr) {
-        assert(parent->functionToDCENode.count(getFunction()->name) > 0);
-        parent->nodes[parent->functionToDCENode[getFunction()->name]].reaches.push_back(
-          parent->importIdToDCENode[parent->getImportId(curr->target)]
-        );
+        reaches->push_back(parent->importToDCENode.at(curr->target));
       }
       void visitGetGlobal(GetGlobal* curr) {
-        handleGlobal(curr->name);
+        reaches->push_back(parent->getGlobalNode(curr->name));
       }
       void visitSetGlobal(SetGlobal* curr) {
-        handleGlobal(curr->name);
+        reaches->push_back(parent->getGlobalNode(curr->name));
       }
 
     private:
       MetaDCEGraph* parent;
-
-      void handleGlobal(Name name) {
-        if (!getFunction()) return; // non-function stuff (initializers) are handled separately
-        Name dceName;
-        if (getModule()->getGlobalOrNull(name)) {
-          // its a global
-          dceName = parent->globalToDCENode[name];
-        } else {
-          // it's an import.
-          dceName = parent->importIdToDCENode[parent->getImportId(name)];
-        }
-        parent->nodes[parent->functionToDCENode[getFunction()->name]].reaches.push_back(dceName);
-      }
+      std::vector<Index>* reaches;
     };
 
     PassRunner runner(&wasm);
     runner.setIsNested(true);
     runner.add<Scanner>(this);
     runner.run();
+
+    buildRows();
   }
 
 private:
@@ -244,7 +261,8 @@ private:
   Name getName(std::string prefix1, std::string prefix2) {
     while (1) {
       auto curr = Name(prefix1 + '$' + prefix2 + '$' + std::to_string(nameIndex++));
-      if (nodes.find(curr) == nodes.end()) {
+      auto iter = nodeIndexes.find(curr);
+      if (iter == nodeIndexes.end() || !defined[iter->second]) {
         return curr;
       }
     }
@@ -252,23 +270,79 @@ private:
 
   Index nameIndex = 0;
 
-  std::unordered_set<Name> reached;
+  Index addNode(Name name) {
+    names.push_back(name);
+    defined.push_back(false);
+    return names.size() - 1;
+  }
+
+  Index addDefinedNode(Name name) {
+    auto node = getNode(name);
+    defined[node] = true;
+    return node;
+  }
+
+  // a global might be imported, in which case the node is the import's
+  Index getGlobalNode(Name name) {
+    auto iter = globalToDCENode.find(name);
+    if (iter != globalToDCENode.end()) {
+      return iter->second;
+    }
+    return importToDCENode.at(name);
+  }
+
+  // Turns the edge lists into rows, in the order they were added
+  void buildRows() {
+    offsets.assign(names.size() + 1, 0);
+    for (auto& edge : edges) {
+      offsets[edge.first + 1]++;
+    }
+    for (auto& pair : functionToDCENode) {
+      offsets[pair.second + 1] += functionEdges[functionIndexes[pair.first]].size();
+    }
+    for (Index i = 0; i < names.size(); i++) {
+      offsets[i + 1] += offsets[i];
+    }
+    targets.resize(offsets.back());
+    auto next = offsets;
+    for (auto& edge : edges) {
+      targets[next[edge.first]++] = edge.second;
+    }
+    for (Index i = 0; i < wasm.functions.size(); i++) {
+      auto node = functionToDCENode[wasm.functions[i]->name];
+      for (auto target : functionEdges[i]) {
+        targets[next[node]++] = target;
+      }
+    }
+    edges.clear();
+    edges.shrink_to_fit();
+    functionEdges.clear();
+  }
+
+  std::vector<bool> reached;
+
+  bool isReached(Index node) {
+    return reached[node];
+  }
 
 public:
   // Perform the DCE: simple marking from the roots
   void deadCodeElimination() {
-    std::vector<Name> queue;
+    reached.assign(names.size(), false);
+    std::vector<Index> queue;
     for (auto root : roots) {
-      reached.insert(root);
-      queue.push_back(root);
+      if (!reached[root]) {
+        reached[root] = true;
+        queue.push_back(root);
+      }
     }
     while (queue.size() > 0) {
-      auto name = queue.back();
+      auto node = queue.back();
       queue.pop_back();
-      auto& node = nodes[name];
-      for (auto target : node.reaches) {
-        if (reached.find(target) == reached.end()) {
-          reached.insert(target);
+      for (auto i = offsets[node]; i < offsets[node + 1]; i++) {
+        auto target = targets[i];
+        if (!reached[target]) {
+          reached[target] = true;
           queue.push_back(target);
         }
       }
@@ -281,8 +355,7 @@ public:
     std::vector<Name> toRemove;
     for (auto& exp : wasm.exports) {
       auto name = exp->name;
-      auto dceName = exportToDCENode[name];
-      if (reached.find(dceName) == reached.end()) {
+      if (!isReached(exportToDCENode[name])) {
         toRemove.push_back(name);
       }
     }
@@ -300,10 +373,9 @@ public:
   // removed, including on the outside
   void printAllUnused() {
     std::set<std::string> unused;
-    for (auto& pair : nodes) {
-      auto name = pair.first;
-      if (reached.find(name) == reached.end()) {
-        unused.insert(name.str);
+    for (Index i = 0; i < names.size(); i++) {
+      if (defined[i] && !isReached(i)) {
+        unused.insert(names[i].str);
       }
     }
     for (auto& name : unused) {
@@ -315,32 +387,29 @@ public:
   void dump() {
     std::cout << "=== graph ===\n";
     for (auto root : roots) {
-      std::cout << "root: " << root.str << '\n';
+      std::cout << "root: " << names[root].str << '\n';
     }
-    std::map<Name, ImportId> importMap;
+    std::map<Index, ImportId> importMap;
     for (auto& pair : importIdToDCENode) {
-      auto& id = pair.first;
-      auto dceName = pair.second;
-      importMap[dceName] = id;
-    }
-    for (auto& pair : nodes) {
-      auto name = pair.first;
-      auto& node = pair.second;
-      std::cout << "node: " << name.str << '\n';
-      if (importMap.find(name) != importMap.end()) {
-        std::cout << "  is import " << importMap[name] << '\n';
+      importMap[pair.second] = pair.first;
+    }
+    for (Index i = 0; i < names.size(); i++) {
+      if (!defined[i] && importMap.find(i) == importMap.end()) continue;
+      std::cout << "node: " << names[i].str << '\n';
+      if (importMap.find(i) != importMap.end()) {
+        std::cout << "  is import " << importMap[i].first << " (*) " << importMap[i].second << '\n';
       }
-      if (DCENodeToExport.find(name) != DCENodeToExport.end()) {
-        std::cout << "  is export " << DCENodeToExport[name].str << ", " << wasm.getExport(DCENodeToExport[name])->value << '\n';
+      if (DCENodeToExport.find(i) != DCENodeToExport.end()) {
+        std::cout << "  is export " << DCENodeToExport[i].str << ", " << wasm.getExport(DCENodeToExport[i])->value << '\n';
       }
-      if (DCENodeToFunction.find(name) != DCENodeToFunction.end()) {
-        std::cout << "  is function " << DCENodeToFunction[name] << '\n';
+      if (DCENodeToFunction.find(i) != DCENodeToFunction.end()) {
+        std::cout << "  is function " << DCENodeToFunction[i] << '\n';
       }
-      if (DCENodeToGlobal.find(name) != DCENodeToGlobal.end()) {
-        std::cout << "  is function " << DCENodeToGlobal[name] << '\n';
+      if (DCENodeToGlobal.find(i) != DCENodeToGlobal.end()) {
+        std::cout << "  is function " << DCENodeToGlobal[i] << '\n';
       }
-      for (auto target : node.reaches) {
-        std::cout << "  reaches: " << target.str << '\n';
+      for (auto j = offsets[i]; j < offsets[i + 1]; j++) {
+        std::cout << "  reaches: " << names[targets[j]].str << '\n';
       }
     }
     std::cout << "=============\n";
@@ -450,10 +519,12 @@ int main(int argc, const char* argv[]) {
     }
   }
 
-  auto graphInput(read_file<std::string>(graphFile, Flags::Text, Flags::Release));
-  auto* copy = strdup(graphInput.c_str());
+  // the JSON is parsed in place, in this NUL-terminated buffer, and the
+  // parsed graph lives in the arena, so both must stay alive until we finish
+  auto graphInput(read_file<std::vector<char>>(graphFile, Flags::Text, Flags::Release));
+  MixedArena jsonArena;
   json::Value outside;
-  outside.parse(copy);
+  outside.parse(graphInput.data(), jsonArena);
 
   // parse the JSON into our graph, doing all the JSON parsing here, leaving
   // the abstract computation for the class itself
@@ -477,7 +548,8 @@ int main(int argc, const char* argv[]) {
     if (!ref->has(NAME)) {
       Fatal() << "nodes in input graph must have a name. see --help for the form";
     }
-    DCENode node(ref[NAME]->getIString());
+    auto node = graph.getNode(ref[NAME]->getIString());
+    graph.defineNode(node);
     if (ref->has(REACHES)) {
       json::Ref reaches = ref[REACHES];
       if (!reaches->isArray()) {
@@ -489,7 +561,7 @@ int main(int argc, const char* argv[]) {
         if (!name->isString()) {
           Fatal() << "node.reaches items must be strings. see --help for the form";
         }
-        node.reaches.push_back(name->getIString());
+        graph.addEdge(node, graph.getNode(name->getIString()));
       }
     }
     if (ref->has(ROOT)) {
@@ -497,26 +569,24 @@ int main(int argc, const char* argv[]) {
       if (!root->isBool() || !root->getBool()) {
         Fatal() << "node.root, if it exists, must be true. see --help for the form";
       }
-      graph.roots.insert(node.name);
+      graph.roots.push_back(node);
     }
     if (ref->has(EXPORT)) {
       json::Ref exp = ref[EXPORT];
       if (!exp->isString()) {
         Fatal() << "node.export, if it exists, must be a string. see --help for the form";
       }
-      graph.exportToDCENode[exp->getIString()] = node.name;
-      graph.DCENodeToExport[node.name] = exp->getIString();
+      graph.exportToDCENode[exp->getIString()] = node;
+      graph.DCENodeToExport[node] = exp->getIString();
     }
     if (ref->has(IMPORT)) {
       json::Ref imp = ref[IMPORT];
       if (!imp->isArray() || imp->size() != 2 || !imp[0]->isString() || !imp[1]->isString()) {
         Fatal() << "node.import, if it exists, must be an array of two strings. see --help for the form";
       }
-      auto id = graph.getImportId(imp[0]->getIString(), imp[1]->getIString());
-      graph.importIdToDCENode[id] = node.name;
+      MetaDCEGraph::ImportId id(imp[0]->getIString(), imp[1]->getIString());
+      graph.importIdToDCENode[id] = node;
     }
-    // TODO: optimize this copy with a clever move
-    graph.nodes[node.name] = node;
   }
 
   // The external graph is now populated. Scan the module
@@ -542,7 +612,4 @@ int main(int argc, const char* argv[]) {
 
   // Print out everything that we found is removable, the outside might use that
   graph.printAllUnused();
-
-  // Clean up
-  free(copy);
 }
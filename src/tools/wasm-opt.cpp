@@ -34,6 +34,7 @@
 #include "optimization-options.h"
 #include "execution-results.h"
 #include "fuzzing.h"
+#include "autotune.h"
 #include "js-wrapper.h"
 #include "spec-wrapper.h"
 
@@ -63,8 +64,13 @@ std::string runCommand(std::string command) {
 int main(int argc, const char* argv[]) {
   Name entry;
   bool emitBinary = true;
+  bool emitSnapshot = false;
   bool debugInfo = false;
   bool converge = false;
+  bool autotune = false;
+  Autotuner::Goal autotuneGoal = Autotuner::Size;
+  size_t autotuneGenerations = 8;
+  std::string autotunePipelineFile;
   bool fuzzExec = false;
   bool fuzzBinary = false;
   std::string extraFuzzCommand;
@@ -87,12 +93,35 @@ int main(int argc, const char* argv[]) {
       .add("--emit-text", "-S", "Emit text instead of binary for the output file",
            Options::Arguments::Zero,
            [&](Options *o, const std::string& argument) { emitBinary = false; })
+      .add("--emit-snapshot", "-snapshot", "Emit a snapshot of the IR instead of wasm, which a later wasm-opt run with the same version can read back exactly, including all names and debug info",
+           Options::Arguments::Zero,
+           [&](Options *o, const std::string& argument) { emitSnapshot = true; })
       .add("--debuginfo", "-g", "Emit names section and debug info",
            Options::Arguments::Zero,
            [&](Options *o, const std::string& arguments) { debugInfo = true; })
       .add("--converge", "-c", "Run passes to convergence, continuing while binary size decreases",
            Options::Arguments::Zero,
            [&](Options *o, const std::string& arguments) { converge = true; })
+      .add("--autotune", "-at", "Search for a pipeline of optimization passes that does well on this module, starting from the default one, and run it. The optimize and shrink levels given are the starting point",
+           Options::Arguments::Zero,
+           [&](Options *o, const std::string& arguments) { autotune = true; })
+      .add("--autotune-goal", "-atg", "What --autotune optimizes for: size (the default) for the smallest binary, or cost for the lowest estimated execution cost",
+           Options::Arguments::One,
+           [&](Options *o, const std::string& argument) {
+             if (argument == "size") {
+               autotuneGoal = Autotuner::Size;
+             } else if (argument == "cost") {
+               autotuneGoal = Autotuner::Cost;
+             } else {
+               Fatal() << "Unknown autotune goal: " << argument;
+             }
+           })
+      .add("--autotune-generations", "-atn", "How many generations --autotune searches for at most (default: 8)",
+           Options::Arguments::One,
+           [&](Options *o, const std::string& argument) { autotuneGenerations = std::stoul(argument); })
+      .add("--autotune-pipeline", "-atp", "Write the pipeline found by --autotune to the specified file, as wasm-opt arguments (stderr if not specified)",
+           Options::Arguments::One,
+           [&](Options *o, const std::string& argument) { autotunePipelineFile = argument; })
       .add("--fuzz-exec", "-fe", "Execute functions before and after optimization, helping fuzzing find bugs",
            Options::Arguments::Zero,
            [&](Options *o, const std::string& arguments) { fuzzExec = true; })
@@ -229,6 +258,35 @@ int main(int argc, const char* argv[]) {
     curr = &other;
   }
 
+  if (autotune) {
+    if (options.debug) std::cerr << "autotuning...\n";
+    auto best = Autotuner(*curr, options.passOptions, autotuneGoal).run(autotuneGenerations);
+    if (autotunePipelineFile.size() > 0) {
+      std::ofstream outfile;
+      outfile.open(autotunePipelineFile, std::ofstream::out);
+      outfile << best->toString() << '\n';
+      outfile.close();
+    } else {
+      std::cerr << "[autotune pipeline] " << best->toString() << '\n';
+    }
+    // run what we found instead of the default optimization passes, or
+    // before any other passes if those were not asked for
+    options.passOptions.optimizeLevel = best->optimizeLevel;
+    options.passOptions.shrinkLevel = best->shrinkLevel;
+    std::vector<std::string> passes;
+    if (!options.runningDefaultOptimizationPasses()) {
+      passes = best->passes;
+    }
+    for (auto& pass : options.passes) {
+      if (pass == OptimizationOptions::DEFAULT_OPT_PASSES) {
+        passes.insert(passes.end(), best->passes.begin(), best->passes.end());
+      } else {
+        passes.push_back(pass);
+      }
+    }
+    options.passes = passes;
+  }
+
   if (options.runningPasses()) {
     if (options.debug) std::cerr << "running passes...\n";
     auto runPasses = [&]() {
@@ -271,6 +329,7 @@ int main(int argc, const char* argv[]) {
     ModuleWriter writer;
     writer.setDebug(options.debug);
     writer.setBinary(emitBinary);
+    writer.setSnapshot(emitSnapshot);
     writer.setDebugInfo(debugInfo);
     if (outputSourceMapFilename.size()) {
       writer.setSourceMapFilename(outputSourceMapFilename);
@@ -60,6 +60,9 @@ int main(int argc, const char *argv[]) {
 
   Element* root;
   Module wasm;
+  // the AST is freed once we have printed it
+  auto astArena = make_unique<cashew::ScopedArena>();
+  Wasm2AsmBuilder wasm2asm(builderFlags);
   Ref asmjs;
 
   try {
@@ -71,8 +74,9 @@ int main(int argc, const char *argv[]) {
     SExpressionWasmBuilder builder(wasm, *(*root)[0]);
 
     if (options.debug) std::cerr << "asming..." << std::endl;
-    Wasm2AsmBuilder wasm2asm(builderFlags);
-    asmjs = wasm2asm.processWasm(&wasm);
+    // convert the functions only as we print them, unless we want to see the
+    // entire AST
+    asmjs = wasm2asm.processWasm(&wasm, ASM_FUNC, !options.debug);
 
     if (options.extra["asserts"] == "1") {
       if (options.debug) std::cerr << "asserting..." << std::endl;
@@ -92,10 +96,19 @@ int main(int argc, const char *argv[]) {
   }
 
   if (options.debug) std::cerr << "j-printing..." << std::endl;
-  JSPrinter jser(true, true, asmjs);
-  jser.printAst();
   Output output(options.extra["output"], Flags::Text, options.debug ? Flags::Debug : Flags::Release);
-  output << jser.buffer << std::endl;
+  JSPrinter jser(true, true, asmjs);
+  // each function is freed once it is printed, before the next is converted
+  std::unique_ptr<cashew::ScopedArena> functionArena;
+  jser.expandFunction = [&](Ref func) {
+    functionArena.reset();
+    functionArena = make_unique<cashew::ScopedArena>();
+    return wasm2asm.processLazyFunction(func);
+  };
+  jser.printAst(output.getStream());
+  output.getStream() << std::endl;
+  functionArena.reset();
+  astArena.reset();
 
   if (options.debug) std::cerr << "done." << std::endl;
 }
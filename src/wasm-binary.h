@@ -75,6 +75,20 @@ struct LEB {
     } while (more);
   }
 
+  // the number of bytes write() would emit
+  size_t size() {
+    T temp = value;
+    size_t ret = 0;
+    bool more;
+    do {
+      uint8_t byte = temp & 127;
+      temp >>= 7;
+      more = hasMore(temp, byte);
+      ret++;
+    } while (more);
+    return ret;
+  }
+
   // @minimum: a minimum number of bytes to write, padding as necessary
   // returns the number of bytes written
   size_t writeAt(std::vector<uint8_t>* out, size_t at, size_t minimum = 0) {
@@ -94,7 +108,8 @@ struct LEB {
     return offset;
   }
 
-  void read(std::function<MiniT()> get) {
+  template<typename Get>
+  void read(Get get) {
     value = 0;
     T shift = 0;
     MiniT byte;
@@ -662,6 +677,16 @@ class WasmBinaryWriter : public Visitor<WasmBinaryWriter, void> {
   std::string sourceMapUrl;
   std::string symbolMap;
 
+  // When set, completed parts of the binary are written here as we go,
+  // instead of the buffer holding all of it at the end.
+  std::ostream* output = nullptr;
+  // bytes already written to the output
+  size_t flushedBytes = 0;
+  // function bodies moved out of the buffer, to be written once the size of
+  // the code section is known
+  std::vector<std::vector<uint8_t>> pendingBodies;
+  size_t pendingBodyBytes = 0;
+
   MixedArena allocator;
 
   void prepare();
@@ -687,6 +712,14 @@ public:
     sourceMapUrl = url;
   }
   void setSymbolMap(std::string set) { symbolMap = set; }
+  // Write the binary to a stream as it is generated. Only a single section is
+  // buffered at a time, except for the code section, whose function bodies
+  // are kept as they are (rather than in a single growing buffer) until its
+  // size is known.
+  void setOutput(std::ostream* set) { output = set; }
+
+  // the location in the output binary that the next byte will be written to
+  size_t getPosition() { return flushedBytes + pendingBodyBytes + o.size(); }
 
   void write();
   void writeHeader();
@@ -746,6 +779,7 @@ public:
   void emitBuffer(const char* data, size_t size);
   void emitString(const char *str);
   void finishUp();
+  void flush();
 
   // AST writing via visitors
   int depth = 0; // only for debugging
@@ -761,7 +795,7 @@ public:
       auto& debugLocations = currFunction->debugLocations;
       auto iter = debugLocations.find(curr);
       if (iter != debugLocations.end() && iter->second != lastDebugLocation) {
-        writeDebugLocation(o.size(), iter->second);
+        writeDebugLocation(getPosition(), iter->second);
       }
     }
     Visitor<WasmBinaryWriter>::visit(curr);
@@ -839,6 +873,7 @@ public:
   uint64_t getU64LEB();
   int32_t getS32LEB();
   int64_t getS64LEB();
+  template<typename T, typename MiniT> T getLEB();
   Type getType();
   Type getConcreteType();
   Name getString();
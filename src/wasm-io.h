@@ -42,15 +42,20 @@ public:
   // read binary
   void readBinary(std::string filename, Module& wasm,
                   std::string sourceMapFilename="");
+  // read a snapshot (see wasm-snapshot.h)
+  void readSnapshot(std::string filename, Module& wasm);
   // read text or binary, checking the contents for what it is
   void read(std::string filename, Module& wasm,
             std::string sourceMapFilename="");
   // check whether a file is a wasm binary
   bool isBinaryFile(std::string filename);
+  // check whether a file is a snapshot
+  bool isSnapshotFile(std::string filename);
 };
 
 class ModuleWriter : public ModuleIO {
   bool binary = true;
+  bool snapshot = false;
   bool debugInfo = false;
   std::string symbolMap;
   std::string sourceMapFilename;
@@ -58,6 +63,7 @@ class ModuleWriter : public ModuleIO {
 
 public:
   void setBinary(bool binary_) { binary = binary_; }
+  void setSnapshot(bool snapshot_) { snapshot = snapshot_; }
   void setDebugInfo(bool debugInfo_) { debugInfo = debugInfo_; }
   void setSymbolMap(std::string symbolMap_) { symbolMap = symbolMap_; }
   void setSourceMapFilename(std::string sourceMapFilename_) { sourceMapFilename = sourceMapFilename_; }
@@ -69,9 +75,12 @@ public:
   // write binary
   void writeBinary(Module& wasm, Output& output);
   void writeBinary(Module& wasm, std::string filename);
-  // write text or binary, defaulting to binary unless setBinary(false),
-  // and unless there is no output file (in which case we write text
-  // to stdout).
+  // write a snapshot (see wasm-snapshot.h)
+  void writeSnapshot(Module& wasm, Output& output);
+  void writeSnapshot(Module& wasm, std::string filename);
+  // write a snapshot if setSnapshot(true), or else text or binary,
+  // defaulting to binary unless setBinary(false), and unless there
+  // is no output file (in which case we write text to stdout).
   void write(Module& wasm, Output& output);
   void write(Module& wasm, std::string filename);
 };
@@ -46,12 +46,15 @@ class Element {
 
   bool isList_;
   List list_;
-  cashew::IString str_;
+  // strings are interned only when needed, as most tokens (e.g. numbers)
+  // never need to be, and the string pool is never freed
+  mutable cashew::IString str_;
+  mutable bool interned_;
   bool dollared_;
   bool quoted_;
 
 public:
-  Element(MixedArena& allocator) : isList_(true), list_(allocator), line(-1), col(-1), loc(nullptr) {}
+  Element(MixedArena& allocator) : isList_(true), list_(allocator), interned_(false), line(-1), col(-1), loc(nullptr) {}
 
   bool isList() const { return isList_; }
   bool isStr() const { return !isList_; }
@@ -71,7 +74,13 @@ public:
   // string methods
   cashew::IString str() const;
   const char* c_str() const;
+  // the characters of the string, without interning it. this is only valid
+  // as long as the element is
+  const char* text() const;
   Element* setString(cashew::IString str__, bool dollared__, bool quoted__);
+  // sets the string without interning it; the characters must live as long
+  // as the element
+  Element* setText(const char* text, bool dollared__, bool quoted__);
   Element* setMetadata(size_t line_, size_t col_, SourceLocation* loc_);
 
   // printing
@@ -89,6 +98,13 @@ class SExpressionParser {
   SourceLocation* loc;
 
   MixedArena allocator;
+  // where elements are allocated (normally our own allocator)
+  MixedArena* elementAllocator;
+  // if nonzero, lists nested deeper than this are skipped, and left empty
+  size_t maxDepth = 0;
+  bool sawDebugLocation = false;
+
+  friend class SExpressionModuleParser;
 
 public:
   // Assumes control of and modifies the input.
@@ -96,10 +112,53 @@ public:
   Element* root;
 
 private:
-  Element* parse();
+  // Creates a parser without parsing anything yet.
+  SExpressionParser(char* input, MixedArena* elementAllocator);
+
+  Element* parse(bool single = false);
   void skipWhitespace();
+  void skipList();
   void parseDebugLocation();
   Element* parseString();
+  char* copyText(const char* text, size_t size);
+};
+
+//
+// Streaming S-Expression parsing of a single module. Rather than build an
+// Element tree for the entire module, which for a large module can take
+// more memory than the IR, we find the module's fields with a cheap scan,
+// and parse each one into Elements on demand, in an arena that the caller
+// can free as soon as it is done with that field.
+//
+class SExpressionModuleParser {
+  struct Field {
+    char* start;
+    size_t line;
+    char* lineStart;
+    SourceLocation* loc;
+    bool isFunction;
+  };
+
+  SExpressionParser parser;
+  std::vector<Field> fields;
+
+public:
+  // Assumes control of and modifies the input.
+  SExpressionModuleParser(char* input);
+
+  // the module's name, if it has one
+  Name name;
+
+  size_t getNumFields() { return fields.size(); }
+
+  bool isFunction(size_t i) { return fields[i].isFunction; }
+
+  bool hasDebugLocations() { return parser.sawDebugLocation; }
+
+  // Parses a field into the given arena. If shallow, function bodies are
+  // only parsed one level deep, which is enough to find the signatures.
+  // This can be called on multiple threads at once, with separate arenas.
+  Element* parseField(size_t i, MixedArena& arena, bool shallow = false);
 };
 
 //
@@ -119,8 +178,16 @@ class SExpressionWasmBuilder {
 public:
   // Assumes control of and modifies the input.
   SExpressionWasmBuilder(Module& wasm, Element& module, Name* moduleName = nullptr);
+  // Builds a module one field at a time, freeing the Elements of each field
+  // when done with it. Function bodies are parsed in parallel.
+  SExpressionWasmBuilder(Module& wasm, SExpressionModuleParser& module, Name* moduleName = nullptr);
 
 private:
+  // Creates a builder for parsing function bodies on another thread, with
+  // the module-level state of the parent.
+  SExpressionWasmBuilder(SExpressionWasmBuilder& parent);
+
+  void parseFieldsThenFunctions(SExpressionModuleParser& module, bool parallel);
   // pre-parse types and function definitions, so we know function return types before parsing their contents
   void preParseFunctionType(Element& s);
   bool isImport(Element& curr);
@@ -144,6 +211,11 @@ private:
   // returns the next index in s
   size_t parseFunctionNames(Element& s, Name& name, Name& exportName);
   void parseFunction(Element& s, bool preParseImport = false);
+  // parses the function's names, and adds its export if it has one
+  Name parseFunctionHeader(Element& s, bool preParseImport);
+  // parses the rest of the function, returning it (or nullptr for an import)
+  std::unique_ptr<Function> parseFunctionBody(Element& s, Name name, bool preParseImport);
+  void addFunction(std::unique_ptr<Function> func, size_t line, size_t col);
 
   Type stringToType(cashew::IString str, bool allowError=false, bool prefix=false) {
     return stringToType(str.str, allowError, prefix);
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2018 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Snapshots of Binaryen IR, for passing a module from one invocation of a
+// tool to another, for example to split a long pass pipeline across build
+// steps.
+//
+// Unlike the wasm binary format, a snapshot is an exact image of the IR:
+// local and label names, debug locations, user sections and the types of
+// all nodes are kept as they are, and loading one needs no lowering or
+// type inference, just a linear decode with each string interned once.
+//
+// This is a private format: a snapshot can only be read by a build of
+// Binaryen with the same Snapshot::Version, which must be bumped whenever
+// the IR or the encoding changes.
+//
+
+#ifndef wasm_wasm_snapshot_h
+#define wasm_wasm_snapshot_h
+
+#include "wasm.h"
+#include "wasm-binary.h"
+
+namespace wasm {
+
+namespace Snapshot {
+
+// "\0bir"
+enum {
+  Magic = 0x72696200,
+  Version = 1
+};
+
+// Checks if the data begins with a snapshot header, of any version.
+bool isSnapshot(const std::vector<char>& input);
+
+} // namespace Snapshot
+
+class SnapshotWriter {
+public:
+  SnapshotWriter(Module* wasm, BufferWithRandomAccess& o) : wasm(wasm), o(o) {}
+
+  void write();
+
+private:
+  Module* wasm;
+  BufferWithRandomAccess& o;
+
+  // the strings we saw, which are written before everything else
+  std::vector<Name> strings;
+  std::unordered_map<Name, Index> stringIndexes;
+
+  void writeName(BufferWithRandomAccess& buffer, Name name);
+  void writeExpression(BufferWithRandomAccess& buffer, Expression* curr, Function* func = nullptr);
+  void writeFunction(BufferWithRandomAccess& buffer, Function* func);
+};
+
+class SnapshotReader {
+public:
+  SnapshotReader(Module& wasm, const std::vector<char>& input) : wasm(wasm), input(input) {}
+
+  void read();
+
+private:
+  Module& wasm;
+  const std::vector<char>& input;
+  size_t pos = 0;
+
+  std::vector<Name> strings;
+  // the stack of nodes whose parents we have not reached yet
+  std::vector<Expression*> stack;
+
+  uint8_t getInt8();
+  uint32_t getInt32();
+  uint64_t getU64LEB();
+  uint32_t getU32LEB();
+  Name getName();
+  Type getType();
+  Expression* getExpression(Function* func = nullptr);
+  Expression* pop();
+  void popList(ExpressionList& list, Index num);
+  Function* getFunction();
+};
+
+} // namespace wasm
+
+#endif // wasm_wasm_snapshot_h
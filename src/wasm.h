@@ -621,8 +621,16 @@ public:
   };
   std::unordered_map<Expression*, DebugLocation> debugLocations;
 
+  // Bodies can be shared copy-on-write between functions in different
+  // modules, see ModuleUtils::cloneModule. All the functions sharing a body
+  // hold the same token, and while there is more than one of them, the body
+  // must be copied (see ModuleUtils::unshareBody) before it is modified.
+  std::shared_ptr<char> bodyShare;
+
   Function() : result(none) {}
 
+  bool isBodyShared() const { return bodyShare.use_count() > 1; }
+
   size_t getNumParams();
   size_t getNumVars();
   size_t getNumLocals();
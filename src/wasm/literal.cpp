@@ -127,6 +127,26 @@ double Literal::setQuietNaN(double f) {
   return bit_cast<double>(0x0008000000000000ull | bit_cast<uint64_t>(f));
 }
 
+// Writes the decimal digits of x right-aligned into buffer, which must end at
+// end, and returns where they start. This is much faster than the stream's
+// number formatting, which matters when printing large modules.
+static char* formatDecimal(uint64_t x, char* end) {
+  char* start = end;
+  do {
+    *--start = '0' + (x % 10);
+    x /= 10;
+  } while (x);
+  return start;
+}
+
+static void printInteger(std::ostream& o, int64_t x) {
+  char buffer[24];
+  char* end = buffer + sizeof(buffer);
+  char* start = formatDecimal(x < 0 ? -uint64_t(x) : uint64_t(x), end);
+  if (x < 0) *--start = '-';
+  o.write(start, end - start);
+}
+
 void Literal::printFloat(std::ostream &o, float f) {
   if (std::isnan(f)) {
     const char* sign = std::signbit(f) ? "-" : "";
@@ -156,6 +176,31 @@ void Literal::printDouble(std::ostream& o, double d) {
     o << (std::signbit(d) ? "-inf" : "inf");
     return;
   }
+  // Integers are common, and we can print them directly rather than search
+  // for the shortest form like numToString does. That results in all the
+  // digits, except that 3 or more trailing zeros become an exponent.
+  if (std::fabs(d) < 9007199254740992.0 && d == std::trunc(d)) {
+    char buffer[32];
+    char* end = buffer + sizeof(buffer);
+    uint64_t x = uint64_t(std::fabs(d));
+    uint64_t mantissa = x;
+    int zeros = 0;
+    while (mantissa && mantissa % 10 == 0) {
+      mantissa /= 10;
+      zeros++;
+    }
+    // one or two zeros are not worth an exponent
+    char* exponent = end;
+    if (zeros >= 3) {
+      exponent = formatDecimal(zeros, end);
+      *--exponent = 'e';
+      x = mantissa;
+    }
+    char* start = formatDecimal(x, exponent);
+    if (d < 0) *--start = '-';
+    o.write(start, end - start);
+    return;
+  }
   const char* text = cashew::JSPrinter::numToString(d);
   // spec interpreter hates floats starting with '.'
   if (text[0] == '.') {
@@ -172,8 +217,8 @@ std::ostream& operator<<(std::ostream& o, Literal literal) {
   prepareMinorColor(o) << printType(literal.type) << ".const ";
   switch (literal.type) {
     case none: o << "?"; break;
-    case Type::i32: o << literal.i32; break;
-    case Type::i64: o << literal.i64; break;
+    case Type::i32: printInteger(o, literal.i32); break;
+    case Type::i64: printInteger(o, literal.i64); break;
     case Type::f32: literal.printFloat(o, literal.getf32()); break;
     case Type::f64: literal.printDouble(o, literal.getf64()); break;
     default: WASM_UNREACHABLE();
@@ -52,8 +52,11 @@ void WasmBinaryWriter::write() {
   writeExports();
   writeStart();
   writeTableElements();
+  flush();
   writeFunctions();
+  flush();
   writeDataSegments();
+  flush();
   if (debugInfo) writeNames();
   if (sourceMap && !sourceMapUrl.empty()) writeSourceMapUrl();
   if (symbolMap.size() > 0) writeSymbolMap();
@@ -65,6 +68,16 @@ void WasmBinaryWriter::write() {
   writeUserSections();
 
   finishUp();
+  flush();
+}
+
+void WasmBinaryWriter::flush() {
+  if (!output) return;
+  // there is nothing to backpatch in what we have written so far
+  assert(buffersToWrite.empty());
+  output->write((const char*)o.data(), o.size());
+  flushedBytes += o.size();
+  o.clear();
 }
 
 void WasmBinaryWriter::writeHeader() {
@@ -251,10 +264,15 @@ void WasmBinaryWriter::writeExpression(Expression* curr) {
   assert(depth == 0);
 }
 
+// when writing to a stream, function bodies are moved out of the buffer in
+// pieces of about this size
+static const size_t BODY_CHUNK_SIZE = 1024 * 1024;
+
 void WasmBinaryWriter::writeFunctions() {
   if (wasm->functions.size() == 0) return;
   if (debug) std::cerr << "== writeFunctions" << std::endl;
-  auto start = startSection(BinaryConsts::Section::Code);
+  auto sectionStart = startSection(BinaryConsts::Section::Code);
+  auto bodiesStart = o.size();
   size_t total = wasm->functions.size();
   o << U32LEB(total);
   for (size_t i = 0; i < total; i++) {
@@ -290,10 +308,34 @@ void WasmBinaryWriter::writeFunctions() {
       std::move(&o[start], &o[start] + size, &o[sizePos] + sizeFieldSize);
       o.resize(o.size() - (MaxLEB32Bytes - sizeFieldSize));
     }
-    tableOfContents.functionBodies.emplace_back(function->name, sizePos + sizeFieldSize, size);
+    tableOfContents.functionBodies.emplace_back(function->name, flushedBytes + pendingBodyBytes + sizePos + sizeFieldSize, size);
+    if (output && o.size() - bodiesStart >= BODY_CHUNK_SIZE) {
+      // move the bodies out, so the buffer does not need to grow to hold them
+      // all while we wait to know the size of the section
+      pendingBodies.emplace_back(o.begin() + bodiesStart, o.end());
+      pendingBodyBytes += o.size() - bodiesStart;
+      o.resize(bodiesStart);
+    }
   }
   currFunction = nullptr;
-  finishSection(start);
+  if (pendingBodies.empty()) {
+    finishSection(sectionStart);
+    return;
+  }
+  // we know the size now, so write out the section
+  size_t size = pendingBodyBytes + o.size() - bodiesStart;
+  BufferWithRandomAccess header;
+  header.insert(header.end(), o.begin(), o.begin() + sectionStart);
+  header << U32LEB(size);
+  output->write((const char*)header.data(), header.size());
+  for (auto& bodies : pendingBodies) {
+    output->write((const char*)bodies.data(), bodies.size());
+  }
+  output->write((const char*)o.data() + bodiesStart, o.size() - bodiesStart);
+  flushedBytes += header.size() + size;
+  pendingBodies.clear();
+  pendingBodyBytes = 0;
+  o.clear();
 }
 
 void WasmBinaryWriter::writeGlobals() {
@@ -1407,6 +1449,12 @@ uint16_t WasmBinaryBuilder::getInt16() {
 }
 
 uint32_t WasmBinaryBuilder::getInt32() {
+  if (!debug && input.size() - pos >= 4) {
+    auto* bytes = (const uint8_t*)&input[pos];
+    pos += 4;
+    return uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8) |
+           (uint32_t(bytes[2]) << 16) | (uint32_t(bytes[3]) << 24);
+  }
   if (debug) std::cerr << "<==" << std::endl;
   auto ret = uint32_t(getInt16());
   ret |= uint32_t(getInt16()) << 16;
@@ -1415,6 +1463,10 @@ uint32_t WasmBinaryBuilder::getInt32() {
 }
 
 uint64_t WasmBinaryBuilder::getInt64() {
+  if (!debug && input.size() - pos >= 8) {
+    auto low = getInt32();
+    return uint64_t(low) | (uint64_t(getInt32()) << 32);
+  }
   if (debug) std::cerr << "<==" << std::endl;
   auto ret = uint64_t(getInt32());
   ret |= uint64_t(getInt32()) << 32;
@@ -1438,44 +1490,63 @@ Literal WasmBinaryBuilder::getFloat64Literal() {
   return ret;
 }
 
-uint32_t WasmBinaryBuilder::getU32LEB() {
+// Reads a LEB. When the longest possible encoding fits in what is left of the
+// input, we skip checking for the end of it on each byte, and decode the most
+// common, one and two byte, encodings directly.
+template<typename T, typename MiniT>
+T WasmBinaryBuilder::getLEB() {
+  const size_t bits = sizeof(T) * 8;
+  const size_t maxBytes = (bits + 6) / 7;
+  if (!debug && input.size() - pos >= maxBytes) {
+    typedef typename std::make_unsigned<T>::type U;
+    auto* bytes = (const uint8_t*)&input[pos];
+    if (!(bytes[0] & 128)) {
+      pos++;
+      U value = bytes[0];
+      // sign-extend from the top of the 7 bits we read
+      return std::is_signed<T>::value ? T(value << (bits - 7)) >> (bits - 7) : T(value);
+    }
+    if (!(bytes[1] & 128)) {
+      pos += 2;
+      U value = U(bytes[0] & 127) | (U(bytes[1]) << 7);
+      return std::is_signed<T>::value ? T(value << (bits - 14)) >> (bits - 14) : T(value);
+    }
+    LEB<T, MiniT> ret;
+    ret.read([&]() {
+      return MiniT(input[pos++]);
+    });
+    return ret.value;
+  }
   if (debug) std::cerr << "<==" << std::endl;
-  U32LEB ret;
+  LEB<T, MiniT> ret;
   ret.read([&]() {
-      return getInt8();
-    });
-  if (debug) std::cerr << "getU32LEB: " << ret.value << " ==>" << std::endl;
+    return MiniT(getInt8());
+  });
   return ret.value;
 }
 
+uint32_t WasmBinaryBuilder::getU32LEB() {
+  auto ret = getLEB<uint32_t, uint8_t>();
+  if (debug) std::cerr << "getU32LEB: " << ret << " ==>" << std::endl;
+  return ret;
+}
+
 uint64_t WasmBinaryBuilder::getU64LEB() {
-  if (debug) std::cerr << "<==" << std::endl;
-  U64LEB ret;
-  ret.read([&]() {
-      return getInt8();
-    });
-  if (debug) std::cerr << "getU64LEB: " << ret.value << " ==>" << std::endl;
-  return ret.value;
+  auto ret = getLEB<uint64_t, uint8_t>();
+  if (debug) std::cerr << "getU64LEB: " << ret << " ==>" << std::endl;
+  return ret;
 }
 
 int32_t WasmBinaryBuilder::getS32LEB() {
-  if (debug) std::cerr << "<==" << std::endl;
-  S32LEB ret;
-  ret.read([&]() {
-      return (int8_t)getInt8();
-    });
-  if (debug) std::cerr << "getS32LEB: " << ret.value << " ==>" << std::endl;
-  return ret.value;
+  auto ret = getLEB<int32_t, int8_t>();
+  if (debug) std::cerr << "getS32LEB: " << ret << " ==>" << std::endl;
+  return ret;
 }
 
 int64_t WasmBinaryBuilder::getS64LEB() {
-  if (debug) std::cerr << "<==" << std::endl;
-  S64LEB ret;
-  ret.read([&]() {
-      return (int8_t)getInt8();
-    });
-  if (debug) std::cerr << "getS64LEB: " << ret.value << " ==>" << std::endl;
-  return ret.value;
+  auto ret = getLEB<int64_t, int8_t>();
+  if (debug) std::cerr << "getS64LEB: " << ret << " ==>" << std::endl;
+  return ret;
 }
 
 Type WasmBinaryBuilder::getType() {
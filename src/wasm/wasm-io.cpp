@@ -27,15 +27,15 @@
 #include "wasm-io.h"
 #include "wasm-s-parser.h"
 #include "wasm-binary.h"
+#include "wasm-snapshot.h"
 
 namespace wasm {
 
 void ModuleReader::readText(std::string filename, Module& wasm) {
   if (debug) std::cerr << "reading text from " << filename << "\n";
   auto input(read_file<std::string>(filename, Flags::Text, debug ? Flags::Debug : Flags::Release));
-  SExpressionParser parser(const_cast<char*>(input.c_str()));
-  Element& root = *parser.root;
-  SExpressionWasmBuilder builder(wasm, *root[0]);
+  SExpressionModuleParser parser(const_cast<char*>(input.c_str()));
+  SExpressionWasmBuilder builder(wasm, parser);
 }
 
 void ModuleReader::readBinary(std::string filename, Module& wasm,
@@ -55,6 +55,13 @@ void ModuleReader::readBinary(std::string filename, Module& wasm,
   }
 }
 
+void ModuleReader::readSnapshot(std::string filename, Module& wasm) {
+  if (debug) std::cerr << "reading snapshot from " << filename << "\n";
+  auto input(read_file<std::vector<char>>(filename, Flags::Binary, debug ? Flags::Debug : Flags::Release));
+  SnapshotReader reader(wasm, input);
+  reader.read();
+}
+
 bool ModuleReader::isBinaryFile(std::string filename) {
   std::ifstream infile;
   std::ios_base::openmode flags = std::ifstream::in | std::ifstream::binary;
@@ -65,9 +72,24 @@ bool ModuleReader::isBinaryFile(std::string filename) {
   return buffer[0] == '\0' && buffer[1] == 'a' && buffer[2] == 's' && buffer[3] == 'm';
 }
 
+bool ModuleReader::isSnapshotFile(std::string filename) {
+  std::ifstream infile;
+  std::ios_base::openmode flags = std::ifstream::in | std::ifstream::binary;
+  infile.open(filename, flags);
+  std::vector<char> buffer(4, 1);
+  infile.read(buffer.data(), 4);
+  infile.close();
+  return Snapshot::isSnapshot(buffer);
+}
+
 void ModuleReader::read(std::string filename, Module& wasm,
                         std::string sourceMapFilename) {
-  if (isBinaryFile(filename)) {
+  if (isSnapshotFile(filename)) {
+    if (sourceMapFilename.size()) {
+      std::cerr << "Binaryen ModuleReader::read() - source map filename provided, but file is a snapshot, which has its own debug info\n";
+    }
+    readSnapshot(filename, wasm);
+  } else if (isBinaryFile(filename)) {
     readBinary(filename, wasm, sourceMapFilename);
   } else {
     // default to text
@@ -100,6 +122,9 @@ void ModuleWriter::writeBinary(Module& wasm, Output& output) {
     writer.setSourceMap(sourceMapStream.get(), sourceMapUrl);
   }
   if (symbolMap.size() > 0) writer.setSymbolMap(symbolMap);
+  // write as we go, unless we are debugging, which logs where in the buffer
+  // things are written
+  if (!debug) writer.setOutput(&output.getStream());
   writer.write();
   buffer.writeTo(output);
   if (sourceMapStream) {
@@ -113,8 +138,23 @@ void ModuleWriter::writeBinary(Module& wasm, std::string filename) {
   writeBinary(wasm, output);
 }
 
+void ModuleWriter::writeSnapshot(Module& wasm, Output& output) {
+  BufferWithRandomAccess buffer(debug);
+  SnapshotWriter writer(&wasm, buffer);
+  writer.write();
+  output.getStream().write((const char*)buffer.data(), buffer.size());
+}
+
+void ModuleWriter::writeSnapshot(Module& wasm, std::string filename) {
+  if (debug) std::cerr << "writing snapshot to " << filename << "\n";
+  Output output(filename, Flags::Binary, debug ? Flags::Debug : Flags::Release);
+  writeSnapshot(wasm, output);
+}
+
 void ModuleWriter::write(Module& wasm, Output& output) {
-  if (binary) {
+  if (snapshot) {
+    writeSnapshot(wasm, output);
+  } else if (binary) {
     writeBinary(wasm, output);
   } else {
     writeText(wasm, output);
@@ -122,7 +162,9 @@ void ModuleWriter::write(Module& wasm, Output& output) {
 }
 
 void ModuleWriter::write(Module& wasm, std::string filename) {
-  if (binary && filename.size() > 0) {
+  if (snapshot) {
+    writeSnapshot(wasm, filename);
+  } else if (binary && filename.size() > 0) {
     writeBinary(wasm, filename);
   } else {
     writeText(wasm, filename);
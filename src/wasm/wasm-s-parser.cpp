@@ -26,6 +26,7 @@
 #include "shared-constants.h"
 #include "wasm-binary.h"
 #include "wasm-builder.h"
+#include "support/threads.h"
 
 #define abort_on(str) { throw ParseException(std::string("abort_on ") + str); }
 #define element_assert(condition) assert((condition) ? true : (std::cerr << "on: " << *this << '\n' && 0));
@@ -64,10 +65,18 @@ Element* Element::operator[](unsigned i) {
 
 IString Element::str() const {
   if (!isStr()) throw ParseException("expected string", line, col);
+  if (!interned_) {
+    str_ = IString(str_.str, false);
+    interned_ = true;
+  }
   return str_;
 }
 
 const char* Element::c_str() const {
+  return str().str;
+}
+
+const char* Element::text() const {
   if (!isStr()) throw ParseException("expected string", line, col);
   return str_.str;
 }
@@ -75,6 +84,16 @@ const char* Element::c_str() const {
 Element* Element::setString(IString str__, bool dollared__, bool quoted__) {
   isList_ = false;
   str_ = str__;
+  interned_ = true;
+  dollared_ = dollared__;
+  quoted_ = quoted__;
+  return this;
+}
+
+Element* Element::setText(const char* text, bool dollared__, bool quoted__) {
+  isList_ = false;
+  str_.str = text;
+  interned_ = false;
   dollared_ = dollared__;
   quoted_ = quoted__;
   return this;
@@ -103,7 +122,7 @@ void Element::dump() {
 }
 
 
-SExpressionParser::SExpressionParser(char* input) : input(input), loc(nullptr) {
+SExpressionParser::SExpressionParser(char* input) : input(input), loc(nullptr), elementAllocator(&allocator) {
   root = nullptr;
   line = 1;
   lineStart = input;
@@ -112,17 +131,32 @@ SExpressionParser::SExpressionParser(char* input) : input(input), loc(nullptr) {
   }
 }
 
-Element* SExpressionParser::parse() {
+SExpressionParser::SExpressionParser(char* input, MixedArena* elementAllocator) : input(input), loc(nullptr), elementAllocator(elementAllocator) {
+  root = nullptr;
+  line = 1;
+  lineStart = input;
+}
+
+// Parses all the input, or if single, just the next list or string.
+Element* SExpressionParser::parse(bool single) {
   std::vector<Element *> stack;
   std::vector<SourceLocation*> stackLocs;
-  Element *curr = allocator.alloc<Element>();
+  Element *curr = elementAllocator->alloc<Element>();
   while (1) {
     skipWhitespace();
     if (input[0] == 0) break;
     if (input[0] == '(') {
+      if (maxDepth && stack.size() >= maxDepth) {
+        // leave this list empty
+        curr->list().push_back(elementAllocator->alloc<Element>()->setMetadata(line, input - lineStart, loc));
+        auto* before = loc;
+        skipList();
+        loc = before;
+        continue;
+      }
       input++;
       stack.push_back(curr);
-      curr = allocator.alloc<Element>()->setMetadata(line, input - lineStart - 1, loc);
+      curr = elementAllocator->alloc<Element>()->setMetadata(line, input - lineStart - 1, loc);
       stackLocs.push_back(loc);
       assert(stack.size() == stackLocs.size());
     } else if (input[0] == ')') {
@@ -140,11 +174,50 @@ Element* SExpressionParser::parse() {
     } else {
       curr->list().push_back(parseString());
     }
+    if (single && stack.empty()) {
+      return curr->list()[0];
+    }
   }
   if (stack.size() != 0) throw ParseException("stack is not empty", curr->line, curr->col);
+  if (single) throw ParseException("expected list or string", line, input - lineStart);
   return curr;
 }
 
+// Skips the list we are at, without allocating any elements for it.
+void SExpressionParser::skipList() {
+  assert(input[0] == '(');
+  input++;
+  size_t depth = 1;
+  while (depth > 0) {
+    skipWhitespace();
+    if (input[0] == 0) throw ParseException("unterminated list", line, input - lineStart);
+    if (input[0] == '(') {
+      input++;
+      depth++;
+      continue;
+    }
+    if (input[0] == ')') {
+      input++;
+      depth--;
+      continue;
+    }
+    if (input[0] == '$') input++;
+    if (input[0] == '"') {
+      input++;
+      while (input[0] != '"') {
+        if (input[0] == 0) throw ParseException("unterminated string", line, input - lineStart);
+        if (input[0] == '\\' && input[1] != 0) input++;
+        input++;
+      }
+      input++;
+      continue;
+    }
+    char* start = input;
+    while (input[0] && !isspace(input[0]) && input[0] != ')' && input[0] != '(' && input[0] != ';') input++;
+    if (start == input) throw ParseException("expected string", line, input - lineStart);
+  }
+}
+
 void SExpressionParser::parseDebugLocation() {
   // Extracting debug location (if valid)
   char* debugLoc = input + 3; // skipping ";;@"
@@ -164,7 +237,9 @@ void SExpressionParser::parseDebugLocation() {
     return; // no column number
   }
   std::string colStr(++pos, debugLocEnd);
-  void* buf = allocator.allocSpace(sizeof(SourceLocation));
+  sawDebugLocation = true;
+  // locations live as long as the elements that refer to them
+  void* buf = elementAllocator->allocSpace(sizeof(SourceLocation));
   loc = new (buf) SourceLocation(IString(name.c_str(), false), atoi(lineStr.c_str()), atoi(colStr.c_str()));
 }
 
@@ -240,17 +315,62 @@ Element* SExpressionParser::parseString() {
       input++;
     }
     input++;
-    return allocator.alloc<Element>()->setString(IString(str.c_str(), false), dollared, true)->setMetadata(line, start - lineStart, loc);
+    return elementAllocator->alloc<Element>()->setText(copyText(str.c_str(), str.size()), dollared, true)->setMetadata(line, start - lineStart, loc);
   }
   while (input[0] && !isspace(input[0]) && input[0] != ')' && input[0] != '(' && input[0] != ';') input++;
   if (start == input) throw ParseException("expected string", line, input - lineStart);
-  char temp = input[0];
-  input[0] = 0;
-  auto ret = allocator.alloc<Element>()->setString(IString(start, false), dollared, false)->setMetadata(line, start - lineStart, loc);
-  input[0] = temp;
+  return elementAllocator->alloc<Element>()->setText(copyText(start, input - start), dollared, false)->setMetadata(line, start - lineStart, loc);
+}
+
+char* SExpressionParser::copyText(const char* text, size_t size) {
+  auto* ret = static_cast<char*>(elementAllocator->allocSpace(size + 1));
+  memcpy(ret, text, size);
+  ret[size] = 0;
   return ret;
 }
 
+SExpressionModuleParser::SExpressionModuleParser(char* input) : parser(input, nullptr) {
+  // the module header is small, and the debug locations between fields
+  // must outlive the scan, so allocate them in the parser's own arena
+  parser.elementAllocator = &parser.allocator;
+  parser.skipWhitespace();
+  if (parser.input[0] != '(') throw ParseException("expected module", parser.line, parser.input - parser.lineStart);
+  parser.input++;
+  parser.skipWhitespace();
+  if (parser.parseString()->str() != MODULE) throw ParseException("toplevel does not start with module", parser.line, parser.input - parser.lineStart);
+  parser.skipWhitespace();
+  if (parser.input[0] == '$') {
+    name = parser.parseString()->str();
+  }
+  while (1) {
+    parser.skipWhitespace();
+    if (parser.input[0] == 0) throw ParseException("unterminated module", parser.line, parser.input - parser.lineStart);
+    if (parser.input[0] == ')') break;
+    Field field = { parser.input, parser.line, parser.lineStart, parser.loc, false };
+    if (parser.input[0] == '(') {
+      // note functions, which are the only fields we parse shallowly
+      const char* id = parser.input + 1;
+      field.isFunction = strncmp(id, "func", 4) == 0 && (isspace(id[4]) || id[4] == '(' || id[4] == ')');
+      parser.skipList();
+      // debug locations inside the field do not apply outside of it
+      parser.loc = field.loc;
+    } else {
+      parser.parseString();
+    }
+    fields.push_back(field);
+  }
+}
+
+Element* SExpressionModuleParser::parseField(size_t i, MixedArena& arena, bool shallow) {
+  auto& field = fields[i];
+  SExpressionParser fieldParser(field.start, &arena);
+  fieldParser.line = field.line;
+  fieldParser.lineStart = field.lineStart;
+  fieldParser.loc = field.loc;
+  fieldParser.maxDepth = shallow && field.isFunction ? 2 : 0;
+  return fieldParser.parse(true);
+}
+
 SExpressionWasmBuilder::SExpressionWasmBuilder(Module& wasm, Element& module, Name* moduleName) : wasm(wasm), allocator(wasm.allocator), globalCounter(0) {
   if (module.size() == 0) throw ParseException("empty toplevel, expected module");
   if (module[0]->str() != MODULE) throw ParseException("toplevel does not start with module");
@@ -286,11 +406,167 @@ SExpressionWasmBuilder::SExpressionWasmBuilder(Module& wasm, Element& module, Na
     }
   }
   functionCounter -= implementedFunctions; // we go through the functions again, now parsing them, and the counter begins from where imports ended
+  // as in the streaming parser, function bodies are parsed after all other
+  // fields, so they may refer to anything declared in the module
+  std::vector<std::pair<Element*, Name>> funcs;
   for (unsigned j = i; j < module.size(); j++) {
-    parseModuleElement(*module[j]);
+    auto& s = *module[j];
+    if (s[0]->str() == FUNC && !isImport(s)) {
+      funcs.emplace_back(&s, parseFunctionHeader(s, false));
+    } else {
+      parseModuleElement(s);
+    }
+  }
+  for (auto& pair : funcs) {
+    auto& s = *pair.first;
+    addFunction(parseFunctionBody(s, pair.second, false), s.line, s.col);
   }
 }
 
+SExpressionWasmBuilder::SExpressionWasmBuilder(Module& wasm, SExpressionModuleParser& module, Name* moduleName) : wasm(wasm), allocator(wasm.allocator), globalCounter(0) {
+  if (moduleName && module.name.is()) {
+    *moduleName = module.name;
+  }
+  auto numFields = module.getNumFields();
+  if (numFields == 0) return;
+  // each field's elements are freed once we are done with that field
+  MixedArena arena;
+  if (module.parseField(0, arena)->isStr()) {
+    // these s-expressions contain a binary module, actually
+    std::vector<char> data;
+    for (size_t j = 0; j < numFields; j++) {
+      auto str = module.parseField(j, arena)->c_str();
+      if (auto size = strlen(str)) {
+        stringToBinary(str, size, data);
+      }
+    }
+    WasmBinaryBuilder binaryBuilder(wasm, data, false);
+    binaryBuilder.read();
+    return;
+  }
+  arena.clear();
+  Index implementedFunctions = 0;
+  functionCounter = 0;
+  for (size_t j = 0; j < numFields; j++) {
+    auto& s = *module.parseField(j, arena, true /* shallow */);
+    preParseFunctionType(s);
+    preParseImports(s);
+    if (s[0]->str() == FUNC && !isImport(s)) {
+      implementedFunctions++;
+    }
+    arena.clear();
+  }
+  functionCounter -= implementedFunctions; // we go through the functions again, now parsing them, and the counter begins from where imports ended
+  // Debug locations add file names to the module as they are seen, so to
+  // keep them in the same order we parse serially if there are any.
+  bool parallel = implementedFunctions > 1 && !module.hasDebugLocations() &&
+                  ThreadPool::get()->size() > 1 && !ThreadPool::get()->isRunning();
+  parseFieldsThenFunctions(module, parallel);
+}
+
+SExpressionWasmBuilder::SExpressionWasmBuilder(SExpressionWasmBuilder& parent) :
+  wasm(parent.wasm),
+  allocator(parent.allocator),
+  functionNames(parent.functionNames),
+  functionTypeNames(parent.functionTypeNames),
+  globalNames(parent.globalNames),
+  functionCounter(parent.functionCounter),
+  globalCounter(parent.globalCounter),
+  functionTypes(parent.functionTypes) {}
+
+// Function bodies only depend on module-level declarations, so we first
+// parse everything else, in order, and then the bodies, in parallel if
+// asked to. Either way the result is the same: the functions are added to
+// the module in order, and if there were errors, we report the first one
+// in that order.
+void SExpressionWasmBuilder::parseFieldsThenFunctions(SExpressionModuleParser& module, bool parallel) {
+  struct Job {
+    size_t field;
+    Name name;
+    size_t line, col;
+    std::unique_ptr<Function> func;
+    std::exception_ptr error;
+  };
+  std::vector<Job> jobs;
+  std::exception_ptr error;
+  MixedArena arena;
+  for (size_t j = 0; j < module.getNumFields(); j++) {
+    try {
+      // this parse is shallow only for functions, for which we just need the header
+      auto& s = *module.parseField(j, arena, true /* shallow */);
+      if (module.isFunction(j) && !isImport(s)) {
+        jobs.push_back({ j, parseFunctionHeader(s, false), s.line, s.col, nullptr, nullptr });
+      } else {
+        parseModuleElement(s);
+      }
+    } catch (...) {
+      // functions after this are not parsed, like in a serial parse
+      error = std::current_exception();
+      break;
+    }
+    arena.clear();
+  }
+  if (!parallel) {
+    for (auto& job : jobs) {
+      addFunction(parseFunctionBody(*module.parseField(job.field, arena), job.name, false), job.line, job.col);
+      arena.clear();
+    }
+    if (error) std::rethrow_exception(error);
+    return;
+  }
+  // parse the bodies
+  size_t num = ThreadPool::get()->size();
+  std::vector<std::function<ThreadWorkState ()>> doWorkers;
+  std::vector<std::unique_ptr<SExpressionWasmBuilder>> builders;
+  std::vector<std::unique_ptr<MixedArena>> arenas;
+  std::atomic<size_t> nextJob;
+  nextJob.store(0);
+  size_t numJobs = jobs.size();
+  for (size_t i = 0; i < num; i++) {
+    builders.emplace_back(new SExpressionWasmBuilder(*this));
+  }
+  // each worker's arena is created on its own thread, so that clearing it
+  // frees all the memory for the elements of the last function
+  arenas.resize(num);
+  for (size_t i = 0; i < num; i++) {
+    doWorkers.push_back([&, i]() {
+      auto index = nextJob.fetch_add(1);
+      // get the next task, if there is one
+      if (index >= numJobs) {
+        return ThreadWorkState::Finished; // nothing left
+      }
+      auto& job = jobs[index];
+      auto& builder = *builders[i];
+      if (!arenas[i]) {
+        arenas[i] = make_unique<MixedArena>();
+      }
+      auto& arena = *arenas[i];
+      try {
+        job.func = builder.parseFunctionBody(*module.parseField(job.field, arena), job.name, false);
+      } catch (...) {
+        job.error = std::current_exception();
+        // reset the state from the failed function
+        builder.currFunction.reset();
+        builder.currLocalTypes.clear();
+        builder.nameMapper.clear();
+      }
+      arena.clear();
+      if (index + 1 == numJobs) {
+        return ThreadWorkState::Finished; // we did the last one
+      }
+      return ThreadWorkState::More;
+    });
+  }
+  if (numJobs > 0) {
+    ThreadPool::get()->work(doWorkers);
+  }
+  for (auto& job : jobs) {
+    if (job.error) std::rethrow_exception(job.error);
+    addFunction(std::move(job.func), job.line, job.col);
+  }
+  if (error) std::rethrow_exception(error);
+}
+
 bool SExpressionWasmBuilder::isImport(Element& curr) {
   for (Index i = 0; i < curr.size(); i++) {
     auto& x = *curr[i];
@@ -454,9 +730,15 @@ size_t SExpressionWasmBuilder::parseFunctionNames(Element& s, Name& name, Name&
 }
 
 void SExpressionWasmBuilder::parseFunction(Element& s, bool preParseImport) {
-  size_t i = 1;
+  auto name = parseFunctionHeader(s, preParseImport);
+  if (auto func = parseFunctionBody(s, name, preParseImport)) {
+    addFunction(std::move(func), s.line, s.col);
+  }
+}
+
+Name SExpressionWasmBuilder::parseFunctionHeader(Element& s, bool preParseImport) {
   Name name, exportName;
-  i = parseFunctionNames(s, name, exportName);
+  parseFunctionNames(s, name, exportName);
   if (!preParseImport) {
     if (!name.is()) {
       // unnamed, use an index
@@ -478,6 +760,12 @@ void SExpressionWasmBuilder::parseFunction(Element& s, bool preParseImport) {
     if (wasm.getExportOrNull(ex->name)) throw ParseException("duplicate export", s.line, s.col);
     wasm.addExport(ex.release());
   }
+  return name;
+}
+
+std::unique_ptr<Function> SExpressionWasmBuilder::parseFunctionBody(Element& s, Name name, bool preParseImport) {
+  Name ignoredName, ignoredExportName;
+  size_t i = parseFunctionNames(s, ignoredName, ignoredExportName);
   Expression* body = nullptr;
   localIndex = 0;
   otherIndex = 0;
@@ -591,7 +879,7 @@ void SExpressionWasmBuilder::parseFunction(Element& s, bool preParseImport) {
     if (currFunction) throw ParseException("import module inside function dec");
     currLocalTypes.clear();
     nameMapper.clear();
-    return;
+    return nullptr;
   }
   if (preParseImport) throw ParseException("preParseImport in func");
   if (brokeToAutoBlock) {
@@ -608,10 +896,14 @@ void SExpressionWasmBuilder::parseFunction(Element& s, bool preParseImport) {
   if (currFunction->result != result) throw ParseException("bad func declaration", s.line, s.col);
   currFunction->body = body;
   currFunction->type = type;
-  if (wasm.getFunctionOrNull(currFunction->name)) throw ParseException("duplicate function", s.line, s.col);
-  wasm.addFunction(currFunction.release());
   currLocalTypes.clear();
   nameMapper.clear();
+  return std::move(currFunction);
+}
+
+void SExpressionWasmBuilder::addFunction(std::unique_ptr<Function> func, size_t line, size_t col) {
+  if (wasm.getFunctionOrNull(func->name)) throw ParseException("duplicate function", line, col);
+  wasm.addFunction(func.release());
 }
 
 Type SExpressionWasmBuilder::stringToType(const char* str, bool allowError, bool prefix) {
@@ -1133,7 +1425,7 @@ Expression* SExpressionWasmBuilder::makeThenOrElse(Element& s) {
 }
 
 Expression* SExpressionWasmBuilder::makeConst(Element& s, Type type) {
-  auto ret = parseConst(s[1]->str(), type, allocator);
+  auto ret = parseConst(s[1]->text(), type, allocator);
   if (!ret) throw ParseException("bad const");
   return ret;
 }
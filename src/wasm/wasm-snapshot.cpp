@@ -0,0 +1,789 @@
+/*
+ * Copyright 2018 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+
+#include "wasm-snapshot.h"
+
+//
+// The layout of a snapshot is
+//
+//   magic, version            (int32s)
+//   strings                   (count, then each as length and bytes)
+//   module contents           (see SnapshotWriter::write)
+//
+// All integers other than the header are LEBs, and names are indexes into
+// the strings, plus one, with 0 meaning a null name.
+//
+// Expressions are written in post-order, each node as its id and type
+// followed by its immediates, so that a reader can build the tree with a
+// stack and no recursion. A node's children are the last nodes on the
+// stack when it is read, in the order they are executed; the number of
+// children is known from the id and, for lists and optional children,
+// from the immediates.
+//
+
+namespace wasm {
+
+namespace Snapshot {
+
+bool isSnapshot(const std::vector<char>& input) {
+  return input.size() >= 4 && input[0] == '\0' && input[1] == 'b' && input[2] == 'i' && input[3] == 'r';
+}
+
+} // namespace Snapshot
+
+// Writing
+
+void SnapshotWriter::writeName(BufferWithRandomAccess& buffer, Name name) {
+  if (!name.is()) {
+    buffer << U32LEB(0);
+    return;
+  }
+  auto iter = stringIndexes.find(name);
+  if (iter != stringIndexes.end()) {
+    buffer << U32LEB(iter->second + 1);
+    return;
+  }
+  Index index = strings.size();
+  strings.push_back(name);
+  stringIndexes[name] = index;
+  buffer << U32LEB(index + 1);
+}
+
+void SnapshotWriter::writeExpression(BufferWithRandomAccess& buffer, Expression* curr, Function* func) {
+  struct NodeWriter : public PostWalker<NodeWriter, UnifiedExpressionVisitor<NodeWriter>> {
+    SnapshotWriter* parent;
+    BufferWithRandomAccess& o;
+    Function* func;
+    Index count = 0;
+    // the nodes with debug locations, by their index in the post-order
+    std::vector<std::pair<Index, Function::DebugLocation>> locations;
+
+    NodeWriter(SnapshotWriter* parent, BufferWithRandomAccess& o, Function* func) : parent(parent), o(o), func(func) {}
+
+    void writeName(Name name) {
+      parent->writeName(o, name);
+    }
+
+    void visitExpression(Expression* curr) {
+      if (func && !func->debugLocations.empty()) {
+        auto iter = func->debugLocations.find(curr);
+        if (iter != func->debugLocations.end()) {
+          locations.emplace_back(count, iter->second);
+        }
+      }
+      count++;
+      o << U32LEB(curr->_id) << int8_t(curr->type);
+      switch (curr->_id) {
+        case Expression::Id::BlockId: {
+          auto* block = curr->cast<Block>();
+          writeName(block->name);
+          o << U32LEB(block->list.size());
+          break;
+        }
+        case Expression::Id::IfId: {
+          o << int8_t(curr->cast<If>()->ifFalse != nullptr);
+          break;
+        }
+        case Expression::Id::LoopId: {
+          writeName(curr->cast<Loop>()->name);
+          break;
+        }
+        case Expression::Id::BreakId: {
+          auto* br = curr->cast<Break>();
+          writeName(br->name);
+          o << int8_t((br->value ? 1 : 0) | (br->condition ? 2 : 0));
+          break;
+        }
+        case Expression::Id::SwitchId: {
+          auto* sw = curr->cast<Switch>();
+          o << U32LEB(sw->targets.size());
+          for (auto target : sw->targets) {
+            writeName(target);
+          }
+          writeName(sw->default_);
+          o << int8_t(sw->value != nullptr);
+          break;
+        }
+        case Expression::Id::CallId: {
+          auto* call = curr->cast<Call>();
+          writeName(call->target);
+          o << U32LEB(call->operands.size());
+          break;
+        }
+        case Expression::Id::CallImportId: {
+          auto* call = curr->cast<CallImport>();
+          writeName(call->target);
+          o << U32LEB(call->operands.size());
+          break;
+        }
+        case Expression::Id::CallIndirectId: {
+          auto* call = curr->cast<CallIndirect>();
+          writeName(call->fullType);
+          o << U32LEB(call->operands.size());
+          break;
+        }
+        case Expression::Id::GetLocalId: {
+          o << U32LEB(curr->cast<GetLocal>()->index);
+          break;
+        }
+        case Expression::Id::SetLocalId: {
+          o << U32LEB(curr->cast<SetLocal>()->index);
+          break;
+        }
+        case Expression::Id::GetGlobalId: {
+          writeName(curr->cast<GetGlobal>()->name);
+          break;
+        }
+        case Expression::Id::SetGlobalId: {
+          writeName(curr->cast<SetGlobal>()->name);
+          break;
+        }
+        case Expression::Id::LoadId: {
+          auto* load = curr->cast<Load>();
+          o << int8_t(load->bytes) << int8_t(load->signed_) << int8_t(load->isAtomic);
+          o << U32LEB(load->offset) << U32LEB(load->align);
+          break;
+        }
+        case Expression::Id::StoreId: {
+          auto* store = curr->cast<Store>();
+          o << int8_t(store->bytes) << int8_t(store->isAtomic) << int8_t(store->valueType);
+          o << U32LEB(store->offset) << U32LEB(store->align);
+          break;
+        }
+        case Expression::Id::AtomicRMWId: {
+          auto* rmw = curr->cast<AtomicRMW>();
+          o << U32LEB(rmw->op) << int8_t(rmw->bytes) << U32LEB(rmw->offset);
+          break;
+        }
+        case Expression::Id::AtomicCmpxchgId: {
+          auto* cmpxchg = curr->cast<AtomicCmpxchg>();
+          o << int8_t(cmpxchg->bytes) << U32LEB(cmpxchg->offset);
+          break;
+        }
+        case Expression::Id::AtomicWaitId: {
+          auto* wait = curr->cast<AtomicWait>();
+          o << int8_t(wait->expectedType) << U32LEB(wait->offset);
+          break;
+        }
+        case Expression::Id::AtomicWakeId: {
+          o << U32LEB(curr->cast<AtomicWake>()->offset);
+          break;
+        }
+        case Expression::Id::ConstId: {
+          auto& value = curr->cast<Const>()->value;
+          o << int8_t(value.type) << U64LEB(value.getBits());
+          break;
+        }
+        case Expression::Id::UnaryId: {
+          o << U32LEB(curr->cast<Unary>()->op);
+          break;
+        }
+        case Expression::Id::BinaryId: {
+          o << U32LEB(curr->cast<Binary>()->op);
+          break;
+        }
+        case Expression::Id::ReturnId: {
+          o << int8_t(curr->cast<Return>()->value != nullptr);
+          break;
+        }
+        case Expression::Id::HostId: {
+          auto* host = curr->cast<Host>();
+          o << U32LEB(host->op);
+          writeName(host->nameOperand);
+          o << U32LEB(host->operands.size());
+          break;
+        }
+        case Expression::Id::SelectId:
+        case Expression::Id::DropId:
+        case Expression::Id::NopId:
+        case Expression::Id::UnreachableId: break;
+        default: WASM_UNREACHABLE();
+      }
+    }
+  };
+
+  // the number of nodes comes first, so we buffer them
+  BufferWithRandomAccess nodes(false);
+  NodeWriter writer(this, nodes, func);
+  writer.walk(curr);
+  buffer << U32LEB(writer.count);
+  buffer.insert(buffer.end(), nodes.begin(), nodes.end());
+  if (func) {
+    buffer << U32LEB(writer.locations.size());
+    for (auto& pair : writer.locations) {
+      auto& loc = pair.second;
+      buffer << U32LEB(pair.first) << U32LEB(loc.fileIndex) << U32LEB(loc.lineNumber) << U32LEB(loc.columnNumber);
+    }
+  }
+}
+
+void SnapshotWriter::writeFunction(BufferWithRandomAccess& buffer, Function* func) {
+  writeName(buffer, func->name);
+  writeName(buffer, func->type);
+  buffer << int8_t(func->result);
+  buffer << U32LEB(func->params.size());
+  for (auto type : func->params) {
+    buffer << int8_t(type);
+  }
+  buffer << U32LEB(func->vars.size());
+  for (auto type : func->vars) {
+    buffer << int8_t(type);
+  }
+  buffer << U32LEB(func->localNames.size());
+  for (auto& pair : func->localNames) {
+    buffer << U32LEB(pair.first);
+    writeName(buffer, pair.second);
+  }
+  writeExpression(buffer, func->body, func);
+}
+
+void SnapshotWriter::write() {
+  BufferWithRandomAccess buffer(false);
+  buffer << U32LEB(wasm->functionTypes.size());
+  for (auto& type : wasm->functionTypes) {
+    writeName(buffer, type->name);
+    buffer << int8_t(type->result);
+    buffer << U32LEB(type->params.size());
+    for (auto param : type->params) {
+      buffer << int8_t(param);
+    }
+  }
+  buffer << U32LEB(wasm->imports.size());
+  for (auto& import : wasm->imports) {
+    writeName(buffer, import->name);
+    writeName(buffer, import->module);
+    writeName(buffer, import->base);
+    buffer << int8_t(import->kind);
+    writeName(buffer, import->functionType);
+    buffer << int8_t(import->globalType);
+  }
+  buffer << U32LEB(wasm->exports.size());
+  for (auto& ex : wasm->exports) {
+    writeName(buffer, ex->name);
+    writeName(buffer, ex->value);
+    buffer << int8_t(ex->kind);
+  }
+  buffer << U32LEB(wasm->globals.size());
+  for (auto& global : wasm->globals) {
+    writeName(buffer, global->name);
+    buffer << int8_t(global->type) << int8_t(global->mutable_);
+    writeExpression(buffer, global->init);
+  }
+  auto& table = wasm->table;
+  buffer << int8_t(table.exists) << int8_t(table.imported);
+  writeName(buffer, table.name);
+  buffer << U32LEB(table.initial) << U32LEB(table.max);
+  buffer << U32LEB(table.segments.size());
+  for (auto& segment : table.segments) {
+    writeExpression(buffer, segment.offset);
+    buffer << U32LEB(segment.data.size());
+    for (auto name : segment.data) {
+      writeName(buffer, name);
+    }
+  }
+  auto& memory = wasm->memory;
+  buffer << int8_t(memory.exists) << int8_t(memory.imported) << int8_t(memory.shared);
+  writeName(buffer, memory.name);
+  buffer << U32LEB(memory.initial) << U32LEB(memory.max);
+  buffer << U32LEB(memory.segments.size());
+  for (auto& segment : memory.segments) {
+    writeExpression(buffer, segment.offset);
+    buffer << U32LEB(segment.data.size());
+    buffer.insert(buffer.end(), segment.data.begin(), segment.data.end());
+  }
+  writeName(buffer, wasm->start);
+  buffer << U32LEB(wasm->userSections.size());
+  for (auto& section : wasm->userSections) {
+    buffer << U32LEB(section.name.size());
+    buffer.insert(buffer.end(), section.name.begin(), section.name.end());
+    buffer << U32LEB(section.data.size());
+    buffer.insert(buffer.end(), section.data.begin(), section.data.end());
+  }
+  buffer << U32LEB(wasm->debugInfoFileNames.size());
+  for (auto& fileName : wasm->debugInfoFileNames) {
+    buffer << U32LEB(fileName.size());
+    buffer.insert(buffer.end(), fileName.begin(), fileName.end());
+  }
+  buffer << U32LEB(wasm->functions.size());
+  for (auto& func : wasm->functions) {
+    writeFunction(buffer, func.get());
+  }
+  // now that we know all the strings, emit everything
+  o << int32_t(Snapshot::Magic) << int32_t(Snapshot::Version);
+  o << U32LEB(strings.size());
+  for (auto name : strings) {
+    auto size = strlen(name.str);
+    o << U32LEB(size);
+    o.insert(o.end(), name.str, name.str + size);
+  }
+  o.insert(o.end(), buffer.begin(), buffer.end());
+}
+
+// Reading
+
+uint8_t SnapshotReader::getInt8() {
+  if (pos >= input.size()) throw ParseException("unexpected end of snapshot");
+  return uint8_t(input[pos++]);
+}
+
+uint32_t SnapshotReader::getInt32() {
+  uint32_t ret = 0;
+  for (int i = 0; i < 4; i++) {
+    ret |= uint32_t(getInt8()) << (8 * i);
+  }
+  return ret;
+}
+
+uint64_t SnapshotReader::getU64LEB() {
+  uint64_t ret = 0;
+  int shift = 0;
+  while (1) {
+    auto byte = getInt8();
+    if (shift >= 64) throw ParseException("bad LEB in snapshot");
+    ret |= uint64_t(byte & 127) << shift;
+    if (!(byte & 128)) break;
+    shift += 7;
+  }
+  return ret;
+}
+
+uint32_t SnapshotReader::getU32LEB() {
+  auto ret = getU64LEB();
+  if (ret > std::numeric_limits<uint32_t>::max()) throw ParseException("bad LEB in snapshot");
+  return uint32_t(ret);
+}
+
+Name SnapshotReader::getName() {
+  auto index = getU32LEB();
+  if (index == 0) return Name();
+  if (index > strings.size()) throw ParseException("bad string index in snapshot");
+  return strings[index - 1];
+}
+
+Type SnapshotReader::getType() {
+  auto type = getInt8();
+  if (type > unreachable) throw ParseException("bad type in snapshot");
+  return Type(type);
+}
+
+Expression* SnapshotReader::pop() {
+  if (stack.empty()) throw ParseException("bad expression in snapshot");
+  auto* ret = stack.back();
+  stack.pop_back();
+  return ret;
+}
+
+void SnapshotReader::popList(ExpressionList& list, Index num) {
+  if (stack.size() < num) throw ParseException("bad expression in snapshot");
+  list.resize(num);
+  auto start = stack.size() - num;
+  for (Index i = 0; i < num; i++) {
+    list[i] = stack[start + i];
+  }
+  stack.resize(start);
+}
+
+Expression* SnapshotReader::getExpression(Function* func) {
+  auto& allocator = wasm.allocator;
+  auto num = getU32LEB();
+  std::vector<Expression*> nodes;
+  if (func) nodes.reserve(num);
+  auto base = stack.size();
+  for (Index i = 0; i < num; i++) {
+    auto id = getU32LEB();
+    auto type = getType();
+    Expression* curr;
+    switch (id) {
+      case Expression::Id::BlockId: {
+        auto* block = allocator.alloc<Block>();
+        block->name = getName();
+        popList(block->list, getU32LEB());
+        curr = block;
+        break;
+      }
+      case Expression::Id::IfId: {
+        auto* iff = allocator.alloc<If>();
+        if (getInt8()) iff->ifFalse = pop();
+        iff->ifTrue = pop();
+        iff->condition = pop();
+        curr = iff;
+        break;
+      }
+      case Expression::Id::LoopId: {
+        auto* loop = allocator.alloc<Loop>();
+        loop->name = getName();
+        loop->body = pop();
+        curr = loop;
+        break;
+      }
+      case Expression::Id::BreakId: {
+        auto* br = allocator.alloc<Break>();
+        br->name = getName();
+        auto flags = getInt8();
+        if (flags & 2) br->condition = pop();
+        if (flags & 1) br->value = pop();
+        curr = br;
+        break;
+      }
+      case Expression::Id::SwitchId: {
+        auto* sw = allocator.alloc<Switch>();
+        auto numTargets = getU32LEB();
+        for (Index j = 0; j < numTargets; j++) {
+          sw->targets.push_back(getName());
+        }
+        sw->default_ = getName();
+        auto hasValue = getInt8();
+        sw->condition = pop();
+        sw->value = hasValue ? pop() : nullptr;
+        curr = sw;
+        break;
+      }
+      case Expression::Id::CallId: {
+        auto* call = allocator.alloc<Call>();
+        call->target = getName();
+        popList(call->operands, getU32LEB());
+        curr = call;
+        break;
+      }
+      case Expression::Id::CallImportId: {
+        auto* call = allocator.alloc<CallImport>();
+        call->target = getName();
+        popList(call->operands, getU32LEB());
+        curr = call;
+        break;
+      }
+      case Expression::Id::CallIndirectId: {
+        auto* call = allocator.alloc<CallIndirect>();
+        call->fullType = getName();
+        auto numOperands = getU32LEB();
+        call->target = pop();
+        popList(call->operands, numOperands);
+        curr = call;
+        break;
+      }
+      case Expression::Id::GetLocalId: {
+        auto* get = allocator.alloc<GetLocal>();
+        get->index = getU32LEB();
+        curr = get;
+        break;
+      }
+      case Expression::Id::SetLocalId: {
+        auto* set = allocator.alloc<SetLocal>();
+        set->index = getU32LEB();
+        set->value = pop();
+        curr = set;
+        break;
+      }
+      case Expression::Id::GetGlobalId: {
+        auto* get = allocator.alloc<GetGlobal>();
+        get->name = getName();
+        curr = get;
+        break;
+      }
+      case Expression::Id::SetGlobalId: {
+        auto* set = allocator.alloc<SetGlobal>();
+        set->name = getName();
+        set->value = pop();
+        curr = set;
+        break;
+      }
+      case Expression::Id::LoadId: {
+        auto* load = allocator.alloc<Load>();
+        load->bytes = getInt8();
+        load->signed_ = getInt8();
+        load->isAtomic = getInt8();
+        load->offset = getU32LEB();
+        load->align = getU32LEB();
+        load->ptr = pop();
+        curr = load;
+        break;
+      }
+      case Expression::Id::StoreId: {
+        auto* store = allocator.alloc<Store>();
+        store->bytes = getInt8();
+        store->isAtomic = getInt8();
+        store->valueType = getType();
+        store->offset = getU32LEB();
+        store->align = getU32LEB();
+        store->value = pop();
+        store->ptr = pop();
+        curr = store;
+        break;
+      }
+      case Expression::Id::AtomicRMWId: {
+        auto* rmw = allocator.alloc<AtomicRMW>();
+        rmw->op = AtomicRMWOp(getU32LEB());
+        rmw->bytes = getInt8();
+        rmw->offset = getU32LEB();
+        rmw->value = pop();
+        rmw->ptr = pop();
+        curr = rmw;
+        break;
+      }
+      case Expression::Id::AtomicCmpxchgId: {
+        auto* cmpxchg = allocator.alloc<AtomicCmpxchg>();
+        cmpxchg->bytes = getInt8();
+        cmpxchg->offset = getU32LEB();
+        cmpxchg->replacement = pop();
+        cmpxchg->expected = pop();
+        cmpxchg->ptr = pop();
+        curr = cmpxchg;
+        break;
+      }
+      case Expression::Id::AtomicWaitId: {
+        auto* wait = allocator.alloc<AtomicWait>();
+        wait->expectedType = getType();
+        wait->offset = getU32LEB();
+        wait->timeout = pop();
+        wait->expected = pop();
+        wait->ptr = pop();
+        curr = wait;
+        break;
+      }
+      case Expression::Id::AtomicWakeId: {
+        auto* wake = allocator.alloc<AtomicWake>();
+        wake->offset = getU32LEB();
+        wake->wakeCount = pop();
+        wake->ptr = pop();
+        curr = wake;
+        break;
+      }
+      case Expression::Id::ConstId: {
+        auto* c = allocator.alloc<Const>();
+        auto literalType = getType();
+        auto bits = getU64LEB();
+        switch (literalType) {
+          case i32: c->value = Literal(int32_t(bits)); break;
+          case i64: c->value = Literal(int64_t(bits)); break;
+          case f32: c->value = Literal(int32_t(bits)).castToF32(); break;
+          case f64: c->value = Literal(int64_t(bits)).castToF64(); break;
+          default: c->value = Literal();
+        }
+        curr = c;
+        break;
+      }
+      case Expression::Id::UnaryId: {
+        auto* unary = allocator.alloc<Unary>();
+        unary->op = UnaryOp(getU32LEB());
+        unary->value = pop();
+        curr = unary;
+        break;
+      }
+      case Expression::Id::BinaryId: {
+        auto* binary = allocator.alloc<Binary>();
+        binary->op = BinaryOp(getU32LEB());
+        binary->right = pop();
+        binary->left = pop();
+        curr = binary;
+        break;
+      }
+      case Expression::Id::SelectId: {
+        auto* select = allocator.alloc<Select>();
+        select->condition = pop();
+        select->ifFalse = pop();
+        select->ifTrue = pop();
+        curr = select;
+        break;
+      }
+      case Expression::Id::DropId: {
+        auto* drop = allocator.alloc<Drop>();
+        drop->value = pop();
+        curr = drop;
+        break;
+      }
+      case Expression::Id::ReturnId: {
+        auto* ret = allocator.alloc<Return>();
+        if (getInt8()) ret->value = pop();
+        curr = ret;
+        break;
+      }
+      case Expression::Id::HostId: {
+        auto* host = allocator.alloc<Host>();
+        host->op = HostOp(getU32LEB());
+        host->nameOperand = getName();
+        popList(host->operands, getU32LEB());
+        curr = host;
+        break;
+      }
+      case Expression::Id::NopId: {
+        curr = allocator.alloc<Nop>();
+        break;
+      }
+      case Expression::Id::UnreachableId: {
+        curr = allocator.alloc<Unreachable>();
+        break;
+      }
+      default: throw ParseException("bad expression id in snapshot");
+    }
+    if (stack.size() < base) throw ParseException("bad expression in snapshot");
+    curr->type = type;
+    stack.push_back(curr);
+    if (func) nodes.push_back(curr);
+  }
+  if (stack.size() != base + 1) throw ParseException("bad expression in snapshot");
+  auto* ret = pop();
+  if (func) {
+    auto numLocations = getU32LEB();
+    for (Index i = 0; i < numLocations; i++) {
+      auto index = getU32LEB();
+      if (index >= nodes.size()) throw ParseException("bad debug location in snapshot");
+      auto& loc = func->debugLocations[nodes[index]];
+      loc.fileIndex = getU32LEB();
+      loc.lineNumber = getU32LEB();
+      loc.columnNumber = getU32LEB();
+    }
+  }
+  return ret;
+}
+
+Function* SnapshotReader::getFunction() {
+  auto func = make_unique<Function>();
+  func->name = getName();
+  func->type = getName();
+  func->result = getType();
+  auto numParams = getU32LEB();
+  for (Index i = 0; i < numParams; i++) {
+    func->params.push_back(getType());
+  }
+  auto numVars = getU32LEB();
+  for (Index i = 0; i < numVars; i++) {
+    func->vars.push_back(getType());
+  }
+  auto numLocalNames = getU32LEB();
+  for (Index i = 0; i < numLocalNames; i++) {
+    auto index = getU32LEB();
+    auto name = getName();
+    func->localNames[index] = name;
+    func->localIndices[name] = index;
+  }
+  func->body = getExpression(func.get());
+  return func.release();
+}
+
+void SnapshotReader::read() {
+  if (!Snapshot::isSnapshot(input)) throw ParseException("not a snapshot");
+  pos = 4;
+  if (getInt32() != Snapshot::Version) {
+    throw ParseException("snapshot was written by an incompatible version");
+  }
+  auto getBytes = [&](size_t size) {
+    if (input.size() - pos < size) throw ParseException("unexpected end of snapshot");
+    auto* ret = &input[pos];
+    pos += size;
+    return ret;
+  };
+  auto getString = [&]() {
+    auto size = getU32LEB();
+    auto* data = getBytes(size);
+    return std::string(data, data + size);
+  };
+  auto numStrings = getU32LEB();
+  strings.reserve(numStrings);
+  for (Index i = 0; i < numStrings; i++) {
+    strings.push_back(cashew::IString(getString().c_str(), false));
+  }
+  auto numTypes = getU32LEB();
+  for (Index i = 0; i < numTypes; i++) {
+    auto* type = new FunctionType;
+    type->name = getName();
+    type->result = getType();
+    auto numParams = getU32LEB();
+    for (Index j = 0; j < numParams; j++) {
+      type->params.push_back(getType());
+    }
+    wasm.addFunctionType(type);
+  }
+  auto numImports = getU32LEB();
+  for (Index i = 0; i < numImports; i++) {
+    auto* import = new Import;
+    import->name = getName();
+    import->module = getName();
+    import->base = getName();
+    import->kind = ExternalKind(getInt8());
+    import->functionType = getName();
+    import->globalType = getType();
+    wasm.addImport(import);
+  }
+  auto numExports = getU32LEB();
+  for (Index i = 0; i < numExports; i++) {
+    auto* ex = new Export;
+    ex->name = getName();
+    ex->value = getName();
+    ex->kind = ExternalKind(getInt8());
+    wasm.addExport(ex);
+  }
+  auto numGlobals = getU32LEB();
+  for (Index i = 0; i < numGlobals; i++) {
+    auto* global = new Global;
+    global->name = getName();
+    global->type = getType();
+    global->mutable_ = getInt8();
+    global->init = getExpression();
+    wasm.addGlobal(global);
+  }
+  auto& table = wasm.table;
+  table.exists = getInt8();
+  table.imported = getInt8();
+  table.name = getName();
+  table.initial = getU32LEB();
+  table.max = getU32LEB();
+  auto numTableSegments = getU32LEB();
+  for (Index i = 0; i < numTableSegments; i++) {
+    table.segments.emplace_back(getExpression());
+    auto& data = table.segments.back().data;
+    auto size = getU32LEB();
+    for (Index j = 0; j < size; j++) {
+      data.push_back(getName());
+    }
+  }
+  auto& memory = wasm.memory;
+  memory.exists = getInt8();
+  memory.imported = getInt8();
+  memory.shared = getInt8();
+  memory.name = getName();
+  memory.initial = getU32LEB();
+  memory.max = getU32LEB();
+  auto numMemorySegments = getU32LEB();
+  for (Index i = 0; i < numMemorySegments; i++) {
+    auto* offset = getExpression();
+    auto size = getU32LEB();
+    memory.segments.emplace_back(offset, getBytes(size), size);
+  }
+  auto start = getName();
+  if (start.is()) wasm.addStart(start);
+  auto numUserSections = getU32LEB();
+  for (Index i = 0; i < numUserSections; i++) {
+    wasm.userSections.emplace_back();
+    auto& section = wasm.userSections.back();
+    section.name = getString();
+    auto size = getU32LEB();
+    auto* data = getBytes(size);
+    section.data.assign(data, data + size);
+  }
+  auto numFileNames = getU32LEB();
+  for (Index i = 0; i < numFileNames; i++) {
+    wasm.debugInfoFileNames.push_back(getString());
+  }
+  auto numFunctions = getU32LEB();
+  for (Index i = 0; i < numFunctions; i++) {
+    wasm.addFunction(getFunction());
+  }
+  if (pos != input.size()) throw ParseException("unexpected data at the end of the snapshot");
+}
+
+} // namespace wasm
@@ -34,6 +34,7 @@
 #include "emscripten-optimizer/optimizer.h"
 #include "mixed_arena.h"
 #include "asm_v_wasm.h"
+#include "ir/find_all.h"
 #include "ir/names.h"
 #include "ir/utils.h"
 #include "passes/passes.h"
@@ -141,7 +142,12 @@ public:
 
   Wasm2AsmBuilder(Flags f) : flags(f) {}
 
-  Ref processWasm(Module* wasm, Name funcName = ASM_FUNC);
+  // With lazyFunctions, the functions are left as empty placeholders, which
+  // processLazyFunction() then converts one at a time. Used as a JSPrinter's
+  // expandFunction, that lets each function be printed and freed before the
+  // next is converted.
+  Ref processWasm(Module* wasm, Name funcName = ASM_FUNC, bool lazyFunctions = false);
+  Ref processLazyFunction(Ref placeholder);
   Ref processFunction(Module* wasm, Function* func);
 
   // The first pass on an expression: scan it to see whether it will
@@ -266,6 +272,10 @@ private:
   // All our function tables have the same size TODO: optimize?
   size_t tableSize;
 
+  // Placeholders for functions that are not converted yet
+  Module* lazyModule = nullptr;
+  std::unordered_map<Value*, Function*> lazyFunctions;
+
   bool almostASM = false;
 
   void addBasics(Ref ast);
@@ -299,7 +309,7 @@ private:
   Wasm2AsmBuilder &operator=(const Wasm2AsmBuilder&) = delete;
 };
 
-Ref Wasm2AsmBuilder::processWasm(Module* wasm, Name funcName) {
+Ref Wasm2AsmBuilder::processWasm(Module* wasm, Name funcName, bool lazy) {
   PassRunner runner(wasm);
   runner.add<AutoDrop>();
   // First up remove as many non-JS operations we can, including things like
@@ -370,20 +380,32 @@ Ref Wasm2AsmBuilder::processWasm(Module* wasm, Name funcName) {
     }
   }
   // functions
+  auto addFunction = [&](Function* func) {
+    if (lazy) {
+      Ref placeholder = ValueBuilder::makeFunction(fromName(func->name, NameScope::Top));
+      lazyFunctions[placeholder.inst] = func;
+      asmFunc[3]->push_back(placeholder);
+    } else {
+      asmFunc[3]->push_back(processFunction(wasm, func));
+    }
+  };
+  if (lazy) {
+    lazyModule = wasm;
+  }
   for (auto& func : wasm->functions) {
-    asmFunc[3]->push_back(processFunction(wasm, func.get()));
+    addFunction(func.get());
   }
   if (generateFetchHighBits) {
     Builder builder(allocator);
     std::vector<Type> params;
     std::vector<Type> vars;
-    asmFunc[3]->push_back(processFunction(wasm, builder.makeFunction(
+    addFunction(builder.makeFunction(
       WASM_FETCH_HIGH_BITS,
       std::move(params),
       i32,
       std::move(vars),
       builder.makeGetGlobal(INT64_TO_32_HIGH_BITS, i32)
-    )));
+    ));
     auto e = new Export();
     e->name = WASM_FETCH_HIGH_BITS;
     e->value = WASM_FETCH_HIGH_BITS;
@@ -391,12 +413,36 @@ Ref Wasm2AsmBuilder::processWasm(Module* wasm, Name funcName) {
     wasm->addExport(e);
   }
 
+  if (lazy) {
+    // the functions are converted later, but whether they need almost asm
+    // decides how we emit the exports, which we do now
+    for (auto& func : wasm->functions) {
+      for (auto* host : FindAll<Host>(func->body).list) {
+        if (host->op == HostOp::GrowMemory) {
+          setNeedsAlmostASM("grow_memory op");
+        } else if (host->op == HostOp::CurrentMemory) {
+          setNeedsAlmostASM("current_memory op");
+        }
+      }
+    }
+  }
   addTables(asmFunc[3], wasm);
   // memory XXX
   addExports(asmFunc[3], wasm);
   return ret;
 }
 
+Ref Wasm2AsmBuilder::processLazyFunction(Ref placeholder) {
+  auto iter = lazyFunctions.find(placeholder.inst);
+  if (iter == lazyFunctions.end()) {
+    // not a placeholder, but the module's function, for example
+    return placeholder;
+  }
+  auto* func = iter->second;
+  lazyFunctions.erase(iter);
+  return processFunction(lazyModule, func);
+}
+
 void Wasm2AsmBuilder::addBasics(Ref ast) {
   // heaps, var HEAP8 = new global.Int8Array(buffer); etc
   auto addHeap = [&](IString name, IString view) {
@@ -0,0 +1,47 @@
+(module
+  (type $FUNCSIG$iiii (func (param i32 i32 i32) (result i32)))
+  (type $FUNCSIG$ddd (func (param f64 f64) (result f64)))
+  (type $FUNCSIG$id (func (param f64) (result i32)))
+  (type $FUNCSIG$dd (func (param f64) (result f64)))
+  (type $FUNCSIG$v (func))
+  ;; imports whose behavior we know, so they can be run at compile time
+  (import "env" "_emscripten_memcpy_big" (func $_emscripten_memcpy_big (param i32 i32 i32) (result i32)))
+  (import "env" "_memset" (func $_memset (param i32 i32 i32) (result i32)))
+  (import "asm2wasm" "f64-rem" (func $f64-rem (param f64 f64) (result f64)))
+  (import "asm2wasm" "f64-to-int" (func $f64-to-int (param f64) (result i32)))
+  (import "global.Math" "floor" (func $Math_floor (param f64) (result f64)))
+  ;; a known name, but the wrong signature, so not safe
+  (import "global.Math" "sqrt" (func $Math_sqrt (param f64 f64) (result f64)))
+  (memory 256 256)
+  (data (i32.const 10) "waka waka waka waka waka")
+  (export "test1" $test1)
+  (export "test2" $test2)
+  (export "test3" $test3)
+  (func $test1
+    ;; copy, including an overlapping part, and fill
+    (drop (call $_emscripten_memcpy_big (i32.const 40) (i32.const 10) (i32.const 9)))
+    (drop (call $_emscripten_memcpy_big (i32.const 42) (i32.const 40) (i32.const 4)))
+    (drop (call $_memset (i32.const 11) (i32.const 65) (i32.const 3)))
+  )
+  (func $test2
+    ;; 7.5 % 2 = 1.5, floor(1.5) = 1, and -1e10 wraps around to -1410065408
+    (i32.store8 (i32.const 60)
+      (i32.add
+        (i32.const 48)
+        (call $f64-to-int
+          (call $Math_floor
+            (call $f64-rem (f64.const 7.5) (f64.const 2))
+          )
+        )
+      )
+    )
+    (i32.store (i32.const 64)
+      (call $f64-to-int (f64.const -1e10))
+    )
+  )
+  (func $test3
+    (f64.store (i32.const 72)
+      (call $Math_sqrt (f64.const 4) (f64.const 4))
+    )
+  )
+)
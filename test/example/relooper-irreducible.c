@@ -0,0 +1,101 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "binaryen-c.h"
+
+// Irreducible control flow. Small regions are made reducible by splitting
+// blocks, and larger ones dispatch through the label variable.
+
+static BinaryenModuleRef module;
+
+// a block that prints its id, padded with some work in local 2 to make it
+// larger (local 1 is the label helper)
+static RelooperBlockRef makeBlock(RelooperRef relooper, int id, int padding) {
+  BinaryenExpressionRef list[10];
+  BinaryenIndex num = 0;
+  BinaryenExpressionRef args[] = { BinaryenConst(module, BinaryenLiteralInt32(id)) };
+  list[num++] = BinaryenCallImport(module, "print", args, 1, BinaryenTypeNone());
+  for (int i = 0; i < padding; i++) {
+    list[num++] = BinaryenSetLocal(module, 2,
+      BinaryenBinary(module,
+        BinaryenMulInt32(),
+        BinaryenBinary(module,
+          BinaryenAddInt32(),
+          BinaryenGetLocal(module, 2, BinaryenTypeInt32()),
+          BinaryenConst(module, BinaryenLiteralInt32(id))
+        ),
+        BinaryenGetLocal(module, 0, BinaryenTypeInt32())
+      )
+    );
+  }
+  return RelooperAddBlock(relooper, BinaryenBlock(module, NULL, list, num, BinaryenTypeAuto()));
+}
+
+static BinaryenExpressionRef check(int value) {
+  return BinaryenBinary(module,
+    BinaryenEqInt32(),
+    BinaryenGetLocal(module, 0, BinaryenTypeInt32()),
+    BinaryenConst(module, BinaryenLiteralInt32(value))
+  );
+}
+
+static void addFunction(const char* name, BinaryenFunctionTypeRef type, BinaryenExpressionRef body) {
+  BinaryenType localTypes[] = { BinaryenTypeInt32(), BinaryenTypeInt32() };
+  BinaryenAddFunction(module, name, type, localTypes, 2, body);
+}
+
+int main() {
+  module = BinaryenModuleCreate();
+
+  BinaryenType iparams[] = { BinaryenTypeInt32() };
+  BinaryenFunctionTypeRef vi = BinaryenAddFunctionType(module, "vi",
+                                                       BinaryenTypeNone(),
+                                                       iparams, 1);
+  BinaryenAddFunctionImport(module, "print", "spectest", "print", vi);
+
+  { // a loop entered at two blocks, which are small enough to split
+    RelooperRef relooper = RelooperCreate();
+    RelooperBlockRef entry = makeBlock(relooper, 0, 0);
+    RelooperBlockRef a = makeBlock(relooper, 1, 0);
+    RelooperBlockRef b = makeBlock(relooper, 2, 0);
+    RelooperBlockRef exit = makeBlock(relooper, 3, 0);
+    RelooperAddBranch(entry, a, check(1), NULL);
+    RelooperAddBranch(entry, b, NULL, NULL);
+    RelooperAddBranch(a, b, NULL, NULL);
+    RelooperAddBranch(b, a, check(2), NULL);
+    RelooperAddBranch(b, exit, NULL, NULL);
+    BinaryenExpressionRef body = RelooperRenderAndDispose(relooper, entry, 1, module);
+    addFunction("split", vi, body);
+  }
+
+  { // a loop entered at three blocks, which are too large to split
+    RelooperRef relooper = RelooperCreate();
+    RelooperBlockRef entry = RelooperAddBlockWithSwitch(relooper,
+      BinaryenNop(module),
+      BinaryenGetLocal(module, 0, BinaryenTypeInt32())
+    );
+    RelooperBlockRef a = makeBlock(relooper, 1, 8);
+    RelooperBlockRef b = makeBlock(relooper, 2, 8);
+    RelooperBlockRef c = makeBlock(relooper, 3, 8);
+    RelooperBlockRef exit = makeBlock(relooper, 4, 0);
+    BinaryenIndex toA[] = { 0 };
+    BinaryenIndex toB[] = { 1 };
+    RelooperAddBranchForSwitch(entry, a, toA, 1, NULL);
+    RelooperAddBranchForSwitch(entry, b, toB, 1, NULL);
+    RelooperAddBranchForSwitch(entry, c, NULL, 0, NULL);
+    RelooperAddBranch(a, b, NULL, NULL);
+    RelooperAddBranch(b, c, NULL, NULL);
+    RelooperAddBranch(c, a, check(3), NULL);
+    RelooperAddBranch(c, exit, NULL, NULL);
+    BinaryenExpressionRef body = RelooperRenderAndDispose(relooper, entry, 1, module);
+    addFunction("dispatch", vi, body);
+  }
+
+  assert(BinaryenModuleValidate(module));
+
+  BinaryenModulePrint(module);
+
+  BinaryenModuleDispose(module);
+
+  return 0;
+}
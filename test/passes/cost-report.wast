@@ -0,0 +1,36 @@
+(module
+ (global $g (mut i32) (i32.const 0))
+ (func $direct (param $x i32) (param $y i32) (result i32)
+  (i32.div_s
+   (i32.mul
+    (get_local $x)
+    (get_local $y)
+   )
+   (get_local $y)
+  )
+ )
+ (func $through-local (param $x i32) (param $y i32) (result i32)
+  (local $z i32)
+  (set_local $z
+   (i32.div_s
+    (i32.mul
+     (get_local $x)
+     (get_local $y)
+    )
+    (get_local $y)
+   )
+  )
+  (get_local $z)
+ )
+ (func $through-global (param $x i32) (param $y i32)
+  (set_global $g
+   (i32.div_s
+    (i32.mul
+     (get_local $x)
+     (get_local $y)
+    )
+    (get_local $y)
+   )
+  )
+ )
+)
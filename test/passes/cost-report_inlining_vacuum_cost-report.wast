@@ -0,0 +1,61 @@
+(module
+ (memory 1)
+ (export "add" (func $add))
+ (export "loop" (func $loop))
+ (func $add (param $x i32) (param $y i32) (result i32)
+  (local $z i32)
+  (set_local $z
+   (i32.add
+    (get_local $x)
+    (get_local $y)
+   )
+  )
+  (block $out
+   (br_if $out
+    (i32.eqz
+     (i32.const 0)
+    )
+   )
+   (drop (i32.const 1))
+  )
+  (call $helper
+   (get_local $z)
+  )
+ )
+ (func $helper (param $x i32) (result i32)
+  (i32.mul
+   (get_local $x)
+   (i32.const 1)
+  )
+ )
+ (func $loop (param $n i32) (result i32)
+  (local $i i32)
+  (local $sum i32)
+  (loop $top
+   (set_local $sum
+    (i32.add
+     (get_local $sum)
+     (i32.load
+      (i32.shl
+       (get_local $i)
+       (i32.const 2)
+      )
+     )
+    )
+   )
+   (set_local $i
+    (i32.add
+     (get_local $i)
+     (i32.const 1)
+    )
+   )
+   (br_if $top
+    (i32.lt_s
+     (get_local $i)
+     (get_local $n)
+    )
+   )
+  )
+  (get_local $sum)
+ )
+)
@@ -0,0 +1,46 @@
+(module
+  (global $g (mut i32) (i32.const 0))
+  (table 1 1 anyfunc)
+  (elem (i32.const 0) $in-table)
+  (export "exported" (func $exported))
+  (func $unused-param (param $x i32) (param $y i32) (param $z f64)
+    (set_global $g (get_local $y))
+  )
+  (func $param-only-set (param $x i32)
+    (set_local $x (i32.const 1))
+  )
+  (func $side-effect-operand (param $x i32)
+    (nop)
+  )
+  (func $exported (param $x i32)
+    (nop)
+  )
+  (func $in-table (param $x i32)
+    (nop)
+  )
+  (func $dropped-result (param $x i32) (result i32)
+    (if (get_local $x)
+      (return (i32.const 1))
+    )
+    (i32.const 2)
+  )
+  (func $used-result (result i32)
+    (i32.const 3)
+  )
+  (func $chain (param $x i32)
+    (call $unused-param (get_local $x) (i32.const 4) (f64.const 0))
+  )
+  (func $caller
+    (local $l i32)
+    (call $unused-param (i32.const 1) (i32.const 2) (f64.const 3))
+    (call $param-only-set (i32.const 1))
+    (call $side-effect-operand (call $used-result))
+    (call $side-effect-operand (i32.const 1))
+    (call $exported (i32.const 1))
+    (call $in-table (i32.const 1))
+    (drop (call $dropped-result (i32.const 0)))
+    (drop (call $dropped-result (get_local $l)))
+    (set_local $l (call $used-result))
+    (call $chain (i32.const 5))
+  )
+)
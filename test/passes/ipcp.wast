@@ -0,0 +1,56 @@
+(module
+  (type $FUNCSIG$v (func))
+  (import "env" "imported" (global $imported i32))
+  (global $mutable (mut i32) (i32.const 0))
+  (table 1 1 anyfunc)
+  (elem (i32.const 0) $in-table)
+  (export "exported" (func $exported))
+  (func $same-const (param $x i32) (param $y i32) (result i32)
+    (i32.add (get_local $x) (get_local $y))
+  )
+  (func $same-global (param $x i32) (result i32)
+    (get_local $x)
+  )
+  (func $mutable-global (param $x i32) (result i32)
+    (get_local $x)
+  )
+  (func $exported (param $x i32) (result i32)
+    (get_local $x)
+  )
+  (func $in-table (param $x i32)
+    (drop (get_local $x))
+  )
+  (func $const-return (result i32)
+    (if
+      (get_global $mutable)
+      (return (i32.const 42))
+    )
+    (i32.const 42)
+  )
+  (func $different-returns (result i32)
+    (if
+      (get_global $mutable)
+      (return (i32.const 1))
+    )
+    (i32.const 2)
+  )
+  (func $store-and-return (param $x i32) (result i32)
+    (i32.store (i32.const 0) (get_local $x))
+    (i32.const 7)
+  )
+  (func $body-is-call (param $x i32) (result i32)
+    (call $store-and-return (get_local $x))
+  )
+  (func $caller (param $p i32)
+    (drop (call $same-const (i32.const 1) (get_local $p)))
+    (drop (call $same-const (i32.const 1) (i32.const 2)))
+    (drop (call $same-global (get_global $imported)))
+    (drop (call $same-global (get_global $imported)))
+    (drop (call $mutable-global (get_global $mutable)))
+    (drop (call $exported (i32.const 3)))
+    (call $in-table (i32.const 4))
+    (set_global $mutable (call $const-return))
+    (set_global $mutable (call $different-returns))
+    (set_global $mutable (call $body-is-call (i32.const 5)))
+  )
+)
@@ -0,0 +1,27 @@
+(module
+  (global $g (mut i32) (i32.const 0))
+  (export "caller" (func $caller))
+  (func $dispatch (param $mode i32) (param $x i32) (result i32)
+    (if (i32.eq (get_local $mode) (i32.const 0))
+      (return (i32.add (get_local $x) (i32.const 1)))
+    )
+    (if (i32.eq (get_local $mode) (i32.const 1))
+      (return (i32.mul (get_local $x) (get_local $x)))
+    )
+    (if (i32.eq (get_local $mode) (i32.const 2))
+      (return (i32.sub (get_local $x) (i32.const 7)))
+    )
+    (i32.div_s (get_local $x) (get_local $mode))
+  )
+  (func $no-benefit (param $y i32) (result i32)
+    (i32.add (get_local $y) (get_global $g))
+  )
+  (func $caller (param $p i32) (result i32)
+    (set_global $g (call $dispatch (i32.const 1) (get_local $p)))
+    (set_global $g (call $dispatch (i32.const 1) (get_global $g)))
+    (set_global $g (call $dispatch (get_local $p) (get_local $p)))
+    (set_global $g (call $no-benefit (i32.const 1)))
+    (set_global $g (call $no-benefit (get_local $p)))
+    (get_global $g)
+  )
+)
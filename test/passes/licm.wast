@@ -0,0 +1,102 @@
+(module
+  (memory 1)
+  (global $mutable (mut i32) (i32.const 0))
+  (global $immutable i32 (i32.const 10))
+  (import "env" "call" (func $call))
+  (func $add-of-params (param $x i32) (param $y i32)
+    (loop $loop
+      (i32.store (get_local $x) (i32.add (get_local $x) (get_local $y)))
+      (br_if $loop (i32.const 1))
+    )
+  )
+  (func $param-written-in-loop (param $x i32) (param $y i32)
+    (loop $loop
+      (set_local $x (i32.add (get_local $x) (get_local $y)))
+      (br_if $loop (get_local $x))
+    )
+  )
+  (func $local-set-before-loop (param $x i32)
+    (local $y i32)
+    (set_local $y (i32.mul (get_local $x) (i32.const 3)))
+    (loop $loop
+      (drop (i32.shl (get_local $y) (i32.const 2)))
+      (br_if $loop (get_local $x))
+    )
+  )
+  (func $local-set-after-use (param $x i32)
+    (local $y i32)
+    (loop $loop
+      (drop (i32.shl (get_local $y) (i32.const 2)))
+      (set_local $y (get_local $x))
+      (br_if $loop (get_local $x))
+    )
+  )
+  (func $only-cheap (param $x i32)
+    (loop $loop
+      (drop (get_local $x))
+      (drop (i32.const 1))
+      (br_if $loop (get_local $x))
+    )
+  )
+  (func $trapping (param $x i32) (param $y i32)
+    (loop $loop
+      (drop (i32.div_s (get_local $x) (get_local $y)))
+      (drop (i32.add (get_local $x) (i32.div_u (get_local $x) (get_local $y))))
+      (br_if $loop (get_local $x))
+    )
+  )
+  (func $load (param $x i32)
+    (loop $loop
+      (drop (i32.load (i32.add (get_local $x) (i32.const 4))))
+      (br_if $loop (get_local $x))
+    )
+  )
+  (func $globals (param $x i32)
+    (loop $loop
+      (drop (i32.add (get_global $mutable) (get_global $immutable)))
+      (br_if $loop (get_local $x))
+    )
+  )
+  (func $globals-written (param $x i32)
+    (loop $loop
+      (drop (i32.add (get_global $mutable) (get_local $x)))
+      (set_global $mutable (i32.const 1))
+      (br_if $loop (get_local $x))
+    )
+  )
+  (func $globals-call (param $x i32)
+    (loop $loop
+      (drop (i32.add (get_global $mutable) (get_global $immutable)))
+      (call $call)
+      (br_if $loop (get_local $x))
+    )
+  )
+  (func $nested (param $x i32) (param $y i32)
+    (local $i i32)
+    (loop $outer
+      (loop $inner
+        (i32.store (get_local $i) (i32.mul (get_local $x) (get_local $y)))
+        (br_if $inner (get_local $i))
+      )
+      (set_local $i (i32.add (get_local $i) (i32.const 1)))
+      (br_if $outer (get_local $i))
+    )
+  )
+  (func $nested-outer-dependent (param $x i32) (param $y i32)
+    (local $i i32)
+    (loop $outer
+      (loop $inner
+        (i32.store (get_local $x) (i32.mul (get_local $i) (get_local $y)))
+        (br_if $inner (get_local $x))
+      )
+      (set_local $i (i32.add (get_local $i) (i32.const 1)))
+      (br_if $outer (get_local $i))
+    )
+  )
+  (func $loop-value (param $x i32) (result i32)
+    (loop $loop (result i32)
+      (br_if $loop (get_local $x))
+      (i32.eqz (get_local $x))
+    )
+  )
+)
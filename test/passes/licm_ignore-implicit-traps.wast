@@ -0,0 +1,28 @@
+(module
+  (memory $0 (shared 1 1))
+  (func $trapping (param $x i32) (param $y i32)
+    (loop $loop
+      (drop (i32.div_s (get_local $x) (get_local $y)))
+      (br_if $loop (get_local $x))
+    )
+  )
+  (func $load (param $x i32)
+    (loop $loop
+      (drop (i32.load (i32.add (get_local $x) (i32.const 4))))
+      (br_if $loop (get_local $x))
+    )
+  )
+  (func $load-store (param $x i32)
+    (loop $loop
+      (drop (i32.load (i32.add (get_local $x) (i32.const 4))))
+      (i32.store (get_local $x) (i32.const 1))
+      (br_if $loop (get_local $x))
+    )
+  )
+  (func $atomic-load (param $x i32)
+    (loop $loop
+      (drop (i32.atomic.load (get_local $x)))
+      (br_if $loop (get_local $x))
+    )
+  )
+)
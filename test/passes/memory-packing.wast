@@ -18,3 +18,21 @@
   (data (i32.const 4066) "") ;; empty
 )
 
+(module
+  (import "env" "memory" (memory $0 2048 2048))
+  ;; adjacent segments are merged
+  (data (i32.const 100) "adjacent")
+  (data (i32.const 108) "segments")
+  ;; overlapping segments are merged, with the later ones winning
+  (data (i32.const 200) "overlapping segments")
+  (data (i32.const 212) "SEG")
+  (data (i32.const 195) "some overlap")
+  ;; a short gap is cheaper to keep than a new segment
+  (data (i32.const 300) "short")
+  (data (i32.const 309) "gap")
+  ;; but a gap longer than what a new segment costs is worth skipping
+  (data (i32.const 400) "long\00\00\00\00\00\00\00gap")
+  ;; zeros written by a later segment are skipped too
+  (data (i32.const 500) "zeroed out")
+  (data (i32.const 500) "\00\00\00\00\00\00\00")
+)
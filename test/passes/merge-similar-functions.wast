@@ -0,0 +1,83 @@
+(module
+  (type $0 (func (param i32) (result i32)))
+  (table 1 1 anyfunc)
+  (elem (i32.const 0) $callee-b)
+  (memory $0 10)
+  ;; these differ only in constants
+  (func $const-a (param $x i32) (result i32)
+    (i32.store (get_local $x) (i32.const 100))
+    (i32.store offset=4 (get_local $x) (i32.const 200))
+    (i32.store offset=8 (get_local $x) (i32.const 300))
+    (i32.add (i32.load (get_local $x)) (i32.const 1))
+  )
+  (func $const-b (param $x i32) (result i32)
+    (i32.store (get_local $x) (i32.const 100))
+    (i32.store offset=4 (get_local $x) (i32.const 200))
+    (i32.store offset=8 (get_local $x) (i32.const 300))
+    (i32.add (i32.load (get_local $x)) (i32.const 2))
+  )
+  (func $const-c (param $x i32) (result i32)
+    (local $y i32)
+    (set_local $y (i32.const 100))
+    (i32.store (get_local $x) (get_local $y))
+    (i32.store offset=4 (get_local $x) (i32.const 200))
+    (i32.store offset=8 (get_local $x) (i32.const 300))
+    (i32.add (i32.load (get_local $x)) (i32.const 3))
+  )
+  ;; holes with the same values share a param
+  (func $shared-a (param $x i32)
+    (local $y i32)
+    (set_local $y (i32.const 10))
+    (i32.store (get_local $x) (get_local $y))
+    (i32.store offset=4 (get_local $x) (i32.const 10))
+    (i32.store offset=8 (get_local $x) (i32.const 20))
+    (i32.store offset=12 (get_local $x) (i32.const 30))
+  )
+  (func $shared-b (param $x i32)
+    (local $y i32)
+    (set_local $y (i32.const 11))
+    (i32.store (get_local $x) (get_local $y))
+    (i32.store offset=4 (get_local $x) (i32.const 11))
+    (i32.store offset=8 (get_local $x) (i32.const 20))
+    (i32.store offset=12 (get_local $x) (i32.const 30))
+  )
+  ;; these differ in a call target
+  (func $callee-a (param $x i32) (result i32)
+    (i32.add (get_local $x) (i32.const 1))
+  )
+  (func $callee-b (param $x i32) (result i32)
+    (i32.sub (get_local $x) (i32.const 1))
+  )
+  (func $call-a (param $x i32) (result i32)
+    (i32.store (get_local $x) (i32.const 100))
+    (i32.store offset=4 (get_local $x) (i32.const 200))
+    (i32.store offset=8 (get_local $x) (i32.const 300))
+    (call $callee-a (i32.load (get_local $x)))
+  )
+  (func $call-b (param $x i32) (result i32)
+    (i32.store (get_local $x) (i32.const 100))
+    (i32.store offset=4 (get_local $x) (i32.const 200))
+    (i32.store offset=8 (get_local $x) (i32.const 300))
+    (call $callee-b (i32.load (get_local $x)))
+  )
+  ;; too small to be worth it
+  (func $small-a (result i32)
+    (i32.const 1)
+  )
+  (func $small-b (result i32)
+    (i32.const 2)
+  )
+  ;; different types
+  (func $type-a (param $x i32)
+    (i32.store (get_local $x) (i32.const 100))
+    (i32.store offset=4 (get_local $x) (i32.const 200))
+    (i32.store offset=8 (get_local $x) (i32.const 300))
+    (drop (i32.const 1))
+  )
+  (func $type-b (param $x i32)
+    (i32.store (get_local $x) (i32.const 100))
+    (i32.store offset=4 (get_local $x) (i32.const 200))
+    (i32.store offset=8 (get_local $x) (i32.const 300))
+    (drop (i64.const 1))
+  )
+)
@@ -0,0 +1,14 @@
+(module
+  (type $i (func (result i32)))
+  (func $call-table (type $i) (result i32)
+    (call_indirect (type $i)
+      (i32.const 0)
+    )
+  )
+  (func $read-global (type $i) (result i32)
+    (get_global $g)
+  )
+  (table 1 1 anyfunc)
+  (elem (i32.const 0) $read-global)
+  (global $g (mut i32) (i32.const 42))
+)
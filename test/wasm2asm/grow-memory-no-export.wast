@@ -0,0 +1,15 @@
+(module
+ (memory $0 1)
+ (export "grow" (func $grow))
+ (export "size" (func $size))
+ (func $grow (param $0 i32) (result i32)
+  (grow_memory (get_local $0))
+ )
+ (func $size (result i32)
+  (current_memory)
+ )
+)
+
+(assert_return (invoke "size") (i32.const 1))
+(assert_return (invoke "grow" (i32.const 1)) (i32.const 1))
+(assert_return (invoke "size") (i32.const 2))